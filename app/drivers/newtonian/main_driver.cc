@@ -45,6 +45,7 @@
 #include "default_physics.h"
 #include "analysis.h"
 #include "diagnostic.h"
+#include "initial_data.h"
 
 #define OUTPUT_ANALYSIS
 
@@ -98,8 +99,17 @@ mpi_init_task(const char * parameter_file){
 
   // read input file
   body_system<double,gdimension> bs;
-  bs.read_bodies(initial_data_prefix,
-      output_h5data_prefix,initial_iteration);
+  if(initial_data_generator[0] != '\0'){
+    // generate the particles of this rank in memory: its slabs of the
+    // lattice, which the first update_iteration sorts by keys
+    initial_data::select(initial_data_generator);
+    std::vector<body> bodies;
+    initial_data::generate(bodies);
+    bs.setLocalbodies(std::move(bodies));
+  }
+  else
+    bs.read_bodies(initial_data_prefix,
+        output_h5data_prefix,initial_iteration);
   bs.setMacangle(param::fmm_macangle);
   bs.setMaxmasscell(param::fmm_max_cell_mass);
 
@@ -109,6 +119,10 @@ mpi_init_task(const char * parameter_file){
     analysis::screen_output(rank);
     MPI_Barrier(MPI_COMM_WORLD);
 
+    // The timestep is computed in the last sweep of the step, unless the
+    // smoothing length changes after it
+    bool dt_computed = false;
+
     if (physics::iteration == param::initial_iteration){
 
       clog_one(trace)<<"First iteration"<<std::endl << std::flush;
@@ -120,14 +134,39 @@ mpi_init_task(const char * parameter_file){
       }
 
       clog_one(trace) << "compute density pressure cs" << std::flush;
-      bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
+      if(sph_variable_h){
+        bs.apply_in_smoothinglength_variable_h(physics::compute_density_h,
+          physics::compute_density);
+        if(eos_batch)
+          physics::compute_pressure_soundspeed_batch(bs.getLocalbodies());
+        else
+          bs.apply_all(physics::compute_pressure_soundspeed);
+      }
+      else if(eos_batch){
+        if(sph_symmetric_interactions)
+          bs.apply_in_smoothinglength_symmetric<double>(
+            physics::pair_density,physics::finalize_density);
+        else
+          bs.apply_in_smoothinglength(physics::compute_density);
+        physics::compute_pressure_soundspeed_batch(bs.getLocalbodies());
+      }
+      else if(sph_symmetric_interactions)
+        bs.apply_in_smoothinglength_symmetric<double>(
+          physics::pair_density,
+          physics::finalize_density_pressure_soundspeed);
+      else
+        bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
       bs.apply_all(integration::save_velocityhalf);
 
       // necessary for computing dv/dt and du/dt in the next step
       bs.reset_ghosts();
 
       clog_one(trace) << "compute rhs of evolution equations" <<std::endl<< std::flush;
-      bs.apply_in_smoothinglength(physics::compute_acceleration);
+      if(sph_symmetric_interactions)
+        bs.apply_in_smoothinglength_symmetric<point_t>(
+          physics::pair_acceleration,physics::finalize_acceleration);
+      else
+        bs.apply_in_smoothinglength(physics::compute_acceleration);
       clog_one(trace) << "compute gravitation" <<std::endl<< std::flush;
       bs.gravitation_fmm();
       if (thermokinetic_formulation){
@@ -135,35 +174,55 @@ mpi_init_task(const char * parameter_file){
         bs.apply_in_smoothinglength(physics::compute_dedt);
       }else{
         clog_one(trace) << "compute dudt" << std::flush;
-        bs.apply_in_smoothinglength(physics::compute_dudt);
+        if(sph_symmetric_interactions)
+          bs.apply_in_smoothinglength_symmetric<double>(
+            physics::pair_dudt,physics::finalize_dudt);
+        else
+          bs.apply_in_smoothinglength(physics::compute_dudt);
       }
       clog_one(trace) << ".done" << std::endl;
 
     }
     else {
-      clog_one(trace) << "leapfrog: kick one" << std::flush;
-      bs.apply_all(integration::leapfrog_kick_v);
-      if (thermokinetic_formulation)
-        bs.apply_all(integration::leapfrog_kick_e);
-      else
-        bs.apply_all(integration::leapfrog_kick_u);
-      bs.apply_all(integration::save_velocityhalf);
-      clog_one(trace) << ".done" << std::endl;
-
-      clog_one(trace) << "leapfrog: drift" << std::flush;
-      bs.apply_all(integration::leapfrog_drift);
+      clog_one(trace) << "leapfrog: kick one and drift" << std::flush;
+      bs.apply_all(integration::leapfrog_kick_drift);
       clog_one(trace) << ".done" << std::endl;
 
       // sync velocities
       bs.update_iteration();
       clog_one(trace) << "compute density pressure cs"<<std::endl << std::flush;
-      bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
+      if(sph_variable_h){
+        bs.apply_in_smoothinglength_variable_h(physics::compute_density_h,
+          physics::compute_density);
+        if(eos_batch)
+          physics::compute_pressure_soundspeed_batch(bs.getLocalbodies());
+        else
+          bs.apply_all(physics::compute_pressure_soundspeed);
+      }
+      else if(eos_batch){
+        if(sph_symmetric_interactions)
+          bs.apply_in_smoothinglength_symmetric<double>(
+            physics::pair_density,physics::finalize_density);
+        else
+          bs.apply_in_smoothinglength(physics::compute_density);
+        physics::compute_pressure_soundspeed_batch(bs.getLocalbodies());
+      }
+      else if(sph_symmetric_interactions)
+        bs.apply_in_smoothinglength_symmetric<double>(
+          physics::pair_density,
+          physics::finalize_density_pressure_soundspeed);
+      else
+        bs.apply_in_smoothinglength(physics::compute_density_pressure_soundspeed);
 
       // Sync density/pressure/cs
       bs.reset_ghosts();
 
 
-      bs.apply_in_smoothinglength(physics::compute_acceleration);
+      if(sph_symmetric_interactions)
+        bs.apply_in_smoothinglength_symmetric<point_t>(
+          physics::pair_acceleration,physics::finalize_acceleration);
+      else
+        bs.apply_in_smoothinglength(physics::compute_acceleration);
       clog_one(trace) << "compute gravitation"<<std::endl << std::flush;
       bs.gravitation_fmm();
       clog_one(trace) << "leapfrog: kick two (velocity)" << std::flush;
@@ -177,21 +236,27 @@ mpi_init_task(const char * parameter_file){
       if (thermokinetic_formulation) {
         clog_one(trace) << "compute dedt" << std::flush;
         bs.apply_in_smoothinglength(physics::compute_dedt);
-        bs.apply_all(integration::leapfrog_kick_e);
       }
       else {
         clog_one(trace) << "compute dudt" << std::flush;
-        bs.apply_in_smoothinglength(physics::compute_dudt);
-        bs.apply_all(integration::leapfrog_kick_u);
+        if(sph_symmetric_interactions)
+          bs.apply_in_smoothinglength_symmetric<double>(
+            physics::pair_dudt,physics::finalize_dudt);
+        else
+          bs.apply_in_smoothinglength(physics::compute_dudt);
       }
+      dt_computed = adaptive_timestep &&
+          (sph_variable_h || !sph_update_uniform_h);
+      if (dt_computed)
+        bs.apply_all_fused(integration::leapfrog_kick_energy,
+            physics::compute_dt);
+      else
+        bs.apply_all(integration::leapfrog_kick_energy);
       clog_one(trace) << ".done" << std::endl;
     }
 
-    if(sph_variable_h){
-      clog_one(trace) << "updating smoothing length"<<std::flush;
-      bs.get_all(physics::compute_smoothinglength);
-      clog_one(trace) << ".done" << std::endl << std::flush;
-    }else if(sph_update_uniform_h){
+    // With sph_variable_h the smoothing length is solved with the density
+    if(!sph_variable_h && sph_update_uniform_h){
       // The particles moved, compute new smoothing length
       clog_one(trace) << "updating smoothing length"<<std::flush;
       bs.get_all(physics::compute_average_smoothinglength,bs.getNBodies());
@@ -201,25 +266,49 @@ mpi_init_task(const char * parameter_file){
     if (adaptive_timestep) {
       // Update timestep
       clog_one(trace) << "compute adaptive timestep" << std::flush;
-      bs.apply_all(physics::compute_dt);
+      if (!dt_computed)
+        bs.apply_all(physics::compute_dt);
       bs.get_all(physics::set_adaptive_timestep);
       clog_one(trace) << ".done" << std::endl;
     }
 
     // Output scalar reductions
-    analysis::scalar_output(bs, rank);
-    diagnostic::output(bs, rank);
+    {
+      timers::scoped_timer timer("analysis");
+      analysis::scalar_output(bs, rank);
+      analysis::grid_output(bs,rank);
+      diagnostic::output(bs, rank);
+      // One pass and one reduction for both, completed in the next step
+      reductions::start(bs.getLocalbodies());
+    }
+
+    if(out_checkpoint_every > 0 &&
+        physics::iteration % out_checkpoint_every == 0){
+      bs.write_checkpoint(output_h5data_prefix,physics::iteration,
+          physics::totaltime);
+    }
 
     if(out_h5data_every > 0 && physics::iteration % out_h5data_every == 0){
       bs.write_bodies(output_h5data_prefix,physics::iteration,
           physics::totaltime);
     }
-    MPI_Barrier(MPI_COMM_WORLD);
+
+    // Per-phase timings, reduced over the ranks
+    if(out_scalar_every > 0 && physics::iteration % out_scalar_every == 0)
+      timers::output(physics::iteration);
+
     ++physics::iteration;
 
     physics::totaltime += physics::dt;
 
   } while(physics::iteration <= final_iteration);
+
+  // Wait for the last reductions and the snapshots still written in
+  // background
+  reductions::wait();
+  bs.flush_bodies();
+  // Release the node shared EOS table before MPI_Finalize
+  eos::sc().free();
 } // mpi_init_task
 
 
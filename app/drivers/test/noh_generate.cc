@@ -0,0 +1,20 @@
+#include <cinchdevel.h>
+#include <cinchtest.h>
+
+#include <iostream>
+#include <cmath>
+
+#include <mpi.h>
+
+namespace flecsi{
+namespace execution{
+  void mpi_init_task(const char * parameter_file);
+}
+}
+
+using namespace flecsi;
+using namespace execution;
+
+TEST(noh, generate) {
+  mpi_init_task("noh_nx20_generate.par");
+}
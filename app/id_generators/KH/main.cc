@@ -44,6 +44,8 @@ static point_t bbox_min, bbox_max;
 static int64_t np_middle = 0; // number of particles in the middle block
 static int64_t np_top = 0;    // number of particles in the top block
 static int64_t np_bottom = 0; // number of particles in the bottom block
+// sub-blocks of the rank in the middle, top and bottom blocks
+static particle_lattice::block_t rank_middle, rank_top, rank_bottom;
 static double sph_sep_tb = 0; // particle separation in top or bottom blocks
 static double pmass = 0;      // particle mass in the middle block
 static double pmass_tb = 0;   // particle mass in top or bottom blocks
@@ -140,13 +142,16 @@ void set_derived_params() {
   bbox_max[1] = mbox_min[1] - 0.5*(dy_tb + dy) + dy;
   bbox_min[1] = bbox_max[1] - bbox_width - dy_tb;
 
-  // count the number of particles
-  np_middle = particle_lattice::count(lattice_type,gdimension,mbox_min,mbox_max,
-                                      sph_separation,0);
-  np_top    = particle_lattice::count(lattice_type,gdimension,tbox_min,tbox_max,
-                                      sph_sep_tb, np_middle);
-  np_bottom = particle_lattice::count(lattice_type,gdimension,bbox_min,bbox_max,
-                                      sph_sep_tb, np_middle + np_top);
+  // split the blocks over the ranks and count the particles
+  rank_middle = particle_lattice::partition(lattice_type,gdimension,
+                                      mbox_min,mbox_max,sph_separation);
+  rank_top    = particle_lattice::partition(lattice_type,gdimension,
+                                      tbox_min,tbox_max,sph_sep_tb);
+  rank_bottom = particle_lattice::partition(lattice_type,gdimension,
+                                      bbox_min,bbox_max,sph_sep_tb);
+  np_middle = rank_middle.total;
+  np_top    = rank_top.total;
+  np_bottom = rank_bottom.total;
 
   SET_PARAM(nparticles, np_middle + np_bottom + np_top);
 
@@ -180,45 +185,50 @@ int main(int argc, char * argv[]){
   set_derived_params();
 
   // screen output
-  std::cout << "Kelvin-Helmholtz instability setup in " << gdimension
+  clog_one(info) << "Kelvin-Helmholtz instability setup in " << gdimension
        << "D:" << std::endl << " - number of particles: " << nparticles << std::endl
        << " - generated initial data file: " << initial_data_file << std::endl;
 
-  // allocate arrays
+  // allocate the arrays of the particles of this rank
+  const int64_t nm = rank_middle.nlocal, nt = rank_top.nlocal;
+  const int64_t nlocal = nm + nt + rank_bottom.nlocal;
   // Position
-  double* x = new double[nparticles]();
-  double* y = new double[nparticles]();
-  double* z = new double[nparticles]();
+  double* x = new double[nlocal]();
+  double* y = new double[nlocal]();
+  double* z = new double[nlocal]();
   // Velocity
-  double* vx = new double[nparticles]();
-  double* vy = new double[nparticles]();
-  double* vz = new double[nparticles]();
+  double* vx = new double[nlocal]();
+  double* vy = new double[nlocal]();
+  double* vz = new double[nlocal]();
   // Acceleration
-  double* ax = new double[nparticles]();
-  double* ay = new double[nparticles]();
-  double* az = new double[nparticles]();
+  double* ax = new double[nlocal]();
+  double* ay = new double[nlocal]();
+  double* az = new double[nlocal]();
   // Smoothing length
-  double* h = new double[nparticles]();
+  double* h = new double[nlocal]();
   // Density
-  double* rho = new double[nparticles]();
+  double* rho = new double[nlocal]();
   // Internal Energy
-  double* u = new double[nparticles]();
+  double* u = new double[nlocal]();
   // Pressure
-  double* P = new double[nparticles]();
+  double* P = new double[nlocal]();
   // Mass
-  double* m = new double[nparticles]();
+  double* m = new double[nlocal]();
   // Id
-  int64_t* id = new int64_t[nparticles]();
+  int64_t* id = new int64_t[nlocal]();
   // Timestep
-  double* dt = new double[nparticles]();
-
-  // generate the lattice
-  assert (np_middle == particle_lattice::generate( lattice_type,gdimension,
-          mbox_min,mbox_max,sph_separation,0,x,y,z));
-  assert (np_top    == particle_lattice::generate( lattice_type,gdimension,
-          tbox_min,tbox_max,sph_sep_tb,np_middle,x,y,z));
-  assert (np_bottom == particle_lattice::generate( lattice_type,gdimension,
-          bbox_min,bbox_max,sph_sep_tb,nparticles-np_bottom,x,y,z));
+  double* dt = new double[nlocal]();
+
+  // generate the sub-blocks of the lattice
+  int64_t ngen = particle_lattice::generate_block( lattice_type,gdimension,
+          mbox_min,mbox_max,sph_separation,rank_middle,0,x,y,z);
+  assert (ngen == nm);
+  ngen = particle_lattice::generate_block( lattice_type,gdimension,
+          tbox_min,tbox_max,sph_sep_tb,rank_top,nm,x,y,z);
+  assert (ngen == nt);
+  ngen = particle_lattice::generate_block( lattice_type,
+          gdimension,bbox_min,bbox_max,sph_sep_tb,rank_bottom,nm+nt,x,y,z);
+  assert (ngen == nlocal-nm-nt);
 
   // max. value for the speed of sound
   double cs = sqrt(poly_gamma*std::max(pressure_1/rho_1,pressure_2/rho_2));
@@ -227,10 +237,12 @@ int main(int argc, char * argv[]){
   double timestep = timestep_cfl_factor
                   * sph_separation/std::max(cs, flow_velocity);
 
-  // particle id number
-  int64_t posid = 0;
-  for(int64_t part=0; part<nparticles; ++part){
-    id[part] = posid++;
+  // particle id number: the one of the serial generation, with the middle,
+  // top and bottom blocks one after the other
+  for(int64_t part=0; part<nlocal; ++part){
+    id[part] = part < nm ? rank_middle.offset + part
+             : part < nm + nt ? np_middle + rank_top.offset + part - nm
+             : np_middle + np_top + rank_bottom.offset + part - nm - nt;
     if (particle_lattice::in_domain_1d(y[part],
         mbox_min[1], mbox_max[1], domain_type)) {
       P[part] = pressure_1;
@@ -263,8 +275,10 @@ int main(int argc, char * argv[]){
 
   } // for part=0..nparticles
 
-  // delete the output file if exists
-  remove(initial_data_file.c_str());
+  // remove the previous file before its collective creation
+  if (rank == 0)
+    remove(initial_data_file.c_str());
+  MPI_Barrier(MPI_COMM_WORLD);
 
   hid_t dataFile = H5P_openFile(initial_data_file.c_str(),H5F_ACC_RDWR);
 
@@ -276,21 +290,21 @@ int main(int argc, char * argv[]){
   H5P_writeAttribute(dataFile,"dimension",&dim);
   H5P_writeAttribute(dataFile,"use_fixed_timestep",&use_fixed_timestep);
 
-  H5P_setNumParticles(nparticles);
+  H5P_setNumParticles(nlocal);
   H5P_setStep(dataFile,0);
 
   //H5PartSetNumParticles(dataFile,nparticles);
-  H5P_writeDataset(dataFile,"x",x,nparticles);
-  H5P_writeDataset(dataFile,"y",y,nparticles);
-  H5P_writeDataset(dataFile,"z",z,nparticles);
-  H5P_writeDataset(dataFile,"vx",vx,nparticles);
-  H5P_writeDataset(dataFile,"vy",vy,nparticles);
-  H5P_writeDataset(dataFile,"h",h,nparticles);
-  H5P_writeDataset(dataFile,"rho",rho,nparticles);
-  H5P_writeDataset(dataFile,"u",u,nparticles);
-  H5P_writeDataset(dataFile,"P",P,nparticles);
-  H5P_writeDataset(dataFile,"m",m,nparticles);
-  H5P_writeDataset(dataFile,"id",id,nparticles);
+  H5P_writeDataset(dataFile,"x",x,nlocal);
+  H5P_writeDataset(dataFile,"y",y,nlocal);
+  H5P_writeDataset(dataFile,"z",z,nlocal);
+  H5P_writeDataset(dataFile,"vx",vx,nlocal);
+  H5P_writeDataset(dataFile,"vy",vy,nlocal);
+  H5P_writeDataset(dataFile,"h",h,nlocal);
+  H5P_writeDataset(dataFile,"rho",rho,nlocal);
+  H5P_writeDataset(dataFile,"u",u,nlocal);
+  H5P_writeDataset(dataFile,"P",P,nlocal);
+  H5P_writeDataset(dataFile,"m",m,nlocal);
+  H5P_writeDataset(dataFile,"id",id,nlocal);
 
   H5P_closeFile(dataFile);
 
@@ -41,6 +41,7 @@ static double timestep = 1.0;         // Recommended timestep
 static double total_mass = 1.;        // total mass of the fluid
 static double mass_particle = 1.;     // mass of an individual particle
 static point_t bbox_max, bbox_min;    // bounding box of the domain
+static particle_lattice::block_t block; // sub-block of the lattice of the rank
 static std::string initial_data_file; // = initial_data_prefix + ".h5part"
 
 void set_derived_params() {
@@ -75,11 +76,10 @@ void set_derived_params() {
     SET_PARAM(sph_separation, (2.*sphere_radius/(lattice_nx-1)));
   }
 
-  // Count number of particles
-  int64_t tparticles =
-      particle_lattice::count(lattice_type,domain_type,
-      bbox_min,bbox_max,sph_separation,0);
-  SET_PARAM(nparticles, tparticles);
+  // Split the lattice over the ranks and count the particles
+  block = particle_lattice::partition(lattice_type,domain_type,
+      bbox_min,bbox_max,sph_separation);
+  SET_PARAM(nparticles, block.total);
 
   // total mass
   if (gdimension < 3) {
@@ -143,44 +143,46 @@ int main(int argc, char * argv[]){
   param::mpi_read_params(argv[1]);
   set_derived_params();
 
-  // Initialize the arrays to be filled later
+  // Initialize the arrays of the particles of this rank
+  const int64_t nlocal = block.nlocal;
   // Position
-  double* x = new double[nparticles]();
-  double* y = new double[nparticles]();
-  double* z = new double[nparticles]();
+  double* x = new double[nlocal]();
+  double* y = new double[nlocal]();
+  double* z = new double[nlocal]();
   // Velocity
-  double* vx = new double[nparticles]();
-  double* vy = new double[nparticles]();
-  double* vz = new double[nparticles]();
+  double* vx = new double[nlocal]();
+  double* vy = new double[nlocal]();
+  double* vz = new double[nlocal]();
   // Acceleration
-  double* ax = new double[nparticles]();
-  double* ay = new double[nparticles]();
-  double* az = new double[nparticles]();
+  double* ax = new double[nlocal]();
+  double* ay = new double[nlocal]();
+  double* az = new double[nlocal]();
   // Smoothing length
-  double* h = new double[nparticles]();
+  double* h = new double[nlocal]();
   // Density
-  double* rho = new double[nparticles]();
+  double* rho = new double[nlocal]();
   // Internal Energy
-  double* u = new double[nparticles]();
+  double* u = new double[nlocal]();
   // Pressure
-  double* P = new double[nparticles]();
+  double* P = new double[nlocal]();
   // Mass
-  double* m = new double[nparticles]();
+  double* m = new double[nlocal]();
   // Id
-  int64_t* id = new int64_t[nparticles]();
+  int64_t* id = new int64_t[nlocal]();
   // Timestep
-  double* dt = new double[nparticles]();
+  double* dt = new double[nlocal]();
 
-  // Generate the lattice
-  assert(nparticles ==
-      particle_lattice::generate(lattice_type,domain_type,
-      bbox_min,bbox_max,sph_separation,0, x, y, z));
+  // Generate the sub-block of the lattice
+  int64_t ngen =
+      particle_lattice::generate_block(lattice_type,domain_type,
+      bbox_min,bbox_max,sph_separation,block,0, x, y, z);
+  assert(ngen == nlocal);
 
   // Particle id number
-  int64_t posid = 0;
+  int64_t posid = block.offset;
 
   // Assign density, pressure and specific internal energy to particles
-  for(int64_t part=0; part<nparticles; ++part){
+  for(int64_t part=0; part<nlocal; ++part){
     m[part] = mass_particle;
     P[part] = pressure_initial;
     rho[part] = rho_initial;
@@ -189,10 +191,12 @@ int main(int argc, char * argv[]){
     id[part] = posid++;
   }
 
-  clog(info) << "Number of particles: " << nparticles << std::endl;
+  clog_one(info) << "Number of particles: " << nparticles << std::endl;
 
-  // remove the previous file
-  remove(initial_data_file.c_str());
+  // remove the previous file before its collective creation
+  if (rank == 0)
+    remove(initial_data_file.c_str());
+  MPI_Barrier(MPI_COMM_WORLD);
 
   hid_t dataFile = H5P_openFile(initial_data_file.c_str(),H5F_ACC_RDWR);
 
@@ -204,21 +208,21 @@ int main(int argc, char * argv[]){
   H5P_writeAttribute(dataFile,"dimension",&dim);
   H5P_writeAttribute(dataFile,"use_fixed_timestep",&use_fixed_timestep);
 
-  H5P_setNumParticles(nparticles);
+  H5P_setNumParticles(nlocal);
   H5P_setStep(dataFile,0);
 
   //H5PartSetNumParticles(dataFile,nparticles);
-  H5P_writeDataset(dataFile,"x",x,nparticles);
-  H5P_writeDataset(dataFile,"y",y,nparticles);
-  H5P_writeDataset(dataFile,"z",z,nparticles);
-  H5P_writeDataset(dataFile,"vx",vx,nparticles);
-  H5P_writeDataset(dataFile,"vy",vy,nparticles);
-  H5P_writeDataset(dataFile,"h",h,nparticles);
-  H5P_writeDataset(dataFile,"rho",rho,nparticles);
-  H5P_writeDataset(dataFile,"u",u,nparticles);
-  H5P_writeDataset(dataFile,"P",P,nparticles);
-  H5P_writeDataset(dataFile,"m",m,nparticles);
-  H5P_writeDataset(dataFile,"id",id,nparticles);
+  H5P_writeDataset(dataFile,"x",x,nlocal);
+  H5P_writeDataset(dataFile,"y",y,nlocal);
+  H5P_writeDataset(dataFile,"z",z,nlocal);
+  H5P_writeDataset(dataFile,"vx",vx,nlocal);
+  H5P_writeDataset(dataFile,"vy",vy,nlocal);
+  H5P_writeDataset(dataFile,"h",h,nlocal);
+  H5P_writeDataset(dataFile,"rho",rho,nlocal);
+  H5P_writeDataset(dataFile,"u",u,nlocal);
+  H5P_writeDataset(dataFile,"P",P,nlocal);
+  H5P_writeDataset(dataFile,"m",m,nlocal);
+  H5P_writeDataset(dataFile,"id",id,nlocal);
 
   H5P_closeFile(dataFile);
 
@@ -0,0 +1,59 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file initial_data.h
+ * @brief Registry of the initial data generators which the drivers can run
+ * in memory instead of reading the initial data file: with
+ * initial_data_generator set, each rank generates its slabs of the lattice
+ * of the problem, the same particles as the generator writes.
+ */
+
+#ifndef _initial_data_h_
+#define _initial_data_h_
+
+#include <vector>
+#include <boost/algorithm/string.hpp>
+
+#include "sodtube.h"
+#include "noh.h"
+#include "sedov.h"
+
+namespace initial_data {
+
+  typedef void (*set_derived_params_t)();
+  typedef void (*generate_t)(std::vector<body>&);
+
+  set_derived_params_t set_derived_params = nullptr;
+  generate_t generate = nullptr;
+
+/**
+ * @brief  Installs the 'set_derived_params' and 'generate' function
+ *         pointers of the generator named initial_data_generator.
+ *         Collective: the lattice is split over the ranks.
+ */
+void select(const std::string& initial_data_generator) {
+  if(boost::iequals(initial_data_generator, "sodtube")) {
+    set_derived_params = sodtube::set_derived_params;
+    generate = sodtube::generate;
+  }
+  else if(boost::iequals(initial_data_generator, "noh")) {
+    set_derived_params = noh::set_derived_params;
+    generate = noh::generate;
+  }
+  else if(boost::iequals(initial_data_generator, "sedov")) {
+    set_derived_params = sedov::set_derived_params;
+    generate = sedov::generate;
+  }
+  else {
+    clog_fatal("Bad initial_data_generator parameter: "
+        << initial_data_generator << std::endl);
+  }
+  set_derived_params();
+}
+
+} // namespace initial_data
+
+#endif // _initial_data_h_
@@ -29,4 +29,114 @@
 #define INTERNAL_ENERGY
 #define OUTPUT
 
+#include <vector>
+#include <math.h>
+
+#include "user.h"
+#include "params.h"
+#include "lattice.h"
+#include "kernels.h"
+
+/**
+ * The Noh collapse initial data: a disk or sphere of homogeneous density
+ * falling inwards. Shared by the generator and the drivers, which generate
+ * it in memory with initial_data_generator = "noh".
+ */
+namespace noh {
+
+//
+// derived parameters
+//
+static double total_mass = 1.;        // total mass of the fluid
+static double mass_particle = 1.;     // mass of an individual particle
+static point_t bbox_max, bbox_min;    // bounding box of the domain
+static particle_lattice::block_t block; // sub-block of the lattice of the rank
+
+void set_derived_params() {
+  using namespace param;
+  particle_lattice::select();
+
+  // Bounding box of the domain
+  bbox_min = -sphere_radius;
+  bbox_max =  sphere_radius;
+
+  // particle separation
+  SET_PARAM(sph_separation, (2.*sphere_radius/(lattice_nx-1)));
+
+  // Split the lattice over the ranks and count the particles
+  block = particle_lattice::partition(lattice_type,domain_type,
+      bbox_min,bbox_max,sph_separation);
+  SET_PARAM(nparticles, block.total);
+
+  // total mass
+  if (gdimension == 2) {
+    total_mass = rho_initial * M_PI*sphere_radius*sphere_radius;
+  }
+  else if (gdimension == 3) {
+    total_mass = rho_initial * 4./3.*M_PI*sphere_radius*sphere_radius*sphere_radius;
+  }
+  else
+    assert (false);
+
+  // single particle mass
+  assert (equal_mass);
+  mass_particle = total_mass / nparticles;
+
+  // set kernel
+  kernels::select();
+
+  // smoothing length
+  const double sph_h = sph_eta * kernels::kernel_width
+                               * pow(mass_particle/rho_initial,1./gdimension);
+  SET_PARAM(sph_smoothing_length, sph_h);
+
+  // intial internal energy
+  SET_PARAM(uint_initial, (pressure_initial/(rho_initial*(poly_gamma-1.0))));
+}
+
+/**
+ * @brief      Generate the particles of this rank: its slab of the lattice
+ *
+ * @param      bodies  The local particles, resized
+ */
+void generate(std::vector<body>& bodies) {
+  using namespace param;
+  const int64_t nlocal = block.nlocal;
+
+  // Generate the sub-block of the lattice
+  std::vector<double> x(nlocal,0.), y(nlocal,0.), z(nlocal,0.);
+  int64_t ngen =
+     particle_lattice::generate_block(lattice_type,domain_type,
+     bbox_min,bbox_max,sph_separation,block,0,x.data(),y.data(),z.data());
+  assert(ngen == nlocal);
+
+  // Assign density, pressure and specific internal energy to particles, etc.
+  bodies.clear();
+  bodies.resize(nlocal);
+  for(int64_t part=0; part<nlocal; ++part){
+    body& particle = bodies[part];
+    point_t pos, vel = 0., zero = 0.;
+    pos[0] = x[part];
+    pos[1] = y[part];
+    if constexpr (gdimension > 2) pos[2] = z[part];
+    particle.set_coordinates(pos);
+    particle.set_mass(mass_particle);
+    particle.setPressure(pressure_initial);
+    particle.setDensity(rho_initial);
+    particle.setAcceleration(zero);
+    particle.setInternalenergy(uint_initial);
+    particle.set_radius(sph_smoothing_length);
+    particle.set_id(block.offset + part);
+
+    // Assign particle inward pointing velocity with absolute value 0.1
+    double A = sqrt(x[part]*x[part] + y[part]*y[part] + z[part]*z[part]);
+    if (A > 0.0)
+      for (unsigned short k=0; k<gdimension; ++k)
+        vel[k] = -pos[k] * 0.1 / A;
+    particle.setVelocity(vel);
+  }
+}
+
+} // namespace noh
+
 #endif // _noh_h_
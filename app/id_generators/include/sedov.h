@@ -17,7 +17,7 @@
  *~--------------------------------------------------------------------------~*/
 
 /**
- * @file user.h
+ * @file sedov.h
  * @author Julien Loiseau
  * @date April 2017
  * @brief User define for dimension and type 
@@ -29,4 +29,247 @@
 #define INTERNAL_ENERGY
 #define OUTPUT
 
+#include <vector>
+#include <random>
+#include <math.h>
+
+#include "user.h"
+#include "params.h"
+#include "lattice.h"
+#include "kernels.h"
+#include "density_profiles.h"
+
+/**
+ * The Sedov blast wave initial data: a uniform or profiled density with the
+ * blast energy deposited in the particles around the origin. Shared by the
+ * generator and the drivers, which generate it in memory with
+ * initial_data_generator = "sedov".
+ */
+namespace sedov {
+
+//
+// derived parameters
+//
+static double r_blast = 0.;           // Radius of injection region
+static double total_mass = 1.;        // total mass of the fluid
+static double mass_particle = 1.;     // mass of an individual particle
+static point_t bbox_max, bbox_min;    // bounding box of the domain
+static particle_lattice::block_t block; // sub-block of the lattice of the rank
+
+void set_derived_params() {
+  using namespace param;
+
+  density_profiles::select();
+  particle_lattice::select();
+
+  // Bounding box of the domain
+  if (domain_type == 0) { // box
+    bbox_min[0] = -box_length/2.;
+    bbox_max[0] =  box_length/2.;
+    if constexpr (gdimension > 1) {
+      bbox_min[1] = -box_width/2.;
+      bbox_max[1] =  box_width/2.;
+    }
+    if constexpr (gdimension > 2) {
+      bbox_min[2] = -box_height/2.;
+      bbox_max[2] =  box_height/2.;
+    }
+  }
+  else if (domain_type == 1) { // sphere or circle
+    bbox_min = -sphere_radius;
+    bbox_max =  sphere_radius;
+  }
+
+  // particle separation
+  if (domain_type == 0) {
+    SET_PARAM(sph_separation, (box_length/(lattice_nx-1)));
+  }
+  else if (domain_type == 1) {
+    SET_PARAM(sph_separation, (2.*sphere_radius/(lattice_nx-1)));
+  }
+
+  // Split the lattice over the ranks and count the particles
+  block = particle_lattice::partition(lattice_type,domain_type,
+      bbox_min,bbox_max,sph_separation);
+  SET_PARAM(nparticles, block.total);
+
+  // total mass
+  if constexpr (gdimension == 1) {
+    total_mass = rho_initial * box_length;
+  }
+  if constexpr (gdimension == 2) {
+    if (domain_type == 0) // a box
+      total_mass = rho_initial * box_length*box_width;
+    else if (domain_type == 1) // a circle
+      total_mass = rho_initial * M_PI*sphere_radius*sphere_radius;
+  }
+  if constexpr (gdimension == 3) {
+    if (domain_type == 0) { // a box
+      assert (boost::iequals(density_profile,"constant"));
+      total_mass = rho_initial * box_length*box_width*box_height;
+    }
+    else if (domain_type == 1) { // a sphere
+      //total_mass = rho_initial * 4./3.*M_PI*sphere_radius*sphere_radius*sphere_radius;
+      // normalize mass such that central density is rho_initial
+      total_mass = rho_initial * sphere_radius*sphere_radius*sphere_radius
+                 / density_profiles::spherical_density_profile(0.0);
+    }
+  }
+
+  // single particle mass
+  assert (equal_mass);
+  mass_particle = total_mass / nparticles;
+
+  // set kernel
+  kernels::select();
+
+  // smoothing length
+  const double sph_h = sph_eta * kernels::kernel_width
+                               * pow(mass_particle/rho_initial,1./gdimension);
+  SET_PARAM(sph_smoothing_length, sph_h);
+
+  // intial internal energy
+  SET_PARAM(uint_initial, (pressure_initial/(rho_initial*(poly_gamma-1.0))));
+
+  // Radius of injection region
+  r_blast = sedov_blast_radius * sph_separation;
+}
+
+/**
+ * @brief      Set the state of the particles and inject the blast energy.
+ *             Collective: the blast zone is counted over the ranks.
+ *
+ * @param      bodies        The local particles, with their positions
+ * @param[in]  from_lattice  Set the density, mass, smoothing length and id
+ *                           of the lattice particles, else keep the ones
+ *                           of the particles
+ */
+void set_particles(std::vector<body>& bodies, const bool from_lattice) {
+  using namespace param;
+  const int64_t nlocal = bodies.size();
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+
+  // Number of particles in the blast zone
+  int64_t particles_blast = 0;
+
+  // Total mass of particles in the blast zone
+  double mass_blast = 0;
+
+  // Count the number of particles and mass in the blast zone
+  // The blast is centered at the origin ({0,0} or {0,0,0})
+  for(int64_t a=0L; a<nlocal; ++a) {
+    body& particle = bodies[a];
+    double r = norm2(particle.coordinates());
+    if (r < r_blast) {
+       particles_blast++;
+       mass_blast += mass_particle;
+    }
+  }
+  MPI_Allreduce(MPI_IN_PLACE,&particles_blast,1,MPI_INT64_T,MPI_SUM,
+      MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE,&mass_blast,1,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+
+  // Assign density, pressure and specific internal energy to particles,
+  // including the particles in the blast zone
+  const double rho0 = density_profiles::spherical_density_profile(0);
+  const double K0 = pressure_initial // polytropic constant
+                  / pow(rho_initial, poly_gamma); 
+  std::default_random_engine generator(rank);
+  for(int64_t a=0; a<nlocal; ++a){
+    body& particle = bodies[a];
+
+    // zero velocity for this test
+    point_t zero = 0;
+    particle.setVelocity(zero);
+    particle.setAcceleration(zero);
+
+    // radial distance from the origin
+    point_t rp(particle.coordinates());
+    double r = norm2(rp);
+
+    // set density, particle mass, smoothing length and id
+    double rho_a, m_a, h_a;
+    int64_t id_a;
+    if (not from_lattice) {
+      rho_a = particle.getDensity();
+      m_a   = particle.mass();
+      h_a   = particle.radius();
+      id_a  = particle.id();
+    }
+    else {
+      rho_a = rho_initial/rho0  // renormalize density profile
+            * density_profiles::spherical_density_profile(r/sphere_radius);
+      m_a = mass_particle;
+      h_a = sph_eta * kernels::kernel_width
+          * pow(mass_particle/rho_a,1./gdimension);
+      id_a = block.offset + a;
+      particle.setDensity(rho_a);
+      particle.set_mass(m_a);
+      particle.set_radius(h_a);
+      particle.set_id(id_a);
+    }
+
+    if (lattice_perturbation_amplitude > 0.0) {
+    // add lattice perturbation
+      std::normal_distribution<double> 
+        distribution(0.,h_a*lattice_perturbation_amplitude);
+      for (unsigned short k=0; k<gdimension; ++k) { 
+        rp[k] += distribution(generator);
+      }
+      particle.set_coordinates(rp);
+    }
+
+    // set internal energy
+    double u_a = K0*pow(rho_a,poly_gamma-1)/(poly_gamma-1);
+    if (r < r_blast) 
+      u_a += sedov_blast_energy/particles_blast;
+    particle.setInternalenergy(u_a);
+
+    // set pressure (a function of density and internal energy)
+    double P_a = rho_a*u_a*(poly_gamma - 1);
+    particle.setPressure(P_a);
+
+    // set timestep
+    particle.setDt(initial_dt);
+
+  }
+
+  clog_one(info) << "Number of particles: " << nparticles << std::endl;
+  clog_one(info) << "Mass of a single particle: " << mass_particle << std::endl;
+  clog_one(info) << "Total number of seeded blast particles: " << particles_blast << std::endl;
+  clog_one(info) << "Total blast energy (E_blast = u_blast * total mass): "
+                 << sedov_blast_energy * mass_blast << std::endl;
+}
+
+/**
+ * @brief      Generate the particles of this rank: its slab of the lattice
+ *
+ * @param      bodies  The local particles, resized
+ */
+void generate(std::vector<body>& bodies) {
+  using namespace param;
+  const int64_t nlocal = block.nlocal;
+
+  // Generate the sub-block of the lattice
+  std::vector<double> x(nlocal,0.), y(nlocal,0.), z(nlocal,0.);
+  int64_t ngen =
+      particle_lattice::generate_block(lattice_type,domain_type,
+      bbox_min,bbox_max,sph_separation,block,0,x.data(),y.data(),z.data());
+  assert(ngen == nlocal);
+
+  bodies.clear();
+  bodies.resize(nlocal);
+  for (int64_t a=0L; a<nlocal; ++a) {
+    point_t pos;
+    pos[0] = x[a];
+    if constexpr (gdimension > 1) pos[1] = y[a];
+    if constexpr (gdimension > 2) pos[2] = z[a];
+    bodies[a].set_coordinates(pos);
+  }
+  set_particles(bodies,true);
+}
+
+} // namespace sedov
+
 #endif // _sedov_h_
@@ -30,4 +30,226 @@
 // #define INTERNAL_ENERGY 1
 // #define OUTPUT
 
+#include <vector>
+#include <math.h>
+
+#include "user.h"
+#include "params.h"
+#include "lattice.h"
+#include "kernels.h"
+
+/**
+ * The Sod shocktube initial data: a central block between a left and a
+ * right block in different states. Shared by the generator and the drivers,
+ * which generate it in memory with initial_data_generator = "sodtube".
+ */
+namespace sodtube {
+
+//
+// derived parameters
+//
+static double rho_1, rho_2;           // densities
+static double vx_1, vx_2;             // velocities
+static double pressure_1, pressure_2; // pressures
+static double mass = 0.;              // particle mass with equal_mass
+static double lr_sph_sep;             // separation in the left/right blocks
+
+// geometric extents of the three regions: left, right and central
+static point_t cbox_min, cbox_max;
+static point_t rbox_min, rbox_max;
+static point_t lbox_min, lbox_max;
+
+// sub-blocks of the central, right and left lattices of the rank
+static particle_lattice::block_t rank_c, rank_r, rank_l;
+
+void set_derived_params() {
+  using namespace std;
+  using namespace param;
+
+  particle_lattice::select();
+  kernels::select();
+
+  // compute the total number of particles
+  int64_t npd = lattice_nx;
+
+  // 1D setup
+  cbox_max[0] =  box_length/6.;
+  cbox_min[0] = -cbox_max[0];
+  lbox_min[0] = -box_length/2.;
+  lbox_max[0] =  cbox_min[0];
+  rbox_min[0] =  cbox_max[0];
+  rbox_max[0] = -lbox_min[0];
+
+  // 2D case
+  if (gdimension>1) {
+     cbox_max[1] = lbox_max[1] = rbox_max[1] = box_width/2.0;
+     cbox_min[1] = lbox_min[1] = rbox_min[1] =-box_width/2.0;
+     npd *= (int64_t)((double)lattice_nx*box_width/box_length);
+  }
+
+  // 3D case
+  if (gdimension>2) {
+     cbox_max[2] = lbox_max[2] = rbox_max[2] = box_height/2.0;
+     cbox_min[2] = lbox_min[2] = rbox_min[2] =-box_height/2.0;
+     npd *= (int64_t)((double)lattice_nx*box_height/box_length);
+  }
+  SET_PARAM(nparticles, npd);
+
+  // test selector
+  switch (sodtest_num) {
+    case (1):
+      // -- middle         | left and right side -- //
+      rho_1      = 1.0;      rho_2      = 0.125;
+      pressure_1 = 1.0;      pressure_2 = 0.1;
+      vx_1       = 0.0;      vx_2       = 0.0;
+      break;
+
+    case (2):
+      rho_1      = 1.0;      rho_2      = 1.0;
+      pressure_1 = 0.4;      pressure_2 = 0.4;
+      vx_1       =-2.0;      vx_2       = 2.0;
+      break;
+
+    case (3):
+      rho_1      = 1.0;      rho_2      = 1.0;
+      pressure_1 = 1000.;    pressure_2 = 0.01;
+      vx_1       = 0.0;      vx_2       = 0.0;
+      break;
+
+    case (4):
+      rho_1      = 1.0;      rho_2      = 1.0;
+      pressure_1 = 0.01;     pressure_2 = 100.;
+      vx_1       = 0.0;      vx_2       = 0.0;
+      break;
+
+    case (5):
+      rho_1      = 5.99924;  rho_2      = 5.99242;
+      pressure_1 = 460.894;  pressure_2 = 46.0950;
+      vx_1       = 19.5975;  vx_2       =-6.19633;
+      break;
+
+    case (6): // 1D equivalent to the Noh problem
+      rho_1      = 1.0;      rho_2      = 1.0;
+      pressure_1 = 1.e-6;    pressure_2 = 1.e-6;
+      vx_1       = 1.0;      vx_2       =-1.0;
+      break;
+
+    default:
+      clog_one(error) << "ERROR: invalid test (" << sodtest_num << ")." << endl;
+      MPI_Finalize();
+      exit(-1);
+
+  }
+
+  // particle spacing
+  SET_PARAM(sph_separation, (box_length/(double)(lattice_nx - 1)));
+
+  // particle mass and spacing of the left and right blocks
+  lr_sph_sep = sph_separation;
+  if(equal_mass){
+    if(gdimension==1){
+      mass = rho_1*sph_separation;
+      lr_sph_sep = mass/rho_2;
+    } else if(gdimension==2){
+      mass = rho_1*sph_separation*sph_separation;
+      if (lattice_type == 1 or lattice_type == 2)
+        mass *= sqrt(3.0)/2.0;
+      lr_sph_sep = sph_separation * sqrt(rho_1/rho_2);
+    } else{
+      mass = rho_1*sph_separation*sph_separation*sph_separation;
+      if (lattice_type == 1 or lattice_type == 2)
+        mass *= 1.0/sqrt(2.0);
+      lr_sph_sep = sph_separation * cbrt(rho_1/rho_2);
+    }
+    rbox_min += (lr_sph_sep - sph_separation) / 2.0; // adjust rbox
+  }
+
+  // split the central, right and left blocks over the ranks
+  rank_c = particle_lattice::partition(
+      lattice_type,2,cbox_min,cbox_max,sph_separation);
+  rank_r = particle_lattice::partition(
+      lattice_type,2,rbox_min,rbox_max,lr_sph_sep);
+  rank_l = particle_lattice::partition(
+      lattice_type,2,lbox_min,lbox_max,lr_sph_sep);
+}
+
+/**
+ * @brief      Generate the particles of this rank: its slabs of the central,
+ *             right and left lattices
+ *
+ * @param      bodies  The local particles, resized
+ */
+void generate(std::vector<body>& bodies) {
+  using namespace param;
+  const int64_t parts_mid = rank_c.total;
+  const int64_t parts_lr = rank_r.total;
+  const int64_t nc = rank_c.nlocal, nr = rank_r.nlocal;
+  const int64_t nlocal = nc + nr + rank_l.nlocal;
+  const bool equal_separation = !equal_mass;
+
+  // generate the sub-blocks of the lattice
+  std::vector<double> x(nlocal,0.), y(nlocal,0.), z(nlocal,0.);
+  int64_t ngen = particle_lattice::generate_block(lattice_type,2,
+          cbox_min,cbox_max,sph_separation,rank_c,0,
+          x.data(),y.data(),z.data());
+  assert (ngen == nc);
+  ngen = particle_lattice::generate_block(lattice_type,2,
+          rbox_min,rbox_max,lr_sph_sep,rank_r,nc,
+          x.data(),y.data(),z.data());
+  assert (ngen == nr);
+  ngen = particle_lattice::generate_block(lattice_type,2,
+          lbox_min,lbox_max,lr_sph_sep,rank_l,nc+nr,
+          x.data(),y.data(),z.data());
+  assert (ngen == nlocal-nc-nr);
+
+  bodies.clear();
+  bodies.resize(nlocal);
+  for(int64_t part=0; part<nlocal; ++part){
+    body& particle = bodies[part];
+    point_t pos, vel = 0., zero = 0.;
+    pos[0] = x[part];
+    if constexpr (gdimension > 1) pos[1] = y[part];
+    if constexpr (gdimension > 2) pos[2] = z[part];
+    particle.set_coordinates(pos);
+    particle.setAcceleration(zero);
+
+    // particle id number: the one of the serial generation, with the central,
+    // right and left blocks one after the other
+    particle.set_id(part < nc ? rank_c.offset + part
+        : part < nc + nr ? parts_mid + rank_r.offset + part - nc
+        : parts_mid + parts_lr + rank_l.offset + part - nc - nr);
+
+    double P_a, rho_a, m_a;
+    if (particle_lattice::in_domain_1d(x[part],
+        cbox_min[0], cbox_max[0], domain_type)) {
+      P_a = pressure_1;
+      rho_a = rho_1;
+      vel[0] = vx_1;
+      m_a = equal_separation ? rho_a/(double)parts_mid : mass;
+    }
+    else {
+      P_a = pressure_2;
+      rho_a = rho_2;
+      vel[0] = vx_2;
+      m_a = equal_separation ? rho_a/(double)parts_lr : mass;
+    }
+    particle.setVelocity(vel);
+    particle.setPressure(P_a);
+    particle.setDensity(rho_a);
+    particle.set_mass(m_a);
+
+    // compute internal energy using gamma-law eos
+    particle.setInternalenergy(P_a/(poly_gamma-1.)/rho_a);
+
+    // particle smoothing length
+    particle.set_radius(sph_eta * kernels::kernel_width
+                                * pow(m_a/rho_a,1./gdimension));
+  } // for part=0..nlocal
+
+  clog_one(info) << "Actual number of particles: "
+                 << parts_mid + parts_lr + rank_l.total << std::endl;
+}
+
+} // namespace sodtube
+
 #endif // _sodtube_h_
@@ -39,13 +39,9 @@
 #include "user.h"
 #include "noh.h"
 #include "params.h"
-#include "lattice.h"
-#include "kernels.h"
 #include "io.h"
 using namespace io;
-
-#define SQ(x) ((x)*(x))
-#define CU(x) ((x)*(x)*(x))
+#include "bodies_system.h"
 
 
 //
@@ -60,56 +56,11 @@ void print_usage() {
 //
 // derived parameters
 //
-static double timestep = 1.0;         // Recommended timestep
-static double total_mass = 1.;        // total mass of the fluid
-static double mass_particle = 1.;     // mass of an individual particle
-static point_t bbox_max, bbox_min;    // bounding box of the domain
 static std::string initial_data_file; // = initial_data_prefix + ".h5part"
 
 void set_derived_params() {
   using namespace param;
-  particle_lattice::select();
-
-  // The value for constant timestep
-  timestep = initial_dt;
-
-  // Bounding box of the domain
-  bbox_min = -sphere_radius;
-  bbox_max =  sphere_radius;
-
-  // particle separation
-  SET_PARAM(sph_separation, (2.*sphere_radius/(lattice_nx-1)));
-
-  // Count number of particles
-  int64_t tparticles =
-      particle_lattice::count(lattice_type,domain_type,
-      bbox_min,bbox_max,sph_separation,0);
-  SET_PARAM(nparticles, tparticles);
-
-  // total mass
-  if (gdimension == 2) {
-    total_mass = rho_initial * M_PI*SQ(sphere_radius);
-  }
-  else if (gdimension == 3) {
-    total_mass = rho_initial * 4./3.*M_PI*CU(sphere_radius);
-  }
-  else
-    assert (false);
-
-  // single particle mass
-  assert (equal_mass);
-  mass_particle = total_mass / nparticles;
-
-  // set kernel
-  kernels::select();
-
-  // smoothing length
-  const double sph_h = sph_eta * kernels::kernel_width
-                               * pow(mass_particle/rho_initial,1./gdimension);
-  SET_PARAM(sph_smoothing_length, sph_h);
-
-  // intial internal energy
-  SET_PARAM(uint_initial, (pressure_initial/(rho_initial*(poly_gamma-1.0))));
+  noh::set_derived_params();
 
   // file to be generated
   std::ostringstream oss;
@@ -147,99 +98,19 @@ int main(int argc, char * argv[]){
                  << "Generating "  << nparticles << " particles in "
                  << gdimension << "D" << std::endl;
 
-  // Initialize the arrays to be filled later
-  // Position
-  double* x = new double[nparticles]();
-  double* y = new double[nparticles]();
-  double* z = new double[nparticles]();
-  // Velocity
-  double* vx = new double[nparticles]();
-  double* vy = new double[nparticles]();
-  double* vz = new double[nparticles]();
-  // Acceleration
-  double* ax = new double[nparticles]();
-  double* ay = new double[nparticles]();
-  double* az = new double[nparticles]();
-  // Smoothing length
-  double* h = new double[nparticles]();
-  // Density
-  double* rho = new double[nparticles]();
-  // Internal Energy
-  double* u = new double[nparticles]();
-  // Pressure
-  double* P = new double[nparticles]();
-  // Mass
-  double* m = new double[nparticles]();
-  // Id
-  int64_t* id = new int64_t[nparticles]();
-  // Timestep
-  double* dt = new double[nparticles]();
-
-  // Generate the lattice
-  assert(nparticles ==
-     particle_lattice::generate(lattice_type,domain_type,
-     bbox_min,bbox_max,sph_separation,0, x, y, z));
-
-  // Particle id number
-  int64_t posid = 0;
-
-  // Assign density, pressure and specific internal energy to particles, etc.
-  for(int64_t part=0; part<nparticles; ++part){
-    m[part] = mass_particle;
-    P[part] = pressure_initial;
-    rho[part] = rho_initial;
-    ax[part] = 0.0;
-    ay[part] = 0.0;
-    az[part] = 0.0;
-    u[part] = uint_initial;
-    h[part] = sph_smoothing_length;
-    id[part] = posid++;
-
-    // Assign particle inward pointing velocity with absolute value 0.1
-    double A = sqrt(SQ(x[part]) + SQ(y[part]) + SQ(z[part]));
-    if (A <= 0.0) {
-      vx[part] = 0.0;
-      vy[part] = 0.0;
-      if(gdimension > 2) vz[part] = 0.0;
-    }
-    else {
-      vx[part] = -(x[part]) * 0.1 / A;
-      vy[part] = -(y[part]) * 0.1 / A;
-      if(gdimension > 2) vz[part] = -(z[part]) * 0.1 / A;
-    }
-  }
+  // generate the particles of this rank
+  body_system<double,gdimension> bs;
+  std::vector<body> bodies;
+  noh::generate(bodies);
+  bs.setLocalbodies(std::move(bodies));
 
-  // remove the previous file
-  remove(initial_data_file.c_str());
-  hid_t dataFile = H5P_openFile(initial_data_file.c_str(),H5F_ACC_RDWR);
-
-  int use_fixed_timestep = 1;
-  // add the global attributes
-  H5P_writeAttribute(dataFile,"nparticles",&nparticles);
-  H5P_writeAttribute(dataFile,"timestep",&timestep);
-  int dim = gdimension;
-  H5P_writeAttribute(dataFile,"dimension",&dim);
-  H5P_writeAttribute(dataFile,"use_fixed_timestep",&use_fixed_timestep);
-
-  H5P_setNumParticles(nparticles);
-  H5P_setStep(dataFile,0);
-
-  //H5PartSetNumParticles(dataFile,nparticles);
-  H5P_writeDataset(dataFile,"x",x,nparticles);
-  H5P_writeDataset(dataFile,"y",y,nparticles);
-  H5P_writeDataset(dataFile,"z",z,nparticles);
-  H5P_writeDataset(dataFile,"vx",vx,nparticles);
-  H5P_writeDataset(dataFile,"vy",vy,nparticles);
-  H5P_writeDataset(dataFile,"h",h,nparticles);
-  H5P_writeDataset(dataFile,"rho",rho,nparticles);
-  H5P_writeDataset(dataFile,"u",u,nparticles);
-  H5P_writeDataset(dataFile,"P",P,nparticles);
-  H5P_writeDataset(dataFile,"m",m,nparticles);
-  H5P_writeDataset(dataFile,"id",id,nparticles);
-
-  H5P_closeFile(dataFile);
-  delete[] x, y, z, vx, vy, vz, ax, ay, az, h, rho, u, P, m, id, dt;
+  // remove the previous file before its collective creation
+  if (rank == 0)
+    remove(initial_data_file.c_str());
+  MPI_Barrier(MPI_COMM_WORLD);
 
+  // write the file; iteration for initial data MUST BE zero!!
+  bs.write_bodies(initial_data_prefix, 0, 0.0);
   MPI_Finalize();
   return 0;
 }
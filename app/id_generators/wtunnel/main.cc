@@ -49,6 +49,7 @@ static std::string initial_data_file; // = initial_data_prefix + ".h5part"
 
 // geometric extents of the flow (box-shaped)
 static point_t cbox_min, cbox_max;
+static particle_lattice::block_t block; // sub-block of the lattice of the rank
 
 void set_derived_params() {
   using namespace std;
@@ -121,44 +122,47 @@ int main(int argc, char * argv[]){
          << endl << " - particles per core:  " << nparticlesproc << endl
          << " - generated initial data file: " << initial_data_file << endl;
 
-  // allocate arrays
-  int64_t tparticles = 0;
-  tparticles =  particle_lattice::count(lattice_type,0,cbox_min,cbox_max,
-                                        sph_separation,0);
+  // split the lattice over the ranks
+  block = particle_lattice::partition(lattice_type,0,cbox_min,cbox_max,
+                                      sph_separation);
+  const int64_t tparticles = block.total;
+  SET_PARAM(nparticles, tparticles);
 
-  // Initialize the arrays to be filled later
+  // Initialize the arrays of the particles of this rank
+  const int64_t nlocal = block.nlocal;
   // Position
-  double* x = new double[tparticles]();
-  double* y = new double[tparticles]();
-  double* z = new double[tparticles]();
+  double* x = new double[nlocal]();
+  double* y = new double[nlocal]();
+  double* z = new double[nlocal]();
   // Velocity
-  double* vx = new double[tparticles]();
-  double* vy = new double[tparticles]();
-  double* vz = new double[tparticles]();
+  double* vx = new double[nlocal]();
+  double* vy = new double[nlocal]();
+  double* vz = new double[nlocal]();
   // Acceleration
-  double* ax = new double[tparticles]();
-  double* ay = new double[tparticles]();
-  double* az = new double[tparticles]();
+  double* ax = new double[nlocal]();
+  double* ay = new double[nlocal]();
+  double* az = new double[nlocal]();
   // Smoothing length
-  double* h = new double[tparticles]();
+  double* h = new double[nlocal]();
   // Density
-  double* rho = new double[tparticles]();
+  double* rho = new double[nlocal]();
   // Internal Energy
-  double* u = new double[tparticles]();
+  double* u = new double[nlocal]();
   // Pressure
-  double* P = new double[tparticles]();
+  double* P = new double[nlocal]();
   // Mass
-  double* m = new double[tparticles]();
+  double* m = new double[nlocal]();
   // Id
-  int64_t* id = new int64_t[tparticles]();
+  int64_t* id = new int64_t[nlocal]();
   // Timestep
-  double* dt = new double[tparticles]();
+  double* dt = new double[nlocal]();
 
-  tparticles =  particle_lattice::generate(lattice_type,0,cbox_min,cbox_max,
-                                           sph_separation,0,x,y,z);
+  int64_t ngen = particle_lattice::generate_block(lattice_type,0,
+          cbox_min,cbox_max,sph_separation,block,0,x,y,z);
+  assert (ngen == nlocal);
 
   // particle id number
-  int64_t posid = 0;
+  int64_t posid = block.offset;
 
   // max. value for the speed of sound
   double cs = sqrt(poly_gamma*pressure_initial/rho_initial);
@@ -166,7 +170,7 @@ int main(int argc, char * argv[]){
   // The value for constant timestep
   double timestep = 0.5*sph_separation/cs;
 
-  for(int64_t part=0; part<tparticles; ++part){
+  for(int64_t part=0; part<nlocal; ++part){
     id[part] = posid++;
     P[part] = pressure_initial;
     rho[part] = rho_initial;
@@ -182,8 +186,10 @@ int main(int argc, char * argv[]){
   } // for part=0..nparticles
 
   clog_one(info) << "Actual number of particles: " << tparticles << std::endl;
-  // delete the output file if exists
-  remove(initial_data_file.c_str());
+  // remove the previous file before its collective creation
+  if (rank == 0)
+    remove(initial_data_file.c_str());
+  MPI_Barrier(MPI_COMM_WORLD);
   hid_t dataFile = H5P_openFile(initial_data_file.c_str(),H5F_ACC_RDWR);
 
   int use_fixed_timestep = 1;
@@ -194,21 +200,21 @@ int main(int argc, char * argv[]){
   H5P_writeAttribute(dataFile,"dimension",&dim);
   H5P_writeAttribute(dataFile,"use_fixed_timestep",&use_fixed_timestep);
 
-  H5P_setNumParticles(nparticles);
+  H5P_setNumParticles(nlocal);
   H5P_setStep(dataFile,0);
 
   //H5PartSetNumParticles(dataFile,nparticles);
-  H5P_writeDataset(dataFile,"x",x,nparticles);
-  H5P_writeDataset(dataFile,"y",y,nparticles);
-  H5P_writeDataset(dataFile,"z",z,nparticles);
-  H5P_writeDataset(dataFile,"vx",vx,nparticles);
-  H5P_writeDataset(dataFile,"vy",vy,nparticles);
-  H5P_writeDataset(dataFile,"h",h,nparticles);
-  H5P_writeDataset(dataFile,"rho",rho,nparticles);
-  H5P_writeDataset(dataFile,"u",u,nparticles);
-  H5P_writeDataset(dataFile,"P",P,nparticles);
-  H5P_writeDataset(dataFile,"m",m,nparticles);
-  H5P_writeDataset(dataFile,"id",id,nparticles);
+  H5P_writeDataset(dataFile,"x",x,nlocal);
+  H5P_writeDataset(dataFile,"y",y,nlocal);
+  H5P_writeDataset(dataFile,"z",z,nlocal);
+  H5P_writeDataset(dataFile,"vx",vx,nlocal);
+  H5P_writeDataset(dataFile,"vy",vy,nlocal);
+  H5P_writeDataset(dataFile,"h",h,nlocal);
+  H5P_writeDataset(dataFile,"rho",rho,nlocal);
+  H5P_writeDataset(dataFile,"u",u,nlocal);
+  H5P_writeDataset(dataFile,"P",P,nlocal);
+  H5P_writeDataset(dataFile,"m",m,nlocal);
+  H5P_writeDataset(dataFile,"id",id,nlocal);
 
   H5P_closeFile(dataFile);
   delete[] x, y, z, vx, vy, vz, ax, ay, az, h, rho, u, P, m, id, dt;
@@ -0,0 +1,543 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file h5part_tool.cc
+ * @brief Parallel post-processing of the H5part outputs.
+ * MPI + OpenMP replacement of the python tools combine_H5part_iterations.py,
+ * extract_particle.py, 1D_reduction.py and h5part_ascii_slicer.py.
+ * Each rank streams its slab of the particles in chunks of
+ * H5PART_TOOL_CHUNK particles, the memory per rank is bounded.
+ */
+
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iomanip>
+#include <cfloat>
+#include <math.h>
+
+#include "user.h"
+#include "params.h"
+#include "kernels.h"
+#include "io.h"
+
+using namespace io;
+
+// Number of particles read at once by each rank
+static int64_t chunk_size = 1<<20;
+
+//
+// help message
+//
+void print_usage() {
+  clog_one(warn)
+      << "Parallel H5part post-processing tool in "
+      << gdimension << "D" << std::endl
+      << "Usage: ./h5part_tool_" << gdimension << "d <command> <args>"
+      << std::endl
+      << "  merge   <prefix> <output.h5part>" << std::endl
+      << "          combine <prefix>_XXXXX.h5part in a single file"
+      << std::endl
+      << "  track   <file.h5part> <id> [<id> ...]" << std::endl
+      << "          extract particles trajectories in track_<id>.dat"
+      << std::endl
+      << "  profile <file.h5part> <step> <field> <nbins> <r|x|y|z>"
+      << std::endl
+      << "          radial or 1D profile of a field in profile_<field>.dat"
+      << std::endl
+      << "  slice   <file.h5part> <step> <x|y|z> <position> <width>"
+      << std::endl
+      << "          particles within width of a plane in slice.dat"
+      << std::endl
+      << "The environment variable H5PART_TOOL_CHUNK sets the number of "
+      << "particles read at once per rank" << std::endl;
+}
+
+/**
+ * @brief Streaming reader of one step of a H5part file. Each rank owns a
+ * contiguous slab of the particles, read by chunks. All the ranks
+ * perform the same number of collective reads.
+ */
+class step_reader {
+public:
+
+  step_reader(
+    const char* filename,
+    int64_t step)
+  {
+    MPI_Comm_rank(comm_,&rank_);
+    MPI_Comm_size(comm_,&size_);
+    file_ = H5P_openFile(filename,H5F_ACC_RDONLY);
+    if(!H5P_hasStep(file_,step)){
+      clog_one(error)<<"No Step#"<<step<<" in "<<filename<<std::endl;
+      FULLSTOP;
+    }
+    H5P_setStep(file_,step);
+    group_ = IO_group_id;
+    nparticles_ = H5P_getNumParticles(file_);
+    begin_ = nparticles_/size_*rank_ + std::min<int64_t>(rank_,
+      nparticles_%size_);
+    end_ = begin_ + nparticles_/size_ + (rank_ < nparticles_%size_);
+    nchunks_ = (end_-begin_+chunk_size-1)/chunk_size;
+    MPI_Allreduce(MPI_IN_PLACE,&nchunks_,1,MPI_INT64_T,MPI_MAX,comm_);
+  }
+
+  ~step_reader()
+  {
+    H5Gclose(group_);
+    H5Fclose(file_);
+  }
+
+  int64_t nparticles() const { return nparticles_; }
+  int64_t nchunks() const { return nchunks_; }
+  hid_t group() const { return group_; }
+
+  /**
+   * @brief Global index of the first particle of a chunk of this rank
+   */
+  int64_t chunk_begin(int64_t c) const
+  {
+    return std::min(end_,begin_+c*chunk_size);
+  }
+
+  bool has(const char* name) const
+  {
+    return H5Lexists(group_,name,H5P_DEFAULT) > 0;
+  }
+
+  /**
+   * @brief Collective read of the chunk c of a dataset, missing datasets
+   * are filled with zeros
+   */
+  template<typename T>
+  int64_t read(
+    const char* name,
+    int64_t c,
+    std::vector<T>& data)
+  {
+    int64_t first = chunk_begin(c);
+    int64_t count = std::min(end_,first+chunk_size) - first;
+    data.assign(count,T(0));
+    if(!has(name))
+      return count;
+    IO_group_id = group_;
+    IO_offset = first;
+    IO_count = count;
+    IO_use_points = count == 0;
+    IO_points.clear();
+    H5P_readDataset(file_,name,data.data(),count);
+    IO_use_points = false;
+    return count;
+  }
+
+  template<typename T>
+  T attribute(const char* name) const
+  {
+    T value = T(0);
+    if(H5Aexists(group_,name) > 0){
+      T* ptr = &value;
+      hid_t att_id = H5Aopen(group_,name,H5P_DEFAULT);
+      H5Aread(att_id,H5P_getType(ptr),ptr);
+      H5Aclose(att_id);
+    }
+    return value;
+  }
+
+private:
+  int rank_, size_;
+  hid_t file_, group_;
+  int64_t nparticles_, begin_, end_, nchunks_;
+};
+
+// Particles fields handled by the tools
+static const std::vector<std::string> double_fields = {
+  "x","y","z","vx","vy","vz","ax","ay","az","h","rho","u","P","m","dt"};
+static const std::vector<std::string> int64_fields = {"id","rank","key"};
+
+/**
+ * @brief Collective write of a chunk in a dataset of the output
+ */
+template<typename T>
+void write_chunk(
+  hid_t dset_id,
+  const std::vector<T>& data,
+  int64_t offset)
+{
+  T* ptr = nullptr;
+  hsize_t count = data.size();
+  hsize_t hoffset = offset;
+  hid_t memspace = H5Screate_simple(1,&count,NULL);
+  hid_t dataspace = H5Dget_space(dset_id);
+  if(count > 0){
+    H5Sselect_hyperslab(dataspace,H5S_SELECT_SET,&hoffset,NULL,&count,NULL);
+  }else{
+    H5Sselect_none(memspace);
+    H5Sselect_none(dataspace);
+  }
+  hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
+  H5Pset_dxpl_mpio(plist_id,H5FD_MPIO_COLLECTIVE);
+  H5Dwrite(dset_id,H5P_getType(ptr),memspace,dataspace,plist_id,data.data());
+  H5Pclose(plist_id);
+  H5Sclose(dataspace);
+  H5Sclose(memspace);
+}
+
+/**
+ * @brief Copy a scalar attribute of a step group
+ */
+template<typename T>
+void copy_attribute(
+  const step_reader& in,
+  hid_t group_id,
+  const char* name)
+{
+  T value = in.attribute<T>(name);
+  T* ptr = &value;
+  hid_t space_id = H5Screate(H5S_SCALAR);
+  hid_t att_id = H5Acreate(group_id,name,H5P_getType(ptr),space_id,
+    H5P_DEFAULT,H5P_DEFAULT);
+  H5Awrite(att_id,H5P_getType(ptr),ptr);
+  H5Aclose(att_id);
+  H5Sclose(space_id);
+}
+
+/**
+ * @brief Merge the per-iteration files <prefix>_XXXXX.h5part in a single
+ * H5part file, steps renumbered in order, with the step index
+ */
+void merge(
+  const char* prefix,
+  const char* output)
+{
+  int rank;
+  MPI_Comm_rank(comm_,&rank);
+
+  // Rank 0 lists the snapshots
+  std::vector<int> steps;
+  if(rank == 0){
+    char buf[MAX_FNAME_LEN], dir_name[MAX_FNAME_LEN], base_name[MAX_FNAME_LEN];
+    strcpy(buf,prefix); strcpy(dir_name,dirname(buf));
+    strcpy(buf,prefix); strcpy(base_name,basename(buf));
+    DIR* d = opendir(dir_name);
+    if(d){
+      struct dirent* dir;
+      while((dir = readdir(d)) != NULL){
+        int step = H5P_isPrefixSnapshot(base_name,dir->d_name);
+        if(step >= 0)
+          steps.push_back(step);
+      }
+      closedir(d);
+    }
+    std::sort(steps.begin(),steps.end());
+  }
+  int nsteps = steps.size();
+  MPI_Bcast(&nsteps,1,MPI_INT,0,comm_);
+  steps.resize(nsteps);
+  MPI_Bcast(steps.data(),nsteps,MPI_INT,0,comm_);
+  clog_one(info)<<"Merging "<<nsteps<<" snapshots in "<<output<<std::endl;
+
+  if(rank == 0)
+    remove(output);
+  MPI_Barrier(comm_);
+  hid_t out_id = H5P_openFile(output,H5F_ACC_RDWR);
+  int32_t dimension = gdimension;
+  H5P_writeAttribute(out_id,"dimension",&dimension);
+
+  for(int s = 0; s < nsteps; ++s){
+    char filename[MAX_FNAME_LEN];
+    sprintf(filename,"%s_%05d.h5part",prefix,steps[s]);
+    step_reader in(filename,steps[s]);
+
+    char cstep[255];
+    sprintf(cstep,"/Step#%d",s);
+    hid_t group_id = H5Gcreate(out_id,cstep,H5P_DEFAULT,H5P_DEFAULT,
+      H5P_DEFAULT);
+    copy_attribute<double>(in,group_id,"time");
+    copy_attribute<int64_t>(in,group_id,"iteration");
+    copy_attribute<double>(in,group_id,"timestep");
+
+    // Stream every field present in the input
+    auto copy = [&](const std::string& name, auto tag){
+      using T = decltype(tag);
+      if(!in.has(name.c_str()))
+        return;
+      T* ptr = nullptr;
+      hsize_t total = in.nparticles();
+      hid_t space_id = H5Screate_simple(1,&total,NULL);
+      hid_t dset_id = H5Dcreate(group_id,name.c_str(),H5P_getType(ptr),
+        space_id,H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT);
+      H5Sclose(space_id);
+      std::vector<T> data;
+      for(int64_t c = 0; c < in.nchunks(); ++c){
+        in.read(name.c_str(),c,data);
+        write_chunk(dset_id,data,in.chunk_begin(c));
+      }
+      H5Dclose(dset_id);
+    };
+    for(auto& f: double_fields) copy(f,double());
+    for(auto& f: int64_fields) copy(f,int64_t());
+    copy("type",int());
+
+    // Keep the step index of the single-file outputs
+    H5P_writeStepIndex(out_id,s,in.attribute<int64_t>("iteration"),
+      in.attribute<double>("time"),in.nparticles());
+    H5Gclose(group_id);
+  }
+  H5Fclose(out_id);
+}
+
+/**
+ * @brief Extract the trajectories of particles from a single-file output
+ * in track_<id>.dat: iteration, time, position, velocity, h, rho, u, P
+ */
+void track(
+  const char* filename,
+  const std::vector<int64_t>& ids)
+{
+  int rank;
+  MPI_Comm_rank(comm_,&rank);
+  const std::vector<std::string> fields = {
+    "x","y","z","vx","vy","vz","h","rho","u","P"};
+  const size_t nf = fields.size();
+
+  std::vector<std::ofstream> out;
+  if(rank == 0)
+    for(auto id: ids){
+      out.emplace_back("track_"+std::to_string(id)+".dat");
+      out.back()<<"# 1:iteration 2:time";
+      for(size_t f = 0; f < nf; ++f)
+        out.back()<<" "<<f+3<<":"<<fields[f];
+      out.back()<<std::endl;
+    }
+
+  // Number of steps in the file
+  hid_t file_id = H5P_openFile(filename,H5F_ACC_RDONLY);
+  int64_t nsteps = 0;
+  while(H5P_hasStep(file_id,nsteps)) ++nsteps;
+  H5Fclose(file_id);
+
+  std::map<int64_t,size_t> index;
+  for(size_t p = 0; p < ids.size(); ++p)
+    index[ids[p]] = p;
+  std::vector<int64_t> pid;
+  std::vector<double> data;
+  for(int64_t step = 0; step < nsteps; ++step){
+    step_reader in(filename,step);
+    // found flag then the fields, reduced by sum
+    std::vector<double> values(ids.size()*(nf+1),0.);
+    for(int64_t c = 0; c < in.nchunks(); ++c){
+      int64_t count = in.read("id",c,pid);
+      std::vector<std::pair<int64_t,size_t>> hits;
+      for(int64_t i = 0; i < count; ++i){
+        auto it = index.find(pid[i]);
+        if(it != index.end())
+          hits.push_back({i,it->second});
+      }
+      // The reads are collective: every rank reads the chunk if any hit
+      int any = !hits.empty();
+      MPI_Allreduce(MPI_IN_PLACE,&any,1,MPI_INT,MPI_LOR,comm_);
+      if(!any) continue;
+      for(size_t f = 0; f < nf; ++f){
+        in.read(fields[f].c_str(),c,data);
+        for(auto& h: hits){
+          values[h.second*(nf+1)] = 1.;
+          values[h.second*(nf+1)+1+f] = data[h.first];
+        }
+      }
+    }
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : values.data(),values.data(),
+      values.size(),MPI_DOUBLE,MPI_SUM,0,comm_);
+    if(rank != 0) continue;
+    for(size_t p = 0; p < ids.size(); ++p){
+      if(values[p*(nf+1)] == 0.) continue;
+      out[p]<<in.attribute<int64_t>("iteration")<<" "
+        <<std::scientific<<std::setprecision(12)
+        <<in.attribute<double>("time");
+      for(size_t f = 0; f < nf; ++f)
+        out[p]<<" "<<values[p*(nf+1)+1+f];
+      out[p]<<std::endl;
+    }
+  }
+}
+
+/**
+ * @brief Radial (from the center of the particles bounding box) or 1D
+ * profile of a field: average of the field in nbins bins
+ */
+void profile(
+  const char* filename,
+  int64_t step,
+  const char* field,
+  int nbins,
+  char axis)
+{
+  int rank;
+  MPI_Comm_rank(comm_,&rank);
+  step_reader in(filename,step);
+  const char* coords[3] = {"x","y","z"};
+  const bool radial = axis == 'r';
+  const int a = radial ? 0 : axis - 'x';
+  std::vector<std::vector<double>> pos(3);
+  std::vector<double> data;
+
+  // First pass: bounding box
+  double bmin[3] = {DBL_MAX,DBL_MAX,DBL_MAX};
+  double bmax[3] = {-DBL_MAX,-DBL_MAX,-DBL_MAX};
+  for(int64_t c = 0; c < in.nchunks(); ++c)
+    for(size_t d = 0; d < gdimension; ++d){
+      int64_t count = in.read(coords[d],c,pos[d]);
+      for(int64_t i = 0; i < count; ++i){
+        bmin[d] = std::min(bmin[d],pos[d][i]);
+        bmax[d] = std::max(bmax[d],pos[d][i]);
+      }
+    }
+  MPI_Allreduce(MPI_IN_PLACE,bmin,3,MPI_DOUBLE,MPI_MIN,comm_);
+  MPI_Allreduce(MPI_IN_PLACE,bmax,3,MPI_DOUBLE,MPI_MAX,comm_);
+  double center[3] = {0.,0.,0.};
+  double rmax = 0.;
+  for(size_t d = 0; d < gdimension; ++d){
+    center[d] = .5*(bmin[d]+bmax[d]);
+    rmax += .25*(bmax[d]-bmin[d])*(bmax[d]-bmin[d]);
+  }
+  const double lo = radial ? 0. : bmin[a];
+  const double hi = radial ? sqrt(rmax) : bmax[a];
+  const double width = (hi-lo)/nbins;
+
+  // Second pass: bin the field
+  std::vector<double> sum(nbins,0.), count(nbins,0.);
+  for(int64_t c = 0; c < in.nchunks(); ++c){
+    int64_t n = in.read(field,c,data);
+    for(size_t d = 0; d < gdimension; ++d)
+      in.read(coords[d],c,pos[d]);
+    #pragma omp parallel
+    {
+      std::vector<double> tsum(nbins,0.), tcount(nbins,0.);
+      #pragma omp for
+      for(int64_t i = 0; i < n; ++i){
+        double r = 0.;
+        if(radial)
+          for(size_t d = 0; d < gdimension; ++d)
+            r += (pos[d][i]-center[d])*(pos[d][i]-center[d]);
+        r = radial ? sqrt(r) : pos[a][i];
+        int b = std::min(nbins-1,std::max(0,(int)((r-lo)/width)));
+        tsum[b] += data[i];
+        tcount[b] += 1.;
+      }
+      #pragma omp critical
+      for(int b = 0; b < nbins; ++b){
+        sum[b] += tsum[b];
+        count[b] += tcount[b];
+      }
+    }
+  }
+  MPI_Reduce(rank == 0 ? MPI_IN_PLACE : sum.data(),sum.data(),nbins,
+    MPI_DOUBLE,MPI_SUM,0,comm_);
+  MPI_Reduce(rank == 0 ? MPI_IN_PLACE : count.data(),count.data(),nbins,
+    MPI_DOUBLE,MPI_SUM,0,comm_);
+  if(rank != 0) return;
+
+  std::ofstream out(std::string("profile_")+field+".dat");
+  out<<"# 1:"<<(radial?"r":coords[a])<<" 2:"<<field<<" 3:count"<<std::endl;
+  for(int b = 0; b < nbins; ++b)
+    out<<std::scientific<<std::setprecision(12)<<lo+(b+.5)*width<<" "
+      <<(count[b]>0.?sum[b]/count[b]:0.)<<" "<<(int64_t)count[b]<<std::endl;
+}
+
+/**
+ * @brief Particles within width of the plane axis=position in slice.dat,
+ * written in parallel in rank order
+ */
+void slice(
+  const char* filename,
+  int64_t step,
+  char axis,
+  double position,
+  double width)
+{
+  step_reader in(filename,step);
+  const int a = axis - 'x';
+  const std::vector<std::string> fields = {
+    "x","y","z","vx","vy","vz","h","rho","u","P","m"};
+  const size_t nf = fields.size();
+  std::vector<std::vector<double>> data(nf);
+
+  MPI_File fh;
+  int rank;
+  MPI_Comm_rank(comm_,&rank);
+  if(rank == 0)
+    remove("slice.dat");
+  MPI_Barrier(comm_);
+  MPI_File_open(comm_,"slice.dat",MPI_MODE_CREATE|MPI_MODE_WRONLY,
+    MPI_INFO_NULL,&fh);
+  std::ostringstream header;
+  if(rank == 0){
+    header<<"#";
+    for(size_t f = 0; f < nf; ++f)
+      header<<" "<<f+1<<":"<<fields[f];
+    header<<std::endl;
+  }
+  std::string hstr = header.str();
+  MPI_File_write_ordered(fh,hstr.data(),hstr.size(),MPI_CHAR,
+    MPI_STATUS_IGNORE);
+
+  for(int64_t c = 0; c < in.nchunks(); ++c){
+    int64_t n = 0;
+    for(size_t f = 0; f < nf; ++f)
+      n = in.read(fields[f].c_str(),c,data[f]);
+    std::ostringstream oss;
+    oss<<std::scientific<<std::setprecision(8);
+    for(int64_t i = 0; i < n; ++i){
+      if(std::abs(data[a][i]-position) > width) continue;
+      for(size_t f = 0; f < nf; ++f)
+        oss<<data[f][i]<<(f+1<nf?" ":"\n");
+    }
+    std::string str = oss.str();
+    MPI_File_write_ordered(fh,str.data(),str.size(),MPI_CHAR,
+      MPI_STATUS_IGNORE);
+  }
+  MPI_File_close(&fh);
+}
+
+//----------------------------------------------------------------------------//
+int main(int argc, char * argv[]){
+
+  int rank, size, provided;
+  MPI_Init_thread(&argc,&argv,MPI_THREAD_MULTIPLE,&provided);
+  MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+  MPI_Comm_size(MPI_COMM_WORLD,&size);
+  clog_set_output_rank(0);
+
+  if(argc < 3){
+    print_usage();
+    MPI_Finalize();
+    return 0;
+  }
+  if(getenv("H5PART_TOOL_CHUNK") != nullptr)
+    chunk_size = std::max<int64_t>(1,atol(getenv("H5PART_TOOL_CHUNK")));
+
+  std::string command = argv[1];
+  if(command == "merge" && argc == 4){
+    merge(argv[2],argv[3]);
+  }else if(command == "track" && argc >= 4){
+    std::vector<int64_t> ids;
+    for(int i = 3; i < argc; ++i)
+      ids.push_back(atol(argv[i]));
+    track(argv[2],ids);
+  }else if(command == "profile" && argc == 7){
+    profile(argv[2],atol(argv[3]),argv[4],atoi(argv[5]),argv[6][0]);
+  }else if(command == "slice" && argc == 7){
+    slice(argv[2],atol(argv[3]),argv[4][0],atof(argv[5]),atof(argv[6]));
+  }else{
+    print_usage();
+  }
+
+  MPI_Finalize();
+  return 0;
+}
@@ -0,0 +1,545 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+ /*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file bench_driver.cc
+ * @brief Micro-benchmarks of the building blocks of the drivers: tree
+ * build, neighbor search, SPH kernels and functors, Hilbert and Morton keys,
+ * distributed sort, FMM versus direct summation and the integrator sweeps.
+ * The particles are a lattice from lattice.h described by the parameter
+ * file (lattice_nx, lattice_type, box_length, sph_eta, ...), the random
+ * particles of the sort use a fixed seed per rank.
+ * Each benchmark keeps the best time of nrepeat runs, maximum over the
+ * ranks, and the peak resident memory of the ranks. Rank 0 writes the
+ * results in JSON, on stdout or in the file given after the parameter file.
+ *
+ * Usage: mpirun -np k ./bench_3d <parameter-file.par> [<output.json>]
+ */
+
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sys/resource.h>
+
+#include <mpi.h>
+#include <omp.h>
+
+#include "flecsi/execution/execution.h"
+#include "flecsi/data/data_client.h"
+#include "flecsi/data/data.h"
+
+#include "params.h"
+#include "bodies_system.h"
+#include "default_physics.h"
+#include "lattice.h"
+
+static std::string output_json_file; // Empty for stdout
+
+namespace bench{
+
+  const int nrepeat = 3;
+
+  struct result_t {
+    std::string name;
+    int64_t n;            // Operations of one run, all the ranks
+    double seconds;       // Best run, max over the ranks
+    std::string unit;
+    long maxrss_kb;       // Peak resident memory, max over the ranks
+    double error = -1.;   // Relative error, if applicable
+  };
+
+  std::vector<result_t> results;
+
+  // Avoid the elimination of the benchmarked loops
+  volatile double sink = 0.;
+
+  /**
+   * @brief      Peak resident memory of the ranks in kB. Collective.
+   */
+  long
+  maxrss()
+  {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF,&usage);
+    long rss = usage.ru_maxrss;
+    MPI_Allreduce(MPI_IN_PLACE,&rss,1,MPI_LONG,MPI_MAX,MPI_COMM_WORLD);
+    return rss;
+  }
+
+  /**
+   * @brief      Add a result measured elsewhere. Collective.
+   *
+   * @param[in]  n        The local number of operations
+   * @param[in]  seconds  The local time
+   */
+  void
+  record(
+    const std::string& name,
+    int64_t n,
+    double seconds,
+    const std::string& unit,
+    double error = -1.)
+  {
+    MPI_Allreduce(MPI_IN_PLACE,&n,1,MPI_INT64_T,MPI_SUM,MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE,&seconds,1,MPI_DOUBLE,MPI_MAX,MPI_COMM_WORLD);
+    results.push_back({name,n,seconds,unit,maxrss(),error});
+    clog_one(trace) << name << ": " << seconds << "s " << n/seconds << " "
+                    << unit << std::endl;
+  }
+
+  /**
+   * @brief      Time nrepeat runs of f, prepared by setup out of the timing.
+   *             Collective.
+   *
+   * @param[in]  n      The local number of operations of one run
+   */
+  template<
+    typename F,
+    typename S>
+  void
+  run(
+    const std::string& name,
+    int64_t n,
+    const std::string& unit,
+    F&& f,
+    S&& setup)
+  {
+    double best = std::numeric_limits<double>::max();
+    for(int r = 0; r < nrepeat; ++r){
+      setup();
+      MPI_Barrier(MPI_COMM_WORLD);
+      double start = MPI_Wtime();
+      f();
+      double seconds = MPI_Wtime() - start;
+      MPI_Allreduce(MPI_IN_PLACE,&seconds,1,MPI_DOUBLE,MPI_MAX,
+        MPI_COMM_WORLD);
+      best = std::min(best,seconds);
+    }
+    record(name,n,best,unit);
+  }
+
+  template<
+    typename F>
+  void
+  run(
+    const std::string& name,
+    int64_t n,
+    const std::string& unit,
+    F&& f)
+  {
+    run(name,n,unit,std::forward<F>(f),[]{});
+  }
+
+  /**
+   * @brief      Write the results in JSON on rank 0
+   */
+  void
+  output(
+    int64_t nparticles)
+  {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+    MPI_Comm_size(MPI_COMM_WORLD,&size);
+    if(rank != 0)
+      return;
+    FILE * out = output_json_file.empty() ? stdout :
+      fopen(output_json_file.c_str(),"w");
+    if(out == nullptr){
+      clog_one(error) << "Cannot open " << output_json_file << std::endl;
+      return;
+    }
+    fprintf(out,"{\n  \"ranks\": %d,\n  \"threads\": %d,\n"
+      "  \"dimension\": %d,\n  \"nparticles\": %ld,\n  \"benchmarks\": [\n",
+      size,omp_get_max_threads(),static_cast<int>(gdimension),nparticles);
+    for(size_t i = 0; i < results.size(); ++i){
+      const result_t& r = results[i];
+      fprintf(out,"    {\"name\": \"%s\", \"n\": %ld, \"seconds\": %.6e, "
+        "\"throughput\": %.6e, \"unit\": \"%s\", \"maxrss_kb\": %ld",
+        r.name.c_str(),r.n,r.seconds,r.seconds > 0. ? r.n/r.seconds : 0.,
+        r.unit.c_str(),r.maxrss_kb);
+      if(r.error >= 0.)
+        fprintf(out,", \"error\": %.6e",r.error);
+      fprintf(out,"}%s\n",i+1 < results.size() ? "," : "");
+    }
+    fprintf(out,"  ]\n}\n");
+    if(out != stdout)
+      fclose(out);
+  }
+
+  /**
+   * @brief      Slice of this rank of the lattice of the parameter file
+   */
+  std::vector<body>
+  lattice_bodies(
+    int64_t& nparticles)
+  {
+    using namespace param;
+    point_t bbox_min, bbox_max;
+    bbox_min = -box_length/2.;
+    bbox_max =  box_length/2.;
+    const double sep = box_length/(lattice_nx-1);
+    const particle_lattice::block_t block = particle_lattice::partition(
+      lattice_type,0,bbox_min,bbox_max,sep);
+    nparticles = block.total;
+    std::vector<double> x(block.nlocal), y(block.nlocal), z(block.nlocal);
+    particle_lattice::generate_block(lattice_type,0,bbox_min,bbox_max,sep,
+      block,0,x.data(),y.data(),z.data());
+
+    const double mass = rho_initial*pow(box_length,gdimension)/nparticles;
+    const double h = sph_eta*kernels::kernel_width*
+      pow(mass/rho_initial,1./gdimension);
+    const double u = pressure_initial/(rho_initial*(poly_gamma-1.));
+    std::vector<body> bodies(block.nlocal);
+    for(int64_t i = 0; i < block.nlocal; ++i){
+      body& b = bodies[i];
+      point_t p;
+      p[0] = x[i];
+      if constexpr (gdimension > 1) p[1] = y[i];
+      if constexpr (gdimension > 2) p[2] = z[i];
+      b.set_coordinates(p);
+      b.set_mass(mass);
+      b.set_radius(h);
+      b.set_id(block.offset+i+1);
+      b.setDensity(rho_initial);
+      b.setPressure(pressure_initial);
+      b.setInternalenergy(u);
+      b.setVelocity(point_t{});
+      b.setAcceleration(point_t{});
+    }
+    return bodies;
+  }
+
+  /**
+   * @brief      Evaluations of the kernel and its gradient on the support
+   */
+  template<
+    param::sph_kernel_keyword K>
+  void
+  kernel(
+    const std::string& name,
+    int64_t n)
+  {
+    const double h = 1.;
+    run("kernel/"+name,n,"evaluations/s",[&]{
+      double sum = 0.;
+      #pragma omp parallel for reduction(+:sum)
+      for(int64_t i = 0; i < n; ++i){
+        double r = kernels::kernel_width*h*(i+.5)/n;
+        sum += kernels::kernel<K,gdimension>(r,h);
+      }
+      sink = sink + sum;
+    });
+    run("kernel_gradient/"+name,n,"evaluations/s",[&]{
+      double sum = 0.;
+      #pragma omp parallel for reduction(+:sum)
+      for(int64_t i = 0; i < n; ++i){
+        point_t p;
+        p[0] = kernels::kernel_width*h*(i+.5)/n;
+        sum += kernels::kernel_gradient<K,gdimension>(p,h)[0];
+      }
+      sink = sink + sum;
+    });
+  }
+
+  /**
+   * @brief      Key encoding of the local particles
+   */
+  template<
+    typename KEY>
+  void
+  keys(
+    const std::string& name,
+    std::vector<body>& bodies,
+    const range_t& range)
+  {
+    std::vector<KEY> ids(bodies.size());
+    run("keys/"+name,bodies.size(),"keys/s",[&]{
+      #pragma omp parallel for
+      for(size_t i = 0; i < bodies.size(); ++i)
+        ids[i] = KEY(range,bodies[i].coordinates());
+    });
+  }
+
+  /**
+   * @brief      Direct summation of the gravitation on the local particles
+   *
+   * @return     The time of the summation
+   */
+  double
+  direct_gravitation(
+    std::vector<body>& bodies,
+    std::vector<point_t>& accelerations)
+  {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD,&size);
+    double start = MPI_Wtime();
+
+    // Gather the positions and masses of all the particles
+    struct source_t {
+      point_t coordinates;
+      double mass;
+      int64_t id;
+    };
+    std::vector<source_t> local(bodies.size());
+    for(size_t i = 0; i < bodies.size(); ++i)
+      local[i] = {bodies[i].coordinates(),bodies[i].mass(),bodies[i].id()};
+    int nbytes = local.size()*sizeof(source_t);
+    std::vector<int> counts(size), offsets(size,0);
+    MPI_Allgather(&nbytes,1,MPI_INT,counts.data(),1,MPI_INT,MPI_COMM_WORLD);
+    for(int i = 1; i < size; ++i)
+      offsets[i] = offsets[i-1] + counts[i-1];
+    std::vector<source_t> sources((offsets.back()+counts.back())/
+      sizeof(source_t));
+    MPI_Allgatherv(local.data(),nbytes,MPI_BYTE,sources.data(),
+      counts.data(),offsets.data(),MPI_BYTE,MPI_COMM_WORLD);
+
+    accelerations.assign(bodies.size(),point_t{});
+    #pragma omp parallel for
+    for(size_t i = 0; i < bodies.size(); ++i){
+      point_t fc{};
+      for(auto& s: sources)
+        if(s.id != bodies[i].id())
+          fmm::gravitation_fc(fc,bodies[i].coordinates(),s.coordinates,
+            s.mass);
+      accelerations[i] = fc;
+    }
+    return MPI_Wtime() - start;
+  }
+
+} // namespace bench
+
+void set_derived_params() {
+  using namespace param;
+
+  // set kernel
+  kernels::select();
+  kernels::set_sinc_kernel_normalization(sph_sinc_index);
+
+  // set viscosity
+  viscosity::select(sph_viscosity);
+
+  // set equation of state
+  eos::select(eos_type);
+
+  // set the lattice generator
+  particle_lattice::select();
+}
+
+namespace flecsi{
+namespace execution{
+
+void
+mpi_init_task(const char * parameter_file){
+  using namespace param;
+  using namespace bench;
+
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+
+  // set simulation parameters
+  param::mpi_read_params(parameter_file);
+  set_derived_params();
+
+  int64_t nparticles = 0;
+  std::vector<body> lattice = lattice_bodies(nparticles);
+  const int64_t nlocal = lattice.size();
+
+  body_system<double,gdimension> bs;
+  bs.setMacangle(fmm_macangle);
+  bs.setMaxmasscell(fmm_max_cell_mass);
+
+  // Tree: keys, sort, build and center of mass from update_iteration
+  timers::registry().clear();
+  for(int r = 0; r < nrepeat; ++r){
+    bs.setLocalbodies(std::vector<body>(lattice));
+    bs.update_iteration();
+  }
+  {
+    auto& phases = timers::registry();
+    record("tree/update_iteration",nlocal,
+      phases["update_iteration"].seconds/nrepeat,"particles/s");
+    record("tree/keys",nlocal,
+      phases["update_iteration/keys"].seconds/nrepeat,"particles/s");
+    record("tree/build",nlocal,
+      phases["update_iteration/tree_build"].seconds/nrepeat,"particles/s");
+    record("tree/cofm",nlocal,
+      phases["update_iteration/cofm"].seconds/nrepeat,"particles/s");
+    timers::registry().clear();
+  }
+
+  // Neighbor search, and the neighbors kept for the functors
+  std::vector<body>& bodies = bs.getLocalbodies();
+  std::vector<std::vector<body*>> neighbors(bodies.size());
+  int64_t nneighbors = 0;
+  run("traversal_sph",bodies.size(),"particles/s",[&]{
+    bs.apply_in_smoothinglength(
+      [&](body& particle, std::vector<body*>& nbs){
+        neighbors[&particle - bodies.data()] = nbs;
+      });
+  });
+  for(auto& nbs: neighbors)
+    nneighbors += nbs.size();
+  clog_one(trace) << "Neighbors per particle (rank 0): "
+                  << nneighbors/std::max<int64_t>(bodies.size(),1)
+                  << std::endl;
+
+  // SPH functors on the neighbors of the traversal
+  bs.apply_all(eos::init);
+  auto functor = [&](const std::string& name, auto ef){
+    run("functor/"+name,bodies.size(),"particles/s",[&]{
+      #pragma omp parallel for
+      for(size_t i = 0; i < bodies.size(); ++i)
+        ef(bodies[i],neighbors[i]);
+    });
+  };
+  functor("compute_density_pressure_soundspeed",
+    physics::compute_density_pressure_soundspeed);
+  functor("compute_acceleration",physics::compute_acceleration);
+  functor("compute_dudt",physics::compute_dudt);
+  functor("compute_dedt",physics::compute_dedt);
+
+  // EOS: per particle pointers against the batch sweep
+  run("eos/pointers",bodies.size(),"particles/s",[&]{
+    #pragma omp parallel for
+    for(size_t i = 0; i < bodies.size(); ++i){
+      eos::compute_pressure(bodies[i]);
+      eos::compute_soundspeed(bodies[i]);
+    }
+  });
+  run("eos/apply",bodies.size(),"particles/s",[&]{
+    eos::apply(bodies);
+  });
+
+  // Kernels: one evaluation per neighbor of a typical particle
+  const int64_t nevaluations = std::max<int64_t>(nneighbors,1000000);
+  kernel<cubic_spline>("cubic_spline",nevaluations);
+  kernel<quintic_spline>("quintic_spline",nevaluations);
+  kernel<wendland_c2>("wendland_c2",nevaluations);
+  kernel<wendland_c4>("wendland_c4",nevaluations);
+  kernel<wendland_c6>("wendland_c6",nevaluations);
+  kernel<gaussian>("gaussian",nevaluations);
+  kernel<super_gaussian>("super_gaussian",nevaluations);
+  kernel<sinc_ker>("sinc",nevaluations);
+
+  // Keys of the lattice particles
+  range_t range;
+  range[0] = -box_length/2.;
+  range[1] =  box_length/2.;
+  keys<flecsi::topology::hilbert_id<uint64_t,gdimension>>("hilbert",
+    lattice,range);
+  keys<flecsi::topology::morton_id<uint64_t,gdimension>>("morton",
+    lattice,range);
+
+  // Distributed sort of random particles, same seed for each run
+  {
+    tree_colorer<double,gdimension> tcolorer;
+    std::vector<body> sorted;
+    run("mpi_qsort",nlocal,"particles/s",[&]{
+      tcolorer.mpi_qsort(sorted,nparticles);
+    },[&]{
+      std::mt19937_64 generator(2019+rank);
+      std::uniform_real_distribution<double> distribution(-box_length/2.,
+        box_length/2.);
+      sorted = lattice;
+      for(auto& b: sorted){
+        point_t p;
+        for(size_t d = 0; d < gdimension; ++d)
+          p[d] = distribution(generator);
+        b.set_coordinates(p);
+        b.set_key(entity_key_t(range,p));
+      }
+    });
+  }
+
+  // Gravitation: FMM on the tree against the direct summation
+  if constexpr (gdimension == 3){
+    run("gravitation/fmm",bodies.size(),"particles/s",[&]{
+      bs.gravitation_fmm();
+    },[&]{
+      for(auto& b: bodies)
+        b.setAcceleration(point_t{});
+    });
+    std::vector<point_t> direct;
+    double seconds = direct_gravitation(bodies,direct);
+    double error = 0.;
+    for(size_t i = 0; i < bodies.size(); ++i){
+      double norm = flecsi::distance(direct[i],point_t{});
+      if(norm > 0.)
+        error = std::max(error,
+          flecsi::distance(bodies[i].getAcceleration(),direct[i])/norm);
+    }
+    MPI_Allreduce(MPI_IN_PLACE,&error,1,MPI_DOUBLE,MPI_MAX,MPI_COMM_WORLD);
+    record("gravitation/direct",bodies.size(),seconds,"particles/s",error);
+  }
+
+  // Leapfrog sweeps of one step, one apply_all per functor or fused. Last:
+  // the particles move
+  run("integration/separate",bodies.size(),"particles/s",[&]{
+    bs.apply_all(integration::leapfrog_kick_v);
+    bs.apply_all(integration::leapfrog_kick_energy);
+    bs.apply_all(integration::save_velocityhalf);
+    bs.apply_all(integration::leapfrog_drift);
+    bs.apply_all(integration::leapfrog_kick_v);
+    bs.apply_all(integration::leapfrog_kick_energy);
+    bs.apply_all(physics::compute_dt);
+  });
+  run("integration/fused",bodies.size(),"particles/s",[&]{
+    bs.apply_all(integration::leapfrog_kick_drift);
+    bs.apply_all(integration::leapfrog_kick_v);
+    bs.apply_all_fused(integration::leapfrog_kick_energy,physics::compute_dt);
+  });
+
+  output(nparticles);
+} // mpi_init_task
+
+
+flecsi_register_mpi_task(mpi_init_task, flecsi::execution);
+
+void
+usage(int rank) {
+  clog_one(warn) << "Usage: ./bench_" << gdimension << "d "
+                 << "<parameter-file.par> [<output.json>]"
+                 << std::endl << std::flush;
+}
+
+void
+specialization_tlt_init(int argc, char * argv[]){
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+
+  clog_set_output_rank(0);
+
+  if (argc != 2 && argc != 3) {
+    clog_one(error) << "ERROR: parameter file not specified!" << std::endl;
+    usage(rank);
+    return;
+  }
+  if (argc == 3)
+    output_json_file = argv[2];
+
+  flecsi_execute_mpi_task(mpi_init_task, flecsi::execution, argv[1]);
+
+} // specialization driver
+
+
+void
+driver(int argc,  char * argv[]){
+} // driver
+
+} // namespace execution
+} // namespace flecsi
@@ -83,8 +83,19 @@ cinch_add_application_directory("mpisph/")
 cinch_add_application_directory("include/physics/test")
 cinch_add_application_directory("include/tree_topology/test")
 
+#------------------------------------------------------------------------------#
+# Drivers specialized on a parameter file: flecsph_specialize()
+#------------------------------------------------------------------------------#
+include(${CMAKE_SOURCE_DIR}/config/specialize.cmake)
+
 #------------------------------------------------------------------------------#
 # Add application targets
 #------------------------------------------------------------------------------#
 cinch_add_application_directory("app/id_generators")
 cinch_add_application_directory("app/drivers")
+cinch_add_application_directory("app/tools")
+
+#------------------------------------------------------------------------------#
+# Add micro-benchmarks
+#------------------------------------------------------------------------------#
+cinch_add_application_directory("bench")
@@ -0,0 +1,109 @@
+#----------------------------------------------------------------------------#
+# Copyright (c) 2017 Triad National Security, LLC
+# All rights reserved.
+#----------------------------------------------------------------------------#
+
+#------------------------------------------------------------------------------#
+# flecsph_specialize(target parfile [NAME name] [EXCLUDE param...])
+#
+# Build a copy of the driver executable target with the parameters of
+# parfile as compile-time constants. A header generated from parfile defines
+# each parameter as a constexpr of its type in params.h, and as a macro
+# expanding to itself so that params.h neither declares nor reads it (see
+# FLECSPH_SPECIALIZATION in params.h). The run control parameters, the input
+# files and the EXCLUDE list stay runtime parameters. The executable,
+# ${target}_<parfile name> by default, still reads a parameter file: it can
+# only repeat the values it was built with. The parameters which the initial
+# data generators derive (nparticles, sph_separation...) stay runtime ones.
+# Must be called in the directory of target.
+#------------------------------------------------------------------------------#
+
+function(flecsph_specialize target parfile)
+  cmake_parse_arguments(SPEC "" "NAME" "EXCLUDE" ${ARGN})
+  get_filename_component(parfile ${parfile} ABSOLUTE)
+  get_filename_component(parname ${parfile} NAME_WE)
+  if(NOT SPEC_NAME)
+    set(SPEC_NAME ${target}_${parname})
+  endif()
+  set(exclude initial_iteration initial_time final_iteration final_time
+    initial_data_prefix initial_data_generator output_h5data_prefix
+    eos_sc_table nparticles sph_separation sph_smoothing_length uint_initial
+    ${SPEC_EXCLUDE})
+
+  # Types of the parameters, from their declaration in params.h
+  file(STRINGS ${CMAKE_SOURCE_DIR}/include/params.h declarations
+    REGEX "^[ \t]*DECLARE_(STRING_|KEYWORD_)?PARAM\\(")
+  foreach(line ${declarations})
+    if(line MATCHES "DECLARE_PARAM\\(([^,]+),[ \t]*([A-Za-z0-9_]+)")
+      string(STRIP "${CMAKE_MATCH_1}" type)
+      set(type_${CMAKE_MATCH_2} "${type}")
+    elseif(line MATCHES "DECLARE_STRING_PARAM\\([ \t]*([A-Za-z0-9_]+)")
+      set(type_${CMAKE_MATCH_1} "const char *")
+    elseif(line MATCHES "DECLARE_KEYWORD_PARAM\\([ \t]*([A-Za-z0-9_]+)")
+      set(type_${CMAKE_MATCH_1} "${CMAKE_MATCH_1}_keyword")
+    endif()
+  endforeach()
+
+  set(header "// Generated by flecsph_specialize from ${parfile}\n")
+  set(values "")
+  file(STRINGS ${parfile} lines)
+  foreach(line ${lines})
+    string(REGEX REPLACE "#.*" "" line "${line}")
+    if(NOT line MATCHES "^[ \t]*([A-Za-z0-9_]+)[ \t]*=[ \t]*(.*[^ \t])[ \t]*$")
+      continue()
+    endif()
+    set(name ${CMAKE_MATCH_1})
+    set(value ${CMAKE_MATCH_2})
+    list(FIND exclude ${name} excluded)
+    if(NOT excluded EQUAL -1)
+      continue()
+    endif()
+    if(NOT DEFINED type_${name})
+      message(FATAL_ERROR "flecsph_specialize: unknown parameter ${name} "
+        "in ${parfile}")
+    endif()
+
+    # The value as read by set_param, without quotes
+    string(REGEX REPLACE "^[\"'](.*)[\"']$" "\\1" value "${value}")
+    set(type "${type_${name}}")
+    if(type STREQUAL "bool")
+      if(value MATCHES "^(yes|true)$")
+        set(constant true)
+      else()
+        set(constant false)
+      endif()
+    elseif(type STREQUAL "const char *")
+      set(constant "\"${value}\"")
+    elseif(type MATCHES "_keyword$")
+      string(TOLOWER "${value}" constant)
+      string(REPLACE " " "_" constant "${constant}")
+    else()
+      set(constant "${value}")
+    endif()
+    string(APPEND header "#define ${name} ${name}\n"
+      "constexpr ${type} ${name} = ${constant};\n")
+    string(APPEND values " \\\n  {\"${name}\",\"${value}\"},")
+  endforeach()
+  if(values)
+    string(APPEND header "#define FLECSPH_SPECIALIZED_PARAMS${values}\n")
+  endif()
+
+  set(header_file ${CMAKE_CURRENT_BINARY_DIR}/${SPEC_NAME}_params.h)
+  file(WRITE ${header_file} "${header}")
+  set_property(DIRECTORY APPEND PROPERTY CMAKE_CONFIGURE_DEPENDS ${parfile})
+
+  # Same sources, libraries and definitions as the target
+  get_target_property(sources ${target} SOURCES)
+  get_target_property(libraries ${target} LINK_LIBRARIES)
+  get_target_property(definitions ${target} COMPILE_DEFINITIONS)
+  add_executable(${SPEC_NAME} ${sources})
+  if(libraries)
+    target_link_libraries(${SPEC_NAME} ${libraries})
+  endif()
+  if(definitions)
+    target_compile_definitions(${SPEC_NAME} PUBLIC ${definitions})
+  endif()
+  target_compile_definitions(${SPEC_NAME} PUBLIC
+    FLECSPH_SPECIALIZATION="${header_file}")
+  install(TARGETS ${SPEC_NAME} RUNTIME DESTINATION bin/drivers)
+endfunction()
@@ -28,6 +28,7 @@
 
 #include <vector>
 #include "params.h"
+#include "reductions.h"
 
 namespace diagnostic {
 
@@ -163,21 +164,66 @@ namespace diagnostic {
     V_average = V_tot/totalnbodies;
   }
 
+  // Reduction group of the diagnostic output, offsets of its quantities
+  int diagnostic_group = -1;
+  int offset_h, offset_V;
+
+  /**
+   * @brief      Add the min, max and sum of f over the particles to the
+   *             diagnostic reductions
+   *
+   * @return     The offset of the min, followed by the max and the sum
+   */
+  int
+  add_stats(double (*f)(const body&))
+  {
+    using namespace reductions;
+    const int offset = add(diagnostic_group,MIN,1,
+      [f](const body* b, int64_t n, double* acc){
+        for(int64_t i = 0; i < n; ++i) acc[0] = std::min(acc[0],f(b[i]));
+      });
+    add(diagnostic_group,MAX,1,
+      [f](const body* b, int64_t n, double* acc){
+        for(int64_t i = 0; i < n; ++i) acc[0] = std::max(acc[0],f(b[i]));
+      });
+    add(diagnostic_group,SUM,1,
+      [f](const body* b, int64_t n, double* acc){
+        for(int64_t i = 0; i < n; ++i) acc[0] += f(b[i]);
+      });
+    return offset;
+  }
+
+  /**
+   * @brief      Register the quantities of the diagnostic output, same as
+   *             compute_smoothinglength_stats and compute_velocity_stats
+   */
+  void
+  add_diagnostic_reductions()
+  {
+    diagnostic_group = reductions::add_group();
+    offset_h = add_stats([](const body& b){ return b.radius(); });
+    offset_V = add_stats([](const body& b){
+      return norm_point(b.getVelocity()); });
+  }
+
   /**
    * @brief Periodic file output
    */
   void
-  output(body_system<double,gdimension>& bs, const int rank)
+  write_output(
+    const double* values,
+    const int rank,
+    const int64_t iteration,
+    const double totaltime,
+    const int64_t totalnbodies)
   {
     static bool first_time = true;
-    if (param::out_diagnostic_every <= 0
-      || physics::iteration % param::out_diagnostic_every!=0)
-      return;
-
-    // compute diagnostic quantities
-    // bs.get_all(compute_neighbors_stats,bs.tree(),bs.getNBodies());
-    bs.get_all(compute_smoothinglength_stats,bs.getNBodies());
-    bs.get_all(compute_velocity_stats,bs.getNBodies());
+    h_min = values[offset_h];
+    h_max = values[offset_h+1];
+    h_average = values[offset_h+2]/totalnbodies;
+    V_min = values[offset_V];
+    V_max = values[offset_V+1];
+    V_average = values[offset_V+2]/totalnbodies;
 
     // output only from rank #0
     if (rank != 0) return;
@@ -200,9 +246,9 @@ namespace diagnostic {
     }
 
     std::ostringstream oss_data;
-    oss_data << std::setw(5) << physics::iteration
+    oss_data << std::setw(5) << iteration
       << std::setw(20) << std::scientific << std::setprecision(12)
-      << physics::totaltime << std::setw(20)
+      << totaltime << std::setw(20)
       << h_min << std::setw(20) << h_max << std::setw(20)
       << h_average << std::setw(5) << N_min << std::setw(5)
       << N_max << std::setw(5) << N_average << std::setw(20)
@@ -216,6 +262,26 @@ namespace diagnostic {
     out << oss_data.str();
     out.close();
 
+  } // write_output
+
+  /**
+   * @brief      Request the diagnostic reductions of this iteration, the line
+   *             is written when they complete (reductions::start)
+   */
+  void
+  output(body_system<double,gdimension>& bs, const int rank)
+  {
+    if (param::out_diagnostic_every <= 0
+      || physics::iteration % param::out_diagnostic_every!=0)
+      return;
+    if (diagnostic_group < 0)
+      add_diagnostic_reductions();
+    const int64_t iteration = physics::iteration;
+    const double totaltime = physics::totaltime;
+    const int64_t totalnbodies = bs.getNBodies();
+    reductions::request(diagnostic_group,[=](const double* values){
+      write_output(values,rank,iteration,totaltime,totalnbodies);
+    });
   } // scalar output
 
 }; // namespace diagnostic
@@ -42,9 +42,17 @@
  *  count_only   - boolean for determing particle number (returned for allocating
  *                 proper arrays) or writing positions to those arrays
  *  x,y,z[]      - the arrays to be filled for the positions of each particle
+ *  planes       - optional selection of the planes of the outermost loop of
+ *                 the generator (see planes_t) for distributed generation
  */
 
+#ifndef LATTICE_H
+#define LATTICE_H
+
 #include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <mpi.h>
 #include "user.h"
 #include "tree.h"
 #include <math.h>
@@ -56,6 +64,29 @@
 namespace particle_lattice {
 const double b_tol = 1e-12; // boundary tolerance
 
+/**
+ * @brief  Selection of the planes of the outermost loop of a generator: the
+ *         points in 1D, the rows in 2D, the layers in 3D and the shells of the
+ *         icosahedral lattice. The particles of a plane are generated
+ *         contiguously, so that a range of planes is a contiguous range of
+ *         particle ids. The generators still run through the skipped planes,
+ *         without their particles, for the positions to be the same.
+ */
+struct planes_t {
+  int64_t first = 0;          // first selected plane
+  int64_t last = INT64_MAX;   // past the last selected plane
+  int64_t stride = 1;         // every stride-th plane from first
+  int64_t * counts = NULL;    // if set, counts[ip] += particles of plane ip
+  int64_t nplanes = 0;        // set by the generator: planes of the lattice
+
+  bool selected(const int64_t ip) const {
+    return ip >= first && ip < last && (ip - first)%stride == 0;
+  }
+  void tally(const int64_t ip) {
+    if(counts) ++counts[ip];
+  }
+};
+
 /**
  * @brief  in_domain_?d functions check whether a particle belongs to a given
  *         domain. This takes into account whether the boundaries are included
@@ -133,7 +164,8 @@ int64_t generator_lattice_1d(
    bool count_only = true,
    double x[] = NULL,
    double y[] = NULL,
-   double z[] = NULL)
+   double z[] = NULL,
+   planes_t * planes = NULL)
 {
   // Central coordinates: in most cases this should be centered at 0
   double x_c = (bbox_max[0] + bbox_min[0])/2.;
@@ -141,18 +173,25 @@ int64_t generator_lattice_1d(
   // Save the starting position id
   const int64_t posid_starting = posid;
 
+  // All the planes by default
+  planes_t all_planes;
+  if(!planes) planes = &all_planes;
+  int64_t ip = 0;
+
   // regular lattice in 1D
   double xmin = bbox_min[0], xmax = bbox_max[0];
-  for(double x_p = xmin; x_p < xmax; x_p += sph_sep){
-    if(in_domain_1d(x_p, xmin, xmax, domain_type)){
+  for(double x_p = xmin; x_p < xmax; x_p += sph_sep, ++ip){
+    if(planes->selected(ip) && in_domain_1d(x_p, xmin, xmax, domain_type)){
       if(!count_only){
         x[posid] = x_p;
         y[posid] = 0.0;
         z[posid] = 0.0;
       }
+      planes->tally(ip);
       posid++;
     }
   }
+  planes->nplanes = ip;
   return (posid - posid_starting);
 }
 
@@ -167,7 +206,8 @@ generator_lattice_2d(
     bool count_only = true,
     double x[] = NULL,
     double y[] = NULL,
-    double z[] = NULL)
+    double z[] = NULL,
+    planes_t * planes = NULL)
 {
    // Coordinate extents
    double xmin = bbox_min[0], xmax = bbox_max[0];
@@ -180,30 +220,38 @@ generator_lattice_2d(
    // Save the starting position id
    const int64_t posid_starting = posid;
 
+   // All the rows by default
+   planes_t all_planes;
+   if(!planes) planes = &all_planes;
+   int64_t ip = 0;
+
    if (lattice_type==0) { // rectangular lattice
-     for(double y_p=ymin; y_p<ymax; y_p+=dx)
-     for(double x_p=xmin; x_p<xmax; x_p+=dx)
+     for(double y_p=ymin; y_p<ymax; y_p+=dx, ++ip)
+     for(double x_p=xmin; x_p<xmax && planes->selected(ip); x_p+=dx)
      if(in_domain_2d(x_p,y_p, bbox_min,bbox_max, domain_type)){
        if(!count_only){
          x[posid] = x_p;
          y[posid] = y_p;
          z[posid] = 0.0;
        }
+       planes->tally(ip);
        posid++;
      } // if in domain
    }
    else { // triangular lattice
-     for(double y_p=ymin,    yo=0; y_p<ymax; y_p+=dy,yo=1-yo)
-     for(double x_p=xmin +yo*dx/2; x_p<xmax; x_p+=dx)
+     for(double y_p=ymin,    yo=0; y_p<ymax; y_p+=dy,yo=1-yo, ++ip)
+     for(double x_p=xmin +yo*dx/2; x_p<xmax && planes->selected(ip); x_p+=dx)
      if(in_domain_2d(x_p,y_p, bbox_min,bbox_max, domain_type)) {
        if(!count_only){
          x[posid] = x_p;
          y[posid] = y_p;
          z[posid] = 0.0;
        }
+       planes->tally(ip);
        posid++;
      } // if in domain
    } // lattice
+   planes->nplanes = ip;
    return (posid - posid_starting);
 }
 
@@ -219,11 +267,17 @@ generator_lattice_3d(
     bool count_only = true,
     double x[] = NULL,
     double y[] = NULL,
-    double z[] = NULL)
+    double z[] = NULL,
+    planes_t * planes = NULL)
 {
    // Save the starting position id
    const int64_t posid_starting = posid;
 
+   // All the layers by default
+   planes_t all_planes;
+   if(!planes) planes = &all_planes;
+   int64_t ip = 0;
+
    // Coordinate extents
    double xmin = bbox_min[0], xmax = bbox_max[0];
    double ymin = bbox_min[1], ymax = bbox_max[1];
@@ -236,8 +290,8 @@ generator_lattice_3d(
 
    // The loop for lattice_type==0 (rectangular)
    if(lattice_type==0){
-     for(double z_p=xmin; z_p<zmax; z_p+=dx)
-     for(double y_p=ymin; y_p<ymax; y_p+=dx)
+     for(double z_p=xmin; z_p<zmax; z_p+=dx, ++ip)
+     for(double y_p=ymin; y_p<ymax && planes->selected(ip); y_p+=dx)
      for(double x_p=zmin; x_p<xmax; x_p+=dx)
      if(in_domain_3d(x_p,y_p,z_p, bbox_min,bbox_max, domain_type)) {
        if(!count_only){
@@ -245,12 +299,14 @@ generator_lattice_3d(
          y[posid] = y_p;
          z[posid] = z_p;
        }
+       planes->tally(ip);
        posid++;
      } // if in domain
    }
    else if(lattice_type==1){//hcp lattice in 3D
-     for(double z_p=zmin,         zo=0; z_p<zmax; z_p+=dz, zo=1-zo)
-     for(double y_p=ymin-zo*dy/3, yo=0; y_p<ymax; y_p+=dy, yo=1-yo)
+     for(double z_p=zmin,         zo=0; z_p<zmax; z_p+=dz, zo=1-zo, ++ip)
+     for(double y_p=ymin-zo*dy/3, yo=0; y_p<ymax && planes->selected(ip);
+                y_p+=dy, yo=1-yo)
      for(double x_p=xmin+(yo-zo)*dx/2.; x_p<xmax; x_p+=dx)
      if(in_domain_3d(x_p,y_p,z_p, bbox_min,bbox_max, domain_type)) {
        if(!count_only){
@@ -258,12 +314,14 @@ generator_lattice_3d(
          y[posid] = y_p;
          z[posid] = z_p;
        }
+       planes->tally(ip);
        posid++;
      } // if in domain
    }
    else if(lattice_type==2) {//fcc lattice in 3D
-     for(double z_p=zmin,         zl=0; z_p<zmax; z_p+=dz, zl=(zl+1)*(zl<3))
-     for(double y_p=ymin-zl*dy/3, yo=0; y_p<ymax; y_p+=dy, yo=1-yo)
+     for(double z_p=zmin,         zl=0; z_p<zmax; z_p+=dz, zl=(zl+1)*(zl<3), ++ip)
+     for(double y_p=ymin-zl*dy/3, yo=0; y_p<ymax && planes->selected(ip);
+                y_p+=dy, yo=1-yo)
      for(double x_p=xmin+(yo-zl)*dx/2.; x_p<xmax; x_p+=dx)
      if(in_domain_3d(x_p,y_p,z_p, bbox_min,bbox_max, domain_type)) {
        if(!count_only){
@@ -271,9 +329,11 @@ generator_lattice_3d(
          y[posid] = y_p;
          z[posid] = z_p;
        }
+       planes->tally(ip);
        posid++;
      } // if in domain
    } // lattice_type
+   planes->nplanes = ip;
 
    return (posid - posid_starting);
 }
@@ -316,13 +376,18 @@ int64_t npart_icosahedral_sphere(const int k) {
 int64_t generator_icosahedral_lattice(const int lattice_type,
     const int domain_type, const point_t& bbox_min, const point_t& bbox_max,
     const double sph_sep, int64_t posid, bool count_only = true,
-    double x[] = NULL, double y[] = NULL, double z[] = NULL) {
+    double x[] = NULL, double y[] = NULL, double z[] = NULL,
+    planes_t * planes = NULL) {
   // sanity check
   assert (lattice_type == 3 and gdimension == 3);
 
   // save the starting position id
   const int64_t posid_starting = posid;
 
+  // all the shells by default
+  planes_t all_planes;
+  if(!planes) planes = &all_planes;
+
   // coordinate extents
   const double xmin = bbox_min[0], xmax = bbox_max[0];
   const double ymin = bbox_min[1], ymax = bbox_max[1];
@@ -376,6 +441,8 @@ int64_t generator_icosahedral_lattice(const int lattice_type,
   double mrk12p = m0, mrk12;
 
   for (int NN=0; NN<=K_rad; ++NN) {
+    // the radius of the next shell is still updated for a skipped one
+    const bool selected = planes->selected(NN);
 
     // 
     //-- Vertices
@@ -404,7 +471,7 @@ int64_t generator_icosahedral_lattice(const int lattice_type,
 
     if (NN > 0) {
       // assign vertices
-      for (i=0; i<12; ++i) {
+      for (i=0; selected && i<12; ++i) {
         x_p = x_c + ico_vtx[i][0];
         y_p = y_c + ico_vtx[i][1];
         z_p = z_c + ico_vtx[i][2];
@@ -414,24 +481,26 @@ int64_t generator_icosahedral_lattice(const int lattice_type,
             y[posid] = y_p;
             z[posid] = z_p;
           }
+          planes->tally(NN);
           posid++;
         } // if in domain
       } // for i from 0 to 12
     }
-    else {
+    else if (selected) {
       // single point at the origin
       if(!count_only){
         x[posid] = x_c;
         y[posid] = y_c;
         z[posid] = z_c;
       }
+      planes->tally(NN);
       posid++;
     } // if NN>0
 
     //
     //-- Edges
     //
-    for (i=0; i<30; ++i) {
+    for (i=0; selected && i<30; ++i) {
       v1= ico_edg[i][0] - 1;
       v2= ico_edg[i][1] - 1;
 
@@ -468,6 +537,7 @@ int64_t generator_icosahedral_lattice(const int lattice_type,
             y[posid] = y_p;
             z[posid] = z_p;
           }
+          planes->tally(NN);
           posid++;
         } // if in domain
       } // for k from 1 to NN-1
@@ -476,7 +546,7 @@ int64_t generator_icosahedral_lattice(const int lattice_type,
     //
     //-- Faces
     //
-    for (i=0; i<20; ++i) {
+    for (i=0; selected && i<20; ++i) {
       v1= ico_fac[i][0] - 1;
       v2= ico_fac[i][1] - 1;
       v3= ico_fac[i][2] - 1;
@@ -528,6 +598,7 @@ int64_t generator_icosahedral_lattice(const int lattice_type,
               y[posid] = y_p;
               z[posid] = z_p;
             }
+            planes->tally(NN);
             posid++;
           } // if in domain
 
@@ -559,6 +630,7 @@ int64_t generator_icosahedral_lattice(const int lattice_type,
     mrk12p= mrk12;
 
   } //  NN
+  planes->nplanes = K_rad + 1;
 //  exit(0);
 
   return (posid - posid_starting);
@@ -625,21 +697,27 @@ typedef int64_t (*lattice_generate_function_t)(const int, const int,
     double*, double*, double*);
 typedef int64_t (*particle_count_function_t)(const int, const int,
     const point_t&, const point_t&, const double, int64_t);
-lattice_generate_function_t generate;
-particle_count_function_t   count;
+typedef int64_t (*lattice_generator_function_t)(const int, const int,
+    const point_t&, const point_t&, const double, int64_t, bool,
+    double*, double*, double*, planes_t*);
+lattice_generate_function_t  generate;
+particle_count_function_t    count;
+lattice_generator_function_t generator;
 
 /**
- * @brief  Installs the 'generate' and 'count' function pointers
+ * @brief  Installs the 'generate', 'count' and 'generator' function pointers
  */
 void select() {
   switch(gdimension) {
   case 1:
     generate = generate_lattice_1d;
     count = count_lattice_1d;
+    generator = generator_lattice_1d;
     break;
   case 2:
     generate = generate_lattice_2d;
     count = count_lattice_2d;
+    generator = generator_lattice_2d;
     break;
   case 3:
     switch(param::lattice_type) {
@@ -648,10 +726,12 @@ void select() {
     case 2:
       generate = generate_lattice_3d;
       count = count_lattice_3d;
+      generator = generator_lattice_3d;
       break;
     case 3:
       generate = generate_icosahedral_lattice;
       count = count_icosahedral_lattice;
+      generator = generator_icosahedral_lattice;
       break;
     default:
       std::cerr << "ERROR: lattice_type not implemented" << std::endl;
@@ -666,7 +746,95 @@ void select() {
 }
 
 
+/**
+ * @brief  Sub-block of a lattice generated by a rank
+ */
+struct block_t {
+  planes_t planes;      // planes of the rank
+  int64_t nlocal = 0;   // particles of the rank
+  int64_t offset = 0;   // index of its first particle in the lattice
+  int64_t total = 0;    // particles of the lattice
+};
+
+/**
+ * @brief  Splits the planes of the lattice in contiguous ranges of balanced
+ *         particle counts over the ranks of comm. The ranks count the
+ *         particles of the planes round-robin, so that the counting is
+ *         distributed too. The particles of a rank are then the particles
+ *         [offset, offset+nlocal) of the serial lattice. Collective on comm.
+ *
+ * @param  Refer to inputs section in introduction; select() must be called
+ */
+block_t partition(const int lattice_type, const int domain_type,
+    const point_t& bbox_min, const point_t& bbox_max, const double sph_sep,
+    MPI_Comm comm = MPI_COMM_WORLD) {
+  int rank, size;
+  MPI_Comm_rank(comm,&rank);
+  MPI_Comm_size(comm,&size);
+
+  // number of planes: no plane is selected
+  planes_t none;
+  none.last = 0;
+  generator(lattice_type,domain_type,bbox_min,bbox_max,sph_sep,0,true,
+      NULL,NULL,NULL,&none);
+  const int64_t nplanes = none.nplanes;
+
+  // particles per plane
+  std::vector<int64_t> counts(nplanes,0);
+  planes_t strided;
+  strided.first = rank;
+  strided.stride = size;
+  strided.counts = counts.data();
+  generator(lattice_type,domain_type,bbox_min,bbox_max,sph_sep,0,true,
+      NULL,NULL,NULL,&strided);
+  MPI_Allreduce(MPI_IN_PLACE,counts.data(),nplanes,MPI_INT64_T,MPI_SUM,comm);
+
+  block_t block;
+  for(int64_t ip = 0; ip < nplanes; ++ip)
+    block.total += counts[ip];
+
+  // a plane goes to the rank of the middle of its particles
+  block.planes.first = block.planes.last = nplanes;
+  int64_t before = 0;
+  for(int64_t ip = 0; ip < nplanes; ++ip) {
+    const double middle = before + 0.5*counts[ip];
+    const int owner = std::min(size - 1,
+        (int)(middle*size/std::max(block.total,(int64_t)1)));
+    if(owner == rank) {
+      block.planes.first = std::min(block.planes.first,ip);
+      block.planes.last = ip + 1;
+      block.nlocal += counts[ip];
+    }
+    before += counts[ip];
+  }
+  if(block.planes.first == nplanes)
+    block.planes.last = nplanes;
+
+  // exact ids: the particles of the lower ranks come first
+  MPI_Exscan(&block.nlocal,&block.offset,1,MPI_INT64_T,MPI_SUM,comm);
+  if(rank == 0)
+    block.offset = 0;
+  return block;
+}
+
+/**
+ * @brief  Generates the particles of the sub-block of a rank, from posid on
+ *         in the arrays, which hold at least block.nlocal particles
+ *
+ * @return the number of particles generated, block.nlocal
+ */
+int64_t generate_block(const int lattice_type, const int domain_type,
+    const point_t& bbox_min, const point_t& bbox_max, const double sph_sep,
+    const block_t& block, int64_t posid, double * x, double * y, double * z) {
+  planes_t planes = block.planes;
+  return generator(lattice_type,domain_type,bbox_min,bbox_max,sph_sep,posid,
+      false,x,y,z,&planes);
+}
+
+
 } // namespace particle_lattice
 
 #undef SQ
 #undef CU
+
+#endif // LATTICE_H
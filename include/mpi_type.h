@@ -0,0 +1,40 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file mpi_type.h
+ * @brief Contiguous MPI datatypes of the exchanged structures, used by the
+ * tree topology and by the mpi_utils exchanges.
+ */
+
+#ifndef _mpi_type_h_
+#define _mpi_type_h_
+
+#include <mpi.h>
+
+namespace mpi_utils{
+
+  /**
+   * @brief      Contiguous MPI datatype of one M, committed at the first use.
+   * The messages count elements of M instead of bytes: the int counts of MPI
+   * then limit them to 2^31 elements instead of 2 GiB.
+   */
+  template<
+    typename M>
+  MPI_Datatype
+  mpi_type()
+  {
+    static MPI_Datatype type = []{
+      MPI_Datatype t;
+      MPI_Type_contiguous(sizeof(M),MPI_BYTE,&t);
+      MPI_Type_commit(&t);
+      return t;
+    }();
+    return type;
+  }
+
+} // namespace mpi_utils
+
+#endif // _mpi_type_h_
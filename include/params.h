@@ -51,7 +51,9 @@
  * avoid confusion. Parameters are read-only (const references) in the param::
  * namespace. It is also possible to #define a parameter instead for optimized
  * performance -- in this case, however, this parameter needs to be commented out
- * in the parameter file.
+ * in the parameter file. The CMake function flecsph_specialize(target parfile)
+ * builds a driver with all the parameters of a parameter file as constants;
+ * this driver accepts the same parameter file.
  *
  * To introduce a new parameter:
  *  - add its declaration below using DECLARE_PARAM or DECLARE_STRING_PARAM
@@ -130,6 +132,13 @@ typedef enum sph_kernel_keyword_enum {
   sinc_ker
 } sph_kernel_keyword;
 
+// Parameters built in the executable as constants by flecsph_specialize:
+// the header defines each of them as a macro expanding to itself, which
+// skips its declaration and reading below, and a constexpr with its value
+#ifdef FLECSPH_SPECIALIZATION
+#include FLECSPH_SPECIALIZATION
+#endif
+
 //////////////////////////////////////////////////////////////////////
 //
 // Parameters controlling timestepping and iterations
@@ -205,6 +214,17 @@ typedef enum sph_kernel_keyword_enum {
   DECLARE_PARAM(double,sph_sinc_index,4.0)
 #endif
 
+//- if true, the kernel and its gradient are sampled in q = r/h at
+// kernels::select() and linearly interpolated in the table
+#ifndef sph_kernel_tabulated
+  DECLARE_PARAM(bool,sph_kernel_tabulated,false)
+#endif
+
+//- number of intervals of the tabulated kernel on the support
+#ifndef sph_kernel_table_size
+  DECLARE_PARAM(int64_t,sph_kernel_table_size,4096)
+#endif
+
 //- if true, recompute (uniform) smoothing length every timestep
 //  h = average { sph_eta (m/rho)^1/D } (Rosswog'09, eq.51)
 # ifndef sph_update_uniform_h
@@ -217,6 +237,51 @@ typedef enum sph_kernel_keyword_enum {
   DECLARE_PARAM(bool, sph_variable_h,false)
 #endif
 
+//- if true, the density, acceleration and dudt are computed in symmetric
+// mode: each pair of particles is computed once and the contribution is
+// added to both particles
+#ifndef sph_symmetric_interactions
+  DECLARE_PARAM(bool, sph_symmetric_interactions,false)
+#endif
+
+//- if true, the ranks of a node keep their particles in MPI-3 shared
+// memory segments: the neighbors owned by a rank of the same node are read
+// in its segment, only the ones of the other nodes are requested. The first
+// traversal of each tree requests all the neighbors to mark the entities
+// the segments need.
+#ifndef node_shared_ghosts
+  DECLARE_PARAM(bool, node_shared_ghosts,false)
+#endif
+
+//- variable smoothing length: target number of neighbors for the h-rho
+// iterations. If <= 0, derived from sph_eta:
+// N = V_D (sph_eta*kernel_width)^D, V_D the volume of the unit sphere
+#ifndef sph_neighbors_target
+  DECLARE_PARAM(double,sph_neighbors_target,0.)
+#endif
+
+//- variable smoothing length: radius factor of the candidates list used
+// for the h-rho iterations
+#ifndef sph_h_search_factor
+  DECLARE_PARAM(double,sph_h_search_factor,1.2)
+#endif
+
+//- variable smoothing length: relative tolerance and maximum number of
+// Newton-Raphson iterations for the h-rho solve
+#ifndef sph_h_tolerance
+  DECLARE_PARAM(double,sph_h_tolerance,1.e-4)
+#endif
+
+#ifndef sph_h_max_iterations
+  DECLARE_PARAM(int,sph_h_max_iterations,20)
+#endif
+
+//- variable smoothing length: maximum number of density traversals, the
+// particles whose h left their candidates radius are searched again
+#ifndef sph_h_max_passes
+  DECLARE_PARAM(int,sph_h_max_passes,4)
+#endif
+
 //
 // Geometric parameters
 //
@@ -281,6 +346,23 @@ typedef enum sph_kernel_keyword_enum {
   DECLARE_STRING_PARAM(initial_data_prefix,"initial_data")
 #endif
 
+//- generate the initial data in memory with this generator (sodtube, noh
+// or sedov) instead of reading the initial data file
+#ifndef initial_data_generator
+  DECLARE_STRING_PARAM(initial_data_generator,"")
+#endif
+
+//- restart from the native checkpoint of initial_iteration if it exists
+#ifndef initial_data_checkpoint
+  DECLARE_PARAM(bool,initial_data_checkpoint,false)
+#endif
+
+//- read the initial data already distributed by keys: positions are read
+// first, then each process reads its own particles
+#ifndef initial_data_key_sorted
+  DECLARE_PARAM(bool,initial_data_key_sorted,false)
+#endif
+
 //- ID-generator-specific parameter to overwrite initial data
 #ifndef modify_initial_data
   DECLARE_PARAM(bool,modify_initial_data,false)
@@ -306,6 +388,50 @@ typedef enum sph_kernel_keyword_enum {
   DECLARE_PARAM(int32_t,out_diagnostic_every,10);
 #endif
 
+//- in-situ grid deposition frequency (0: never)
+#ifndef out_grid_every
+  DECLARE_PARAM(int32_t,out_grid_every,0)
+#endif
+
+//- number of grid points in each direction; a direction with one point
+// is a slice at out_grid_[xyz]min
+#ifndef out_grid_nx
+  DECLARE_PARAM(int32_t,out_grid_nx,64)
+#endif
+
+#ifndef out_grid_ny
+  DECLARE_PARAM(int32_t,out_grid_ny,64)
+#endif
+
+#ifndef out_grid_nz
+  DECLARE_PARAM(int32_t,out_grid_nz,1)
+#endif
+
+//- grid bounds; if min == max the range of the particles is used
+#ifndef out_grid_xmin
+  DECLARE_PARAM(double,out_grid_xmin,0.0)
+#endif
+
+#ifndef out_grid_xmax
+  DECLARE_PARAM(double,out_grid_xmax,0.0)
+#endif
+
+#ifndef out_grid_ymin
+  DECLARE_PARAM(double,out_grid_ymin,0.0)
+#endif
+
+#ifndef out_grid_ymax
+  DECLARE_PARAM(double,out_grid_ymax,0.0)
+#endif
+
+#ifndef out_grid_zmin
+  DECLARE_PARAM(double,out_grid_zmin,0.0)
+#endif
+
+#ifndef out_grid_zmax
+  DECLARE_PARAM(double,out_grid_zmax,0.0)
+#endif
+
 //- HDF5 output frequency
 #ifndef out_h5data_every
   DECLARE_PARAM(int32_t,out_h5data_every,10)
@@ -316,6 +442,42 @@ typedef enum sph_kernel_keyword_enum {
   DECLARE_PARAM(bool,out_h5data_separate_iterations,false)
 #endif
 
+//- write the HDF5 output in a background thread, the main loop only
+// blocks if out_h5data_async_buffers snapshots are still in flight
+#ifndef out_h5data_async
+  DECLARE_PARAM(bool,out_h5data_async,false)
+#endif
+
+#ifndef out_h5data_async_buffers
+  DECLARE_PARAM(int32_t,out_h5data_async_buffers,2)
+#endif
+
+//- how often to write the native per-rank checkpoint (0: never)
+#ifndef out_checkpoint_every
+  DECLARE_PARAM(int32_t,out_checkpoint_every,0)
+#endif
+
+//- comma separated list of the particles fields in the HDF5 output:
+// x,v,a,h,rho,u,P,m,dt,id,type or "all" for the default set
+#ifndef out_h5data_fields
+  DECLARE_STRING_PARAM(out_h5data_fields,"all")
+#endif
+
+//- store the floating point fields in single precision
+#ifndef out_h5data_single_precision
+  DECLARE_PARAM(bool,out_h5data_single_precision,false)
+#endif
+
+//- deflate level of the particles datasets (0: no compression)
+#ifndef out_h5data_compression
+  DECLARE_PARAM(int32_t,out_h5data_compression,0)
+#endif
+
+//- chunk size of the particles datasets, in elements (0: contiguous)
+#ifndef out_h5data_chunk_size
+  DECLARE_PARAM(int64_t,out_h5data_chunk_size,65536)
+#endif
+
 //
 // Viscosity and equation of state
 //
@@ -323,10 +485,24 @@ typedef enum sph_kernel_keyword_enum {
 //  * "ideal fluid" (default)
 //  * "polytropic"
 //  * "white dwarf"
+//  * "stellar collapse": tabulated, see eos_sc_table
 #ifndef eos_type
   DECLARE_STRING_PARAM(eos_type,"ideal fluid")
 #endif
 
+//- if true, the pressure and sound speed are computed in one vectorized
+// sweep over the particles after the density (eos::apply), instead of per
+// particle in the density traversal
+#ifndef eos_batch
+  DECLARE_PARAM(bool,eos_batch,false)
+#endif
+
+//- HDF5 table of the "stellar collapse" EOS, from stellarcollapse.org.
+// Density, internal energy and pressure are in CGS, temperature in MeV
+#ifndef eos_sc_table
+  DECLARE_STRING_PARAM(eos_sc_table,"eos_table.h5")
+#endif
+
 //- polytropic index
 #ifndef poly_gamma
   DECLARE_PARAM(double,poly_gamma,1.4)
@@ -633,38 +809,40 @@ void set_param(const std::string& param_name,
     for (int c=0; c<str_value.length(); ++c)
       if (str_value[c] == ' ') str_value[c] = '_';
 
-#   ifndef sph_kernel
+    sph_kernel_keyword kernel_value = wendland_c4;
     if (boost::iequals(str_value,"cubic_spline"))
-      _sph_kernel =               cubic_spline;
+      kernel_value =                   cubic_spline;
 
     else if (boost::iequals(str_value,"quintic_spline"))
-      _sph_kernel =                    quintic_spline;
+      kernel_value =                   quintic_spline;
 
     else if (boost::iequals(str_value,"wendland_c2"))
-      _sph_kernel =                    wendland_c2;
+      kernel_value =                   wendland_c2;
 
     else if (boost::iequals(str_value,"wendland_c4"))
-      _sph_kernel =                    wendland_c4;
+      kernel_value =                   wendland_c4;
 
     else if (boost::iequals(str_value,"wendland_c6"))
-      _sph_kernel =                    wendland_c6;
+      kernel_value =                   wendland_c6;
 
     else if (boost::iequals(str_value,"gaussian"))
-      _sph_kernel =                    gaussian;
+      kernel_value =                   gaussian;
 
     else if (boost::iequals(str_value,"super_gaussian"))
-      _sph_kernel =                    super_gaussian;
+      kernel_value =                   super_gaussian;
 
     else if (boost::iequals(str_value,"sinc_ker"))
-       _sph_kernel =                   sinc_ker;
+      kernel_value =                   sinc_ker;
 
     else {
       assert(false);
     }
+#   ifndef sph_kernel
+    _sph_kernel = kernel_value;
 #   else
-    if (not boost::iequals(str_value,QUOTE(sph_kernel))) {
-      clog_one(error) 
-          << "ERROR: sph_kernel #defined as \"" << QUOTE(sph_kernel) << "\" "
+    if (kernel_value != sph_kernel) {
+      clog_one(error)
+          << "ERROR: sph_kernel is built in the executable "
           << "but is reset to \"" << str_value << "\" in parameter file"
           << std::endl;
       exit(2);
@@ -677,6 +855,14 @@ void set_param(const std::string& param_name,
   READ_NUMERIC_PARAM(sph_sinc_index)
 # endif
 
+# ifndef sph_kernel_tabulated
+  READ_BOOLEAN_PARAM(sph_kernel_tabulated)
+# endif
+
+# ifndef sph_kernel_table_size
+  READ_NUMERIC_PARAM(sph_kernel_table_size)
+# endif
+
 # ifndef sph_update_uniform_h
   READ_BOOLEAN_PARAM(sph_update_uniform_h)
 # endif
@@ -685,6 +871,34 @@ void set_param(const std::string& param_name,
   READ_BOOLEAN_PARAM(sph_variable_h)
 #endif
 
+#ifndef sph_symmetric_interactions
+  READ_BOOLEAN_PARAM(sph_symmetric_interactions)
+#endif
+
+#ifndef node_shared_ghosts
+  READ_BOOLEAN_PARAM(node_shared_ghosts)
+#endif
+
+#ifndef sph_neighbors_target
+  READ_NUMERIC_PARAM(sph_neighbors_target)
+#endif
+
+#ifndef sph_h_search_factor
+  READ_NUMERIC_PARAM(sph_h_search_factor)
+#endif
+
+#ifndef sph_h_tolerance
+  READ_NUMERIC_PARAM(sph_h_tolerance)
+#endif
+
+#ifndef sph_h_max_iterations
+  READ_NUMERIC_PARAM(sph_h_max_iterations)
+#endif
+
+#ifndef sph_h_max_passes
+  READ_NUMERIC_PARAM(sph_h_max_passes)
+#endif
+
   // geometric configuration  -----------------------------------------------
 # ifndef domain_type
   READ_NUMERIC_PARAM(domain_type)
@@ -736,6 +950,18 @@ void set_param(const std::string& param_name,
   READ_STRING_PARAM(initial_data_prefix)
 # endif
 
+#ifndef initial_data_generator
+  READ_STRING_PARAM(initial_data_generator)
+#endif
+
+#ifndef initial_data_checkpoint
+  READ_BOOLEAN_PARAM(initial_data_checkpoint)
+#endif
+
+#ifndef initial_data_key_sorted
+  READ_BOOLEAN_PARAM(initial_data_key_sorted)
+#endif
+
 #ifndef modify_initial_data
   READ_BOOLEAN_PARAM(modify_initial_data)
 #endif
@@ -756,6 +982,46 @@ void set_param(const std::string& param_name,
   READ_NUMERIC_PARAM(out_diagnostic_every)
 # endif
 
+# ifndef out_grid_every
+  READ_NUMERIC_PARAM(out_grid_every)
+# endif
+
+# ifndef out_grid_nx
+  READ_NUMERIC_PARAM(out_grid_nx)
+# endif
+
+# ifndef out_grid_ny
+  READ_NUMERIC_PARAM(out_grid_ny)
+# endif
+
+# ifndef out_grid_nz
+  READ_NUMERIC_PARAM(out_grid_nz)
+# endif
+
+# ifndef out_grid_xmin
+  READ_NUMERIC_PARAM(out_grid_xmin)
+# endif
+
+# ifndef out_grid_xmax
+  READ_NUMERIC_PARAM(out_grid_xmax)
+# endif
+
+# ifndef out_grid_ymin
+  READ_NUMERIC_PARAM(out_grid_ymin)
+# endif
+
+# ifndef out_grid_ymax
+  READ_NUMERIC_PARAM(out_grid_ymax)
+# endif
+
+# ifndef out_grid_zmin
+  READ_NUMERIC_PARAM(out_grid_zmin)
+# endif
+
+# ifndef out_grid_zmax
+  READ_NUMERIC_PARAM(out_grid_zmax)
+# endif
+
 # ifndef out_h5data_every
   READ_NUMERIC_PARAM(out_h5data_every)
 # endif
@@ -764,11 +1030,47 @@ void set_param(const std::string& param_name,
   READ_BOOLEAN_PARAM(out_h5data_separate_iterations)
 # endif
 
+# ifndef out_h5data_async
+  READ_BOOLEAN_PARAM(out_h5data_async)
+# endif
+
+# ifndef out_h5data_async_buffers
+  READ_NUMERIC_PARAM(out_h5data_async_buffers)
+# endif
+
+# ifndef out_checkpoint_every
+  READ_NUMERIC_PARAM(out_checkpoint_every)
+# endif
+
+# ifndef out_h5data_fields
+  READ_STRING_PARAM(out_h5data_fields)
+# endif
+
+# ifndef out_h5data_single_precision
+  READ_BOOLEAN_PARAM(out_h5data_single_precision)
+# endif
+
+# ifndef out_h5data_compression
+  READ_NUMERIC_PARAM(out_h5data_compression)
+# endif
+
+# ifndef out_h5data_chunk_size
+  READ_NUMERIC_PARAM(out_h5data_chunk_size)
+# endif
+
   // viscosity and equation of state ----------------------------------------
 # ifndef eos_type
   READ_STRING_PARAM(eos_type)
 # endif
 
+# ifndef eos_batch
+  READ_BOOLEAN_PARAM(eos_batch)
+# endif
+
+# ifndef eos_sc_table
+  READ_STRING_PARAM(eos_sc_table)
+# endif
+
 # ifndef poly_gamma
   READ_NUMERIC_PARAM(poly_gamma)
 # endif
@@ -918,6 +1220,23 @@ void set_param(const std::string& param_name,
   READ_NUMERIC_PARAM(airfoil_attack_angle)
 # endif
 
+  // parameters built in the executable: the parameter file can only repeat
+  // the value they were built with
+# ifdef FLECSPH_SPECIALIZED_PARAMS
+  static const char * specialized[][2] = {FLECSPH_SPECIALIZED_PARAMS};
+  for (auto& p: specialized) {
+    if (not unknown_param or param_name != p[0])
+      continue;
+    if (str_value != p[1]) {
+      clog_one(error) << "ERROR: " << param_name << " is built in the "
+          << "executable as \"" << p[1] << "\" but is reset to \""
+          << str_value << "\" in parameter file" << endl;
+      exit(2);
+    }
+    unknown_param = false;
+  }
+# endif
+
   // unknown parameter -------------------------------
   if (unknown_param) {
     clog_one(error) << "ERROR: unknown parameter " << param_name << endl;
@@ -27,7 +27,9 @@
 #define _PHYSICS_ANALYSIS_H_
 
 #include <vector>
+#include <hdf5.h>
 #include "params.h"
+#include "reductions.h"
 
 // OpenMP point reduction
 #pragma omp declare reduction(add_point : point_t : omp_out += omp_in) \
@@ -222,6 +224,88 @@ namespace analysis{
   }
 
 
+  // Reduction group of the scalar output, offsets of its quantities
+  int scalar_group = -1;
+  int offset_mass, offset_energy, offset_kinetic_energy,
+      offset_internal_energy, offset_momentum, offset_ang_mom;
+
+  /**
+   * @brief      Register the quantities of the scalar output, same as
+   *             compute_total_mass, compute_total_energy, ...
+   */
+  void
+  add_scalar_reductions()
+  {
+    using namespace reductions;
+    scalar_group = add_group();
+    offset_mass = add(scalar_group,SUM,1,
+      [](const body* b, int64_t n, double* acc){
+        for(int64_t i = 0; i < n; ++i)
+          if(b[i].type() == NORMAL)
+            acc[0] += b[i].mass();
+      });
+    offset_energy = add(scalar_group,SUM,1,
+      [](const body* b, int64_t n, double* acc){
+        for(int64_t i = 0; i < n; ++i){
+          if(b[i].type() != NORMAL) continue;
+          const double m = b[i].mass();
+          if(param::thermokinetic_formulation) {
+            acc[0] += m*b[i].getTotalenergy();
+            continue;
+          }
+          const point_t v = b[i].getVelocity();
+          double v2 = v[0]*v[0];
+          for(unsigned short int k=1; k<gdimension; ++k)
+            v2 += v[k]*v[k];
+          acc[0] += m*b[i].getInternalenergy() + .5*m*v2;
+        }
+      });
+    offset_kinetic_energy = add(scalar_group,SUM,1,
+      [](const body* b, int64_t n, double* acc){
+        for(int64_t i = 0; i < n; ++i){
+          if(b[i].type() != NORMAL) continue;
+          const point_t v = b[i].getVelocity();
+          double v2 = v[0]*v[0];
+          for(unsigned short int k=1; k<gdimension; ++k)
+            v2 += v[k]*v[k];
+          acc[0] += .5*b[i].mass()*v2;
+        }
+      });
+    offset_internal_energy = add(scalar_group,SUM,1,
+      [](const body* b, int64_t n, double* acc){
+        for(int64_t i = 0; i < n; ++i)
+          if(b[i].type() == NORMAL)
+            acc[0] += b[i].mass()*b[i].getInternalenergy();
+      });
+    offset_momentum = add(scalar_group,SUM,gdimension,
+      [](const body* b, int64_t n, double* acc){
+        for(int64_t i = 0; i < n; ++i){
+          if(b[i].type() != NORMAL) continue;
+          const point_t v = b[i].getVelocity();
+          for(unsigned short int k=0; k<gdimension; ++k)
+            acc[k] += b[i].mass()*v[k];
+        }
+      });
+    offset_ang_mom = add(scalar_group,SUM,gdimension,
+      [](const body* b, int64_t n, double* acc){
+        if(gdimension == 1) return;
+        for(int64_t i = 0; i < n; ++i){
+          if(b[i].type() != NORMAL) continue;
+          const double m = b[i].mass();
+          const point_t v = b[i].getVelocity();
+          const point_t r = b[i].coordinates();
+          if constexpr (gdimension == 2) {
+            acc[0] += m*(r[0]*v[1] - r[1]*v[0]);
+          }
+          else if constexpr (gdimension == 3) {
+            acc[0] += m*(r[1]*v[2] - r[2]*v[1]);
+            acc[1] += m*(r[2]*v[0] - r[0]*v[2]);
+            acc[2] += m*(r[0]*v[1] - r[1]*v[0]);
+          }
+        }
+      });
+  }
+
   /**
    * @brief Periodic file output
    *
@@ -241,20 +325,24 @@ namespace analysis{
    * -- << end output file <<<< -------------------------------------------
    */
   void
-  scalar_output(body_system<double,gdimension>& bs, const int rank)
+  write_scalar_output(
+    const double* values,
+    const int rank,
+    const int64_t iteration,
+    const double totaltime,
+    const double dt)
   {
     static bool first_time = true;
-    if(param::out_scalar_every <= 0 ||
-       physics::iteration % param::out_scalar_every != 0)
-       return;
-
-    // compute reductions
-    bs.get_all(compute_total_momentum);
-    bs.get_all(compute_total_mass);
-    bs.get_all(compute_total_energy);
-    bs.get_all(compute_total_kinetic_energy);
-    bs.get_all(compute_total_internal_energy);
-    bs.get_all(compute_total_ang_mom);
+    total_mass = values[offset_mass];
+    total_energy = values[offset_energy];
+    total_kinetic_energy = values[offset_kinetic_energy];
+    total_internal_energy = values[offset_internal_energy];
+    linear_momentum = {0};
+    total_ang_mom = {0};
+    for(unsigned short int k = 0 ; k < gdimension ; ++k){
+      linear_momentum[k] = values[offset_momentum+k];
+      total_ang_mom[k] = values[offset_ang_mom+k];
+    }
 
     // output only from rank #0
     if (rank != 0) return;
@@ -297,9 +385,9 @@ namespace analysis{
     }
 
     std::ostringstream oss_data;
-    oss_data << std::setw(14) << physics::iteration
+    oss_data << std::setw(14) << iteration
       << std::setw(20) << std::scientific << std::setprecision(12)
-      << physics::totaltime << std::setw(20) << physics::dt <<" "
+      << totaltime << std::setw(20) << dt <<" "
       << total_mass <<" "<< total_energy <<" "
       << total_kinetic_energy<<" "<<total_internal_energy<<" ";
     for(unsigned short int k = 0 ; k < gdimension ; ++k)
@@ -319,8 +407,195 @@ namespace analysis{
     out << oss_data.str();
     out.close();
 
+  } // write_scalar_output
+
+  /**
+   * @brief      Request the scalar reductions of this iteration. The line of
+   *             the iteration is written when they complete, see
+   *             reductions::start.
+   */
+  void
+  scalar_output(body_system<double,gdimension>& bs, const int rank)
+  {
+    if(param::out_scalar_every <= 0 ||
+       physics::iteration % param::out_scalar_every != 0)
+       return;
+    if(scalar_group < 0)
+      add_scalar_reductions();
+    const int64_t iteration = physics::iteration;
+    const double totaltime = physics::totaltime, dt = physics::dt;
+    reductions::request(scalar_group,[=](const double* values){
+      write_scalar_output(values,rank,iteration,totaltime,dt);
+    });
   } // scalar output
 
+  /**
+   * @brief      Uniform grid of the in-situ deposition
+   */
+  struct grid_t {
+    std::array<int64_t,3> n = {{1,1,1}};
+    std::array<double,3> min = {{0.,0.,0.}};
+    std::array<double,3> delta = {{0.,0.,0.}};
+    // rho, v[gdimension], P, u and the normalization sum of m/rho W
+    std::vector<double> fields;
+    static const int nfields = gdimension + 4;
+
+    int64_t npoints() const { return n[0]*n[1]*n[2]; }
+    double coordinate(int d, int64_t i) const { return min[d]+i*delta[d]; }
+  };
+  grid_t grid;
+
+  /**
+   * @brief      Deposit the SPH interpolation of the local bodies on the
+   * grid points within their smoothing length
+   *
+   * @param      bodies  Vector of all the local bodies
+   */
+  void
+  deposit_grid(
+      std::vector<body>& bodies)
+  {
+    grid.fields.assign(grid.npoints()*grid_t::nfields,0.);
+    const int64_t nb = bodies.size();
+    #pragma omp parallel for schedule(dynamic,64)
+    for(int64_t b = 0; b < nb; ++b){
+      const body& bd = bodies[b];
+      const double h = bd.radius();
+      const point_t& pos = bd.coordinates();
+      const double rho = bd.getDensity();
+      if(rho <= 0.) continue;
+      const double mrho = bd.mass()/rho;
+      // Range of the grid points in the support of the kernel
+      int64_t lo[3] = {0,0,0}, hi[3] = {0,0,0};
+      bool outside = false;
+      for(size_t d = 0; d < 3; ++d){
+        if(grid.n[d] == 1) continue;
+        lo[d] = std::max<int64_t>(0,
+          std::ceil((pos[d]-h-grid.min[d])/grid.delta[d]));
+        hi[d] = std::min<int64_t>(grid.n[d]-1,
+          std::floor((pos[d]+h-grid.min[d])/grid.delta[d]));
+        outside = outside || lo[d] > hi[d];
+      }
+      if(outside) continue;
+      for(int64_t k = lo[2]; k <= hi[2]; ++k)
+      for(int64_t j = lo[1]; j <= hi[1]; ++j)
+      for(int64_t i = lo[0]; i <= hi[0]; ++i){
+        const int64_t idx[3] = {i,j,k};
+        double r2 = 0.;
+        for(size_t d = 0; d < gdimension; ++d){
+          double dx = pos[d] - grid.coordinate(d,idx[d]);
+          r2 += dx*dx;
+        }
+        const double W = kernels::sph_kernel_function(sqrt(r2),h);
+        if(W == 0.) continue;
+        double* f = &grid.fields[
+          ((k*grid.n[1]+j)*grid.n[0]+i)*grid_t::nfields];
+        #pragma omp atomic
+        f[0] += bd.mass()*W;
+        for(size_t d = 0; d < gdimension; ++d){
+          #pragma omp atomic
+          f[1+d] += mrho*bd.getVelocity()[d]*W;
+        }
+        #pragma omp atomic
+        f[gdimension+1] += mrho*bd.getPressure()*W;
+        #pragma omp atomic
+        f[gdimension+2] += mrho*bd.getInternalenergy()*W;
+        #pragma omp atomic
+        f[gdimension+3] += mrho*W;
+      }
+    }
+  }
+
+  /**
+   * @brief      In-situ deposition of density, velocity, pressure and
+   * internal energy on the uniform grid (or slice) given by the out_grid_*
+   * parameters. The partial grids of the processes are summed on rank 0,
+   * which writes them in <output_h5data_prefix>_grid_<iteration>.h5.
+   * Velocity, pressure and internal energy are normalized by the sum of
+   * m/rho W (Shepard), the density is the plain SPH sum.
+   */
+  void
+  grid_output(body_system<double,gdimension>& bs, const int rank)
+  {
+    using namespace param;
+    if(out_grid_every <= 0 || physics::iteration % out_grid_every != 0)
+       return;
+
+    // Set the grid, default bounds are the range of the particles.
+    // The dimensions above gdimension have a single point at 0.
+    const int32_t n[3] = {out_grid_nx,out_grid_ny,out_grid_nz};
+    const double gmin[3] = {out_grid_xmin,out_grid_ymin,out_grid_zmin};
+    const double gmax[3] = {out_grid_xmax,out_grid_ymax,out_grid_zmax};
+    auto& range = bs.getRange();
+    for(size_t d = 0; d < 3; ++d){
+      grid.n[d] = d < gdimension ? std::max(1,n[d]) : 1;
+      grid.min[d] = d < gdimension ? gmin[d] : 0.;
+      double max = gmax[d];
+      if(d < gdimension && gmin[d] == gmax[d] && grid.n[d] > 1){
+        grid.min[d] = range[0][d];
+        max = range[1][d];
+      }
+      grid.delta[d] = grid.n[d] > 1 ? (max-grid.min[d])/(grid.n[d]-1) : 0.;
+    }
+
+    bs.get_all(deposit_grid);
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : grid.fields.data(),
+      grid.fields.data(),grid.fields.size(),MPI_DOUBLE,MPI_SUM,0,
+      MPI_COMM_WORLD);
+    if(rank != 0) return;
+
+    // Split and normalize the fields
+    const int64_t np = grid.npoints();
+    const int nf = grid_t::nfields;
+    std::vector<std::vector<double>> out(nf-1,std::vector<double>(np));
+    for(int64_t p = 0; p < np; ++p){
+      const double* f = &grid.fields[p*nf];
+      const double norm = f[nf-1] > 0. ? 1./f[nf-1] : 0.;
+      out[0][p] = f[0];
+      for(int v = 1; v < nf-1; ++v)
+        out[v][p] = f[v]*norm;
+    }
+
+    // The background writer may be in HDF5 calls
+    io::wait_writes();
+    char filename[256];
+    sprintf(filename,"%s_grid_%08ld.h5",output_h5data_prefix,
+      (long)physics::iteration);
+    hid_t file_id = H5Fcreate(filename,H5F_ACC_TRUNC,H5P_DEFAULT,
+      H5P_DEFAULT);
+    // Datasets in C order: (nz,ny,nx)
+    hsize_t dims[3] = {(hsize_t)grid.n[2],(hsize_t)grid.n[1],
+      (hsize_t)grid.n[0]};
+    hid_t space_id = H5Screate_simple(3,dims,NULL);
+    const char* vnames[3] = {"vx","vy","vz"};
+    for(int v = 0; v < nf-1; ++v){
+      const char* name = v == 0 ? "rho" : v <= (int)gdimension ?
+        vnames[v-1] : v == (int)gdimension+1 ? "P" : "u";
+      hid_t dset_id = H5Dcreate(file_id,name,H5T_NATIVE_DOUBLE,space_id,
+        H5P_DEFAULT,H5P_DEFAULT,H5P_DEFAULT);
+      H5Dwrite(dset_id,H5T_NATIVE_DOUBLE,H5S_ALL,H5S_ALL,H5P_DEFAULT,
+        out[v].data());
+      H5Dclose(dset_id);
+    }
+    H5Sclose(space_id);
+
+    // Attributes: time, iteration, origin and spacing of the grid
+    auto attribute = [&](const char* name, hid_t type, hsize_t count,
+      const void* data){
+      hid_t aspace_id = H5Screate_simple(1,&count,NULL);
+      hid_t att_id = H5Acreate(file_id,name,type,aspace_id,H5P_DEFAULT,
+        H5P_DEFAULT);
+      H5Awrite(att_id,type,data);
+      H5Aclose(att_id);
+      H5Sclose(aspace_id);
+    };
+    attribute("time",H5T_NATIVE_DOUBLE,1,&physics::totaltime);
+    attribute("iteration",H5T_NATIVE_INT64,1,&physics::iteration);
+    attribute("origin",H5T_NATIVE_DOUBLE,3,grid.min.data());
+    attribute("spacing",H5T_NATIVE_DOUBLE,3,grid.delta.data());
+    H5Fclose(file_id);
+  } // grid_output
+
 
   bool
   check_conservation(
@@ -42,13 +42,14 @@ class body : public flecsi::topology::entity<type_t,uint64_t,gdimension> {
 
 public:
 
-   body(): entity(), type_(NORMAL)
+   body(): entity(), temperature_(0.), type_(NORMAL)
    {};
 
   double getPressure() const{return pressure_;}
   double getSoundspeed() const{return soundspeed_;}
   double getEntropy() const{return entropy_;}
   double getElectronfraction() const{return electronfraction_;}
+  double getTemperature() const{return temperature_;}
   double getDensity() const{return density_;}
   point_t getVelocity() const{return velocity_;}
   point_t getVelocityhalf() const{return velocityhalf_;}
@@ -74,6 +75,7 @@ public:
   void setPressure(double pressure){pressure_ = pressure;}
   void setEntropy(double entropy){entropy_ = entropy;}
   void setElectronfraction(double electronfraction){electronfraction_ = electronfraction;}
+  void setTemperature(double temperature){temperature_ = temperature;}
   void setDensity(double density){density_ = density;}
   void setDt(double dt){dt_ = dt;};
   void setMumax(double mumax){mumax_ = mumax;};
@@ -120,6 +122,7 @@ private:
   double pressure_;
   double entropy_;
   double electronfraction_;
+  double temperature_; // of the last tabulated EOS call, its next guess
   double soundspeed_;
   double internalenergy_;
   double totalenergy_;
@@ -127,6 +127,85 @@ namespace boundary{
     }
   }
 
+  /**
+   * @brief      Periodic box of the domain, centered on 0 and using
+   *             box_length, box_width and box_height
+   */
+  range_t
+  periodic_box()
+  {
+    const double length[3] = {box_length,box_width,box_height};
+    range_t box;
+    for(size_t d = 0; d < gdimension; ++d){
+      box[0][d] = -length[d]/2.;
+      box[1][d] =  length[d]/2.;
+    }
+    return box;
+  }
+
+  /**
+   * @brief      Periodic axis flags
+   */
+  std::array<bool,gdimension>
+  periodic_axis()
+  {
+    const bool periodic[3] = {param::periodic_boundary_x,
+      param::periodic_boundary_y,
+      param::periodic_boundary_z};
+    std::array<bool,gdimension> axis;
+    for(size_t d = 0; d < gdimension; ++d)
+      axis[d] = periodic[d];
+    return axis;
+  }
+
+  /**
+   * @brief      Return the periodic image of pos_b closest to pos_a.
+   *             Used by the physics to compute the minimum image
+   *             separation pos_a - pos_b across periodic boundaries.
+   */
+  point_t
+  periodic_image(
+      const point_t& pos_a,
+      const point_t& pos_b)
+  {
+    const bool periodic[3] = {param::periodic_boundary_x,
+      param::periodic_boundary_y,
+      param::periodic_boundary_z};
+    const double length[3] = {box_length,box_width,box_height};
+    point_t image = pos_b;
+    for(size_t d = 0; d < gdimension; ++d){
+      if(!periodic[d]) continue;
+      image[d] += length[d]*std::round((pos_a[d]-pos_b[d])/length[d]);
+    }
+    return image;
+  }
+
+  /**
+   * @brief      Teleport the particles which left the periodic box to
+   *             the other side of the domain. The ids are kept.
+   */
+  void
+  pboundary_wrap(
+      std::vector<body>& lbodies)
+  {
+    const std::array<bool,gdimension> periodic = periodic_axis();
+    const range_t box = periodic_box();
+
+    #pragma omp parallel for
+    for(int64_t i = 0 ; i < (int64_t)lbodies.size(); ++i)
+    {
+      point_t coord = lbodies[i].coordinates();
+      for(size_t d = 0 ; d < gdimension ; ++d)
+      {
+        if(!periodic[d]) continue;
+        const double length = box[1][d]-box[0][d];
+        if(coord[d] > box[1][d] || coord[d] < box[0][d])
+          coord[d] -= length*std::floor((coord[d]-box[0][d])/length);
+      }
+      lbodies[i].set_coordinates(coord);
+    }
+  }
+
   void pboundary_generate(
       std::vector<body>& lbodies,
       double halo_size)
@@ -76,7 +76,7 @@ namespace physics{
       const body * const nb = nbs[b];
       m_[b]  = nb->mass();
       h_[b]  = nb->radius();
-      point_t pos_b = nb->coordinates();
+      point_t pos_b = boundary::periodic_image(pos_a,nb->coordinates());
       r_a_[b] = flecsi::distance(pos_a, pos_b);
     }
 
@@ -90,6 +90,89 @@ namespace physics{
   } // compute_density
 
 
+  /**
+   * @brief      Variable smoothing length: solve the h(rho) relation
+   *             with Newton-Raphson iterations to get the target number
+   *             of neighbors sph_neighbors_target:
+   *
+   *             f(h) = rho_a(h) - N m_a / (V_D h^D) = 0
+   *
+   *             The density is computed as in compute_density. The
+   *             candidates nbs are the neighbors in the enlarged radius
+   *             sph_h_search_factor*(h_a+h_b)/2, no new tree search is
+   *             needed as long as h stays in [h/factor, h*factor].
+   *
+   * @param      particle  The particle body
+   * @param      nbs       The candidate neighbors
+   * @param      h_a       The solution for the smoothing length
+   *
+   * @return     False if the solution is outside of the candidates
+   *             radius, the particle has to be searched again with h_a
+   */
+  bool
+  compute_density_h(
+      body& particle,
+      std::vector<body*>& nbs,
+      double& h_a)
+  {
+    using namespace kernels;
+    const double unit_volume[3] = {2.,M_PI,4./3.*M_PI};
+    const double n_target = sph_neighbors_target > 0. ?
+      sph_neighbors_target :
+      unit_volume[gdimension-1]*pow(sph_eta*kernel_width,gdimension);
+    const double mass_target = n_target*particle.mass()
+      /unit_volume[gdimension-1];
+
+    const double h_0 = particle.radius();
+    const double h_min = h_0/sph_h_search_factor;
+    const double h_max = h_0*sph_h_search_factor;
+    const point_t pos_a = particle.coordinates();
+    const int n_nb = nbs.size();
+    mpi_assert(n_nb>0);
+
+    double r_a_[n_nb], m_[n_nb], h_[n_nb];
+    point_t pos_ab_[n_nb];
+    for(int b = 0 ; b < n_nb; ++b){
+      const body * const nb = nbs[b];
+      m_[b]  = nb->mass();
+      h_[b]  = nb->radius();
+      const point_t pos_b = boundary::periodic_image(pos_a,nb->coordinates());
+      pos_ab_[b] = pos_a - pos_b;
+      r_a_[b] = flecsi::distance(pos_a, pos_b);
+    }
+
+    double h = h_0;
+    double rho_a = 0.;
+    bool converged = false;
+    for(int it = 0; it < sph_h_max_iterations && !converged; ++it){
+      // Density and its derivative regarding h
+      // dW/dh = -(D W + r.grad(W))/h
+      rho_a = 0.;
+      double drhodh = 0.;
+      for(int b = 0 ; b < n_nb; ++b){
+        const double h_ab = .5*(h+h_[b]);
+        const double Wab = sph_kernel_function(r_a_[b],h_ab);
+        const double rdWdr = dot(point_to_vector(pos_ab_[b]),
+            point_to_vector(sph_kernel_gradient(pos_ab_[b],h_ab)));
+        rho_a  += m_[b]*Wab;
+        drhodh -= .5*m_[b]*(gdimension*Wab + rdWdr)/h_ab;
+      }
+      const double rho_h = mass_target/pow(h,gdimension);
+      const double f = rho_a - rho_h;
+      const double df = drhodh + gdimension*rho_h/h;
+      double h_new = df != 0. ? h - f/df : h;
+      // Keep the iterations inside the candidates radius
+      h_new = std::max(h_min,std::min(h_max,h_new));
+      converged = fabs(h_new-h) < sph_h_tolerance*h;
+      h = h_new;
+    }
+    h_a = h;
+    mpi_assert(rho_a>0);
+    particle.setDensity(rho_a);
+    return converged && h < h_max && h > h_min;
+  } // compute_density_h
+
+
   /**
    * @brief      Calculates total energy for every particle
    * @param      srch  The source's body holder
@@ -136,6 +219,41 @@ namespace physics{
   } // recover_internal_energy
 
 
+  /**
+   * @brief      Compute the EOS and soundspeed after the density
+   *
+   * @param      particle  The particle body
+   */
+  void
+  compute_pressure_soundspeed(
+    body& particle)
+  {
+    if (thermokinetic_formulation)
+      recover_internal_energy(particle);
+    eos::compute_pressure(particle);
+    eos::compute_soundspeed(particle);
+  }
+
+
+  /**
+   * @brief      Compute the EOS and soundspeed of all the local particles
+   *             after the density, with the batch sweep eos::apply
+   *
+   * @param      bodies  The local particles
+   */
+  void
+  compute_pressure_soundspeed_batch(
+    std::vector<body>& bodies)
+  {
+    if (thermokinetic_formulation) {
+      #pragma omp parallel for
+      for (size_t i = 0; i < bodies.size(); ++i)
+        recover_internal_energy(bodies[i]);
+    }
+    eos::apply(bodies);
+  }
+
+
   /**
    * @brief      Compute the density, EOS and spundspeed in the same function
    * reduce time to gather the neighbors
@@ -196,7 +314,7 @@ namespace physics{
       const body * const nb = nbs[b];
       rho_[b] = nb->getDensity();
       P_[b]   = nb->getPressure();
-      pos_[b] = nb->coordinates();
+      pos_[b] = boundary::periodic_image(pos_a,nb->coordinates());
       v12_[b] = nb->getVelocityhalf();
       c_[b]   = nb->getSoundspeed();
       h_[b]   = nb->radius();
@@ -283,7 +401,7 @@ namespace physics{
       const body * const nb = nbs[b];
       rho_[b] = nb->getDensity();
       P_[b]   = nb->getPressure();
-      pos_[b] = nb->coordinates();
+      pos_[b] = boundary::periodic_image(pos_a,nb->coordinates());
       vel_[b] = nb->getVelocity();
       v12_[b] = nb->getVelocityhalf();
       c_[b]   = nb->getSoundspeed();
@@ -355,7 +473,7 @@ namespace physics{
       const body * const nb = nbs[b];
       rho_[b] = nb->getDensity();
       P_[b]   = nb->getPressure();
-      pos_[b] = nb->coordinates();
+      pos_[b] = boundary::periodic_image(pos_a,nb->coordinates());
       vel_[b] = nb->getVelocity();
       v12_[b] = nb->getVelocityhalf();
       c_[b]   = nb->getSoundspeed();
@@ -389,6 +507,159 @@ namespace physics{
 
 
 
+  /**
+   * @brief      Symmetric density, pair contribution:
+   *             m_b W_ab to rho_a and m_a W_ab to rho_b
+   *
+   * @param      a, b          The pair of particles
+   * @param      rho_a, rho_b  Density accumulators of a and b
+   */
+  void
+  pair_density(
+      const body& a,
+      const body& b,
+      double& rho_a,
+      double& rho_b)
+  {
+    using namespace kernels;
+    const point_t pos_a = a.coordinates(),
+                  pos_b = boundary::periodic_image(pos_a,b.coordinates());
+    const double r_ab = flecsi::distance(pos_a,pos_b);
+    const double Wab = sph_kernel_function(r_ab,.5*(a.radius()+b.radius()));
+    rho_a += b.mass()*Wab;
+    rho_b += a.mass()*Wab;
+  } // pair_density
+
+  /**
+   * @brief      Symmetric density, add the self contribution and set the
+   *             density of the particle
+   */
+  void
+  finalize_density(
+      body& particle,
+      double& rho_a)
+  {
+    rho_a += particle.mass()*
+      kernels::sph_kernel_function(0.,particle.radius());
+    mpi_assert(rho_a>0);
+    particle.setDensity(rho_a);
+  } // finalize_density
+
+  /**
+   * @brief      Symmetric version of compute_density_pressure_soundspeed
+   */
+  void
+  finalize_density_pressure_soundspeed(
+      body& particle,
+      double& rho_a)
+  {
+    finalize_density(particle,rho_a);
+    if (thermokinetic_formulation)
+      recover_internal_energy(particle);
+    eos::compute_pressure(particle);
+    eos::compute_soundspeed(particle);
+  }
+
+  /**
+   * @brief      Symmetric hydro acceleration, pair contribution.
+   *             The term of compute_acceleration is antisymmetric in a,b:
+   *             the kernel gradient and Pi_ab are computed once per pair.
+   *
+   * @param      a, b          The pair of particles
+   * @param      acc_a, acc_b  Acceleration accumulators of a and b
+   */
+  void
+  pair_acceleration(
+      const body& a,
+      const body& b,
+      point_t& acc_a,
+      point_t& acc_b)
+  {
+    using namespace viscosity;
+    using namespace kernels;
+    const double rho_a = a.getDensity(), rho_b = b.getDensity();
+    const point_t pos_a = a.coordinates(),
+                  pos_b = boundary::periodic_image(pos_a,b.coordinates());
+    const space_vector_t v12_ab = point_to_vector(
+        a.getVelocityhalf() - b.getVelocityhalf());
+    const space_vector_t pos_ab = point_to_vector(pos_a - pos_b);
+    const double h_ab = .5*(a.radius() + b.radius());
+    const double mu_ab = mu(h_ab, v12_ab, pos_ab);
+    const double Pi_ab = artificial_viscosity(.5*(rho_a+rho_b),
+        .5*(a.getSoundspeed()+b.getSoundspeed()),mu_ab);
+    const point_t DiWab = sph_kernel_gradient(pos_a - pos_b,h_ab);
+    const double f_ab = (pos_a!=pos_b)*(a.getPressure()/(rho_a*rho_a)
+        + b.getPressure()/(rho_b*rho_b) + Pi_ab);
+    acc_a += -b.mass()*f_ab*DiWab;
+    acc_b +=  a.mass()*f_ab*DiWab;
+  } // pair_acceleration
+
+  /**
+   * @brief      Symmetric hydro acceleration, add the external forces and
+   *             set the acceleration of the particle
+   */
+  void
+  finalize_acceleration(
+      body& particle,
+      point_t& acc_a)
+  {
+    particle.setMumax(0.0);  // needed for adaptive timestep calculation
+    acc_a += external_force::acceleration(particle);
+    particle.setAcceleration(acc_a);
+  } // finalize_acceleration
+
+  /**
+   * @brief      Symmetric dudt, pair contribution.
+   *             v_ab . D_i Wab and Pi_ab are the same seen from a and b.
+   *
+   * @param      a, b            The pair of particles
+   * @param      dudt_a, dudt_b  dudt accumulators of a and b
+   */
+  void
+  pair_dudt(
+      const body& a,
+      const body& b,
+      double& dudt_a,
+      double& dudt_b)
+  {
+    using namespace viscosity;
+    using namespace kernels;
+    const double rho_a = a.getDensity(), rho_b = b.getDensity();
+    const point_t pos_a = a.coordinates(),
+                  pos_b = boundary::periodic_image(pos_a,b.coordinates());
+    const point_t pos_ab = pos_a - pos_b;
+    const space_vector_t v12_ab = point_to_vector(
+        a.getVelocityhalf() - b.getVelocityhalf());
+    const space_vector_t vel_ab = point_to_vector(
+        a.getVelocity() - b.getVelocity());
+    const double h_ab = .5*(a.radius() + b.radius());
+    const double mu_ab = mu(h_ab, v12_ab, point_to_vector(pos_ab));
+    const double Pi_ab = artificial_viscosity(.5*(rho_a+rho_b),
+        .5*(a.getSoundspeed()+b.getSoundspeed()),mu_ab);
+    const space_vector_t DiWab = point_to_vector(
+        sph_kernel_gradient(pos_ab,h_ab));
+    const double vab_dot_DiWab = (pos_a!=pos_b)*dot(vel_ab, DiWab);
+    dudt_a += b.mass()*vab_dot_DiWab*
+      (a.getPressure()/(rho_a*rho_a) + .5*Pi_ab);
+    dudt_b += a.mass()*vab_dot_DiWab*
+      (b.getPressure()/(rho_b*rho_b) + .5*Pi_ab);
+  } // pair_dudt
+
+  /**
+   * @brief      Symmetric dudt, set the dudt of the particle
+   */
+  void
+  finalize_dudt(
+      body& particle,
+      double& dudt_a)
+  {
+    // Do not change internal energy in relaxation phase
+    if(iteration < relaxation_steps)
+      dudt_a = 0.0;
+    particle.setDudt(dudt_a);
+  } // finalize_dudt
+
+
   /**
    * @brief      Adds energy dissipation rate due to artificial
    *             particle relaxation drag force
@@ -30,6 +30,7 @@
 #include "params.h"
 #include "utils.h"
 #include "tree.h"
+#include "eos_stellar_collapse.h"
 #include <boost/algorithm/string.hpp>
 
 namespace eos {
@@ -91,29 +92,45 @@ namespace eos {
     source.setPressure(pressure);
   } // compute_pressure_wd
 
-// HL : Compute pressure from tabulated EOS. Linking to static lib somewhat
-//      need to be fixing
-
-// EOS prep stage for fill eos info from table
-
-#if 0
-  void
-  EOS_prep(body& source)
-  {
-    EOS_SC_fill(source.getDensity(), source.getInternalenergy(),
-                source.getElectronfraction(),
-                1.0//This field should be field for eos cache);
-  //May need different source field?
+  /**
+   * @brief      Tabulated EOS initializer: the first call of
+   *             compute_pressure_sc finds the temperature without guess
+   */
+  void init_sc(body& source) {
+    source.setTemperature(0.);
   }
-#endif
+
+  /**
+   * @brief      Compute the pressure, sound speed and temperature from the
+   *             tabulated EOS, eos::sc(). The temperature of the particle is
+   *             the guess of the root find.
+   * @param      srch  The source's body holder
+   */
   void
   compute_pressure_sc(body& source)
   {
-    using namespace param;
-    //double pressure = EOS_pressure_rho0_u(source->eoscache());
-    //source->setPressure(pressure)
+    const double rho = source.getDensity();
+    const double u = source.getInternalenergy();
+    const double ye = source.getElectronfraction();
+    double T = source.getTemperature(), P, cs;
+    sc().apply(1,&rho,&u,&ye,&T,&P,&cs);
+    source.setTemperature(T);
+    source.setPressure(P);
+    source.setSoundspeed(cs);
   } // compute_pressure_sc
 
+  /**
+   * @brief      Sound speed of the tabulated EOS at the temperature of the
+   *             last compute_pressure_sc
+   * @param      srch  The source's body holder
+   */
+  void compute_soundspeed_sc(body& source) {
+    const double lT = source.getTemperature() > 0. ?
+        log10(source.getTemperature()) : sc().lT_min;
+    source.setSoundspeed(sqrt(sc().interp(sc().cs2,
+        log10(source.getDensity()),lT,source.getElectronfraction())));
+  }
+
   /**
    * @brief      Compute sound speed for ideal fluid or polytropic eos
    * From CES-Seminar 13/14 - Smoothed Particle Hydrodynamics
@@ -149,41 +166,239 @@ namespace eos {
 
   // eos function types and pointers
   typedef void (*compute_quantity_t)(body&);
+  typedef void (*eos_init_t)(body&);
+
+  // eos of the batch sweep eos::apply
+  enum eos_kind_t {
+    kind_ideal,
+    kind_polytropic,
+    kind_white_dwarf,
+    kind_stellar_collapse
+  };
+
+#ifdef eos_type
+  /**
+   * @brief  Case-insensitive comparison with the eos_type built in the
+   *         executable
+   */
+  constexpr bool
+  is_eos_type(const char * name) {
+    const char * t = eos_type;
+    for (; *t and *name; ++t, ++name) {
+      char a = (*t >= 'A' and *t <= 'Z') ? *t - 'A' + 'a' : *t;
+      char b = (*name >= 'A' and *name <= 'Z') ? *name - 'A' + 'a' : *name;
+      if (a != b)
+        return false;
+    }
+    return *t == *name;
+  }
+
+  // eos_type is built in the executable: constant pointers, the calls are
+  // resolved at compile time
+  constexpr eos_init_t init =
+      is_eos_type("polytropic")       ? init_polytropic :
+      is_eos_type("stellar collapse") ? init_sc :
+                                        init_ideal;
+  constexpr compute_quantity_t compute_pressure =
+      is_eos_type("polytropic")       ? compute_pressure_adiabatic :
+      is_eos_type("white dwarf")      ? compute_pressure_wd :
+      is_eos_type("stellar collapse") ? compute_pressure_sc :
+                                        compute_pressure_ideal;
+  constexpr compute_quantity_t compute_soundspeed =
+      is_eos_type("white dwarf")      ? compute_soundspeed_wd :
+      is_eos_type("stellar collapse") ? compute_soundspeed_sc :
+                                        compute_soundspeed_ideal;
+  constexpr eos_kind_t kind =
+      is_eos_type("polytropic")       ? kind_polytropic :
+      is_eos_type("white dwarf")      ? kind_white_dwarf :
+      is_eos_type("stellar collapse") ? kind_stellar_collapse :
+                                        kind_ideal;
+  static_assert(is_eos_type("ideal fluid") or is_eos_type("polytropic")
+      or is_eos_type("white dwarf") or is_eos_type("stellar collapse"),
+      "Bad eos_type parameter");
+
+void select(const std::string& type) {
+  if(not boost::iequals(type, eos_type))
+    std::cerr << "eos_type is built in the executable as " << eos_type
+              << std::endl;
+  if(kind == kind_stellar_collapse and not sc().loaded())
+    sc().load(eos_sc_table);
+}
+
+#else
   compute_quantity_t compute_pressure = compute_pressure_ideal;
   compute_quantity_t compute_soundspeed = compute_soundspeed_ideal;
-
-  typedef void (*eos_init_t)(body&);
   eos_init_t init = init_ideal;
+  eos_kind_t kind = kind_ideal;
 
 /**
  * @brief  Installs the 'compute_pressure' and 'compute_soundspeed'
- *         function pointers, depending on the value of eos_type
+ *         function pointers, depending on the value of eos_type.
+ *         Collective for the tabulated EOS, which loads its table.
  */
 void select(const std::string& eos_type) {
   if(boost::iequals(eos_type, "ideal fluid")) {
+    kind = kind_ideal;
     init = init_ideal;
     compute_pressure = compute_pressure_ideal;
     compute_soundspeed = compute_soundspeed_ideal;
   }
   else if(boost::iequals(eos_type, "polytropic")) {
+    kind = kind_polytropic;
     init = init_polytropic;
     compute_pressure = compute_pressure_adiabatic;
     compute_soundspeed = compute_soundspeed_ideal;
   }
   else if(boost::iequals(eos_type, "white dwarf")) {
+    kind = kind_white_dwarf;
     init = init_ideal;  // TODO
     compute_pressure = compute_pressure_wd;
     compute_soundspeed = compute_soundspeed_wd;
   }
   else if(boost::iequals(eos_type, "stellar collapse")) {
-    init = init_ideal;  // TODO
+    kind = kind_stellar_collapse;
+    init = init_sc;
     compute_pressure = compute_pressure_sc;
-    compute_soundspeed = compute_soundspeed_ideal;
+    compute_soundspeed = compute_soundspeed_sc;
+    if(not sc().loaded())
+      sc().load(eos_sc_table);
   }
   else {
     std::cerr << "Bad eos_type parameter" << std::endl;
   }
 }
+#endif
+
+  // Particles per block of the batch sweep: the fields of a block are
+  // gathered in contiguous arrays for the vectorized EOS
+  const int64_t batch_size = 256;
+
+  /**
+   * @brief      Vectorized ideal gas: pressure and sound speed from the
+   *             density and internal energy
+   */
+  inline void
+  batch_ideal(
+    int64_t n,
+    const double * rho,
+    const double * u,
+    double * P,
+    double * cs)
+  {
+    const double g1 = poly_gamma - 1.0;
+    #pragma omp simd
+    for(int64_t i = 0; i < n; ++i) {
+      P[i] = g1*rho[i]*u[i];
+      cs[i] = sqrt(poly_gamma*P[i]/rho[i]);
+    }
+  }
+
+  /**
+   * @brief      Vectorized polytrope: pressure and sound speed from the
+   *             density and adiabatic constant
+   */
+  inline void
+  batch_polytropic(
+    int64_t n,
+    const double * rho,
+    const double * K,
+    double * P,
+    double * cs)
+  {
+    #pragma omp simd
+    for(int64_t i = 0; i < n; ++i) {
+      P[i] = K[i]*pow(rho[i],poly_gamma);
+      cs[i] = sqrt(poly_gamma*P[i]/rho[i]);
+    }
+  }
+
+  /**
+   * @brief      Vectorized cold white dwarf, same formulas as
+   *             compute_pressure_wd and compute_soundspeed_wd with the cube
+   *             root and asinh written with exp, log and sqrt, which have
+   *             SIMD versions
+   */
+  inline void
+  batch_white_dwarf(
+    int64_t n,
+    const double * rho,
+    double * P,
+    double * cs)
+  {
+    const double A_wd = 6.00288e22;
+    const double B_wd = 9.81011e5;
+    #pragma omp simd
+    for(int64_t i = 0; i < n; ++i) {
+      const double x = exp(log(rho[i]/B_wd)*(1.0/3.0));
+      const double x2 = x*x;
+      const double sq = sqrt(x2 + 1.0);
+      P[i] = A_wd*(x*(2.0*x2 - 3.0)*sq + 3.0*log(x + sq));
+      const double numer = 8.*rho[i]*x - 3.*B_wd;
+      const double deno = 3*B_wd*B_wd*x2*sq;
+      cs[i] = A_wd*(numer/deno + x/(3.*rho[i]*sqrt(1 - x2)));
+    }
+  }
+
+  /**
+   * @brief      Pressure and sound speed of the particles in one sweep after
+   *             the density. The blocks of particles are distributed on the
+   *             threads.
+   *
+   * @param      bodies  The particles
+   * @param[in]  n       Number of particles
+   */
+  void
+  apply(
+    body * bodies,
+    int64_t n)
+  {
+    const int64_t nblocks = (n + batch_size - 1)/batch_size;
+    #pragma omp parallel for
+    for(int64_t b = 0; b < nblocks; ++b) {
+      alignas(64) double rho[batch_size], x[batch_size];
+      alignas(64) double P[batch_size], cs[batch_size];
+      alignas(64) double ye[batch_size], T[batch_size];
+      body * block = bodies + b*batch_size;
+      const int64_t m = std::min(batch_size, n - b*batch_size);
+
+      for(int64_t i = 0; i < m; ++i) {
+        rho[i] = block[i].getDensity();
+        x[i] = kind == kind_polytropic ? block[i].getAdiabatic()
+                                       : block[i].getInternalenergy();
+      }
+      if(kind == kind_stellar_collapse)
+        for(int64_t i = 0; i < m; ++i) {
+          ye[i] = block[i].getElectronfraction();
+          T[i] = block[i].getTemperature();
+        }
+      switch(kind) {
+        case kind_polytropic:
+          batch_polytropic(m,rho,x,P,cs);
+          break;
+        case kind_white_dwarf:
+          batch_white_dwarf(m,rho,P,cs);
+          break;
+        case kind_stellar_collapse:
+          sc().apply(m,rho,x,ye,T,P,cs);
+          for(int64_t i = 0; i < m; ++i)
+            block[i].setTemperature(T[i]);
+          break;
+        default:
+          batch_ideal(m,rho,x,P,cs);
+      }
+      for(int64_t i = 0; i < m; ++i) {
+        block[i].setPressure(P[i]);
+        block[i].setSoundspeed(cs[i]);
+      }
+    }
+  }
+
+  void
+  apply(
+    std::vector<body>& bodies)
+  {
+    apply(bodies.data(),bodies.size());
+  }
 
 } // namespace eos
 
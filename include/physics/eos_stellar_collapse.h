@@ -0,0 +1,446 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2018 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+ /*~--------------------------------------------------------------------------~*
+ *
+ * /@@@@@@@@  @@           @@@@@@   @@@@@@@@ @@@@@@@  @@      @@
+ * /@@/////  /@@          @@////@@ @@////// /@@////@@/@@     /@@
+ * /@@       /@@  @@@@@  @@    // /@@       /@@   /@@/@@     /@@
+ * /@@@@@@@  /@@ @@///@@/@@       /@@@@@@@@@/@@@@@@@ /@@@@@@@@@@
+ * /@@////   /@@/@@@@@@@/@@       ////////@@/@@////  /@@//////@@
+ * /@@       /@@/@@//// //@@    @@       /@@/@@      /@@     /@@
+ * /@@       @@@//@@@@@@ //@@@@@@  @@@@@@@@ /@@      /@@     /@@
+ * //       ///  //////   //////  ////////  //       //      //
+ *
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file eos_stellar_collapse.h
+ * @brief Tabulated nuclear EOS in the stellarcollapse.org format
+ *        (third-party-libraries/stellar_collapse), with the table shared by
+ *        the ranks of a node.
+ *
+ * The table is uniform in (log10 rho, log10 T, Ye) and stored with the
+ * density index fastest, as EOS_ELEM of the third-party reader. The
+ * particle fields are in CGS, the temperature in MeV.
+ */
+
+#ifndef _eos_stellar_collapse_h_
+#define _eos_stellar_collapse_h_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <hdf5.h>
+#include <mpi.h>
+
+#include "params.h"
+#include "cinchlog.h"
+
+namespace eos {
+
+  /**
+   * @brief      Pressure, internal energy and sound speed tables. The node
+   *             root reads the file in an MPI shared window, the other ranks
+   *             of the node map it: one copy per node, read-only after load,
+   *             so the threads and ranks use it without locks.
+   */
+  class sc_table {
+  public:
+
+    int Nrho = 0, NT = 0, NYe = 0;
+    double lrho_min = 0., dlrho = 1.;
+    double lT_min = 0., dlT = 1.;
+    double Ye_min = 0., dYe = 1.;
+    double energy_shift = 0.;
+
+    const double * lrho = nullptr;  // log10 density [g/cm^3]
+    const double * lT = nullptr;    // log10 temperature [MeV]
+    const double * Ye = nullptr;    // electron fraction
+    const double * lP = nullptr;    // log10 pressure [erg/cm^3]
+    const double * le = nullptr;    // log10(e + energy_shift) [erg/g]
+    const double * cs2 = nullptr;   // sound speed squared [cm^2/s^2]
+
+    bool loaded() const { return Nrho > 0; }
+
+    int64_t
+    elem(int irho, int iT, int iY) const
+    {
+      return Nrho*(int64_t(iY)*NT + iT) + irho;
+    }
+
+    /**
+     * @brief      Allocate the shared window of the node. Collective.
+     *
+     * @return     The writable table on the node root: energy shift, axes,
+     *             then the lP, le and cs2 tables. nullptr on the other ranks.
+     */
+    double *
+    allocate(
+      int nrho,
+      int nT,
+      int nYe)
+    {
+      if(node_comm_ == MPI_COMM_NULL)
+        MPI_Comm_split_type(MPI_COMM_WORLD,MPI_COMM_TYPE_SHARED,0,
+          MPI_INFO_NULL,&node_comm_);
+      if(win_ != MPI_WIN_NULL)
+        MPI_Win_free(&win_);
+      int node_rank;
+      MPI_Comm_rank(node_comm_,&node_rank);
+
+      Nrho = nrho;
+      NT = nT;
+      NYe = nYe;
+      const int64_t size = nelem();
+      MPI_Aint bytes = node_rank == 0 ? size*sizeof(double) : 0;
+      double * base;
+      MPI_Win_allocate_shared(bytes,sizeof(double),MPI_INFO_NULL,node_comm_,
+        &base,&win_);
+      if(node_rank != 0) {
+        int disp;
+        MPI_Win_shared_query(win_,0,&bytes,&disp,&base);
+      }
+      const int64_t n3 = int64_t(Nrho)*NT*NYe;
+      lrho = base + 1;
+      lT = lrho + Nrho;
+      Ye = lT + NT;
+      lP = Ye + NYe;
+      le = lP + n3;
+      cs2 = le + n3;
+      base_ = base;
+      MPI_Win_fence(0,win_);
+      return node_rank == 0 ? base : nullptr;
+    }
+
+    /**
+     * @brief      Publish the table written by the node root to the ranks of
+     *             the node. Collective.
+     */
+    void
+    commit()
+    {
+      MPI_Win_fence(0,win_);
+      energy_shift = base_[0];
+      lrho_min = lrho[0];
+      dlrho = (lrho[Nrho-1] - lrho_min)/(Nrho-1);
+      lT_min = lT[0];
+      dlT = (lT[NT-1] - lT_min)/(NT-1);
+      Ye_min = Ye[0];
+      dYe = (Ye[NYe-1] - Ye_min)/(NYe-1);
+    }
+
+    /**
+     * @brief      Release the shared window and the node communicator,
+     *             the table is unloaded. Collective, to be called before
+     *             MPI_Finalize.
+     */
+    void
+    free()
+    {
+      if(win_ != MPI_WIN_NULL)
+        MPI_Win_free(&win_);
+      if(node_comm_ != MPI_COMM_NULL)
+        MPI_Comm_free(&node_comm_);
+      Nrho = NT = NYe = 0;
+      lrho = lT = Ye = lP = le = cs2 = base_ = nullptr;
+    }
+
+    /**
+     * @brief      Read the HDF5 table on the node roots. Collective.
+     *
+     * @param[in]  filename  The table of stellarcollapse.org
+     */
+    void
+    load(
+      const char * filename)
+    {
+      if(node_comm_ == MPI_COMM_NULL)
+        MPI_Comm_split_type(MPI_COMM_WORLD,MPI_COMM_TYPE_SHARED,0,
+          MPI_INFO_NULL,&node_comm_);
+      int node_rank;
+      MPI_Comm_rank(node_comm_,&node_rank);
+
+      hid_t file_id = -1;
+      int dims[3] = {0,0,0};
+      if(node_rank == 0) {
+        file_id = H5Fopen(filename,H5F_ACC_RDONLY,H5P_DEFAULT);
+        if(file_id >= 0 and
+           (read(file_id,"pointsrho",H5T_NATIVE_INT,&dims[0]) < 0 or
+            read(file_id,"pointstemp",H5T_NATIVE_INT,&dims[1]) < 0 or
+            read(file_id,"pointsye",H5T_NATIVE_INT,&dims[2]) < 0))
+          dims[0] = 0;
+        if(file_id >= 0 and dims[0] == 0)
+          H5Fclose(file_id);
+      }
+      MPI_Bcast(dims,3,MPI_INT,0,node_comm_);
+      if(dims[0] < 2 or dims[1] < 2 or dims[2] < 2)
+        clog_fatal("Cannot read the EOS table " << filename << std::endl);
+
+      double * base = allocate(dims[0],dims[1],dims[2]);
+      int status = 0;
+      if(node_rank == 0) {
+        const int64_t n3 = int64_t(Nrho)*NT*NYe;
+        double * t_lrho = base + 1;
+        double * t_lT = t_lrho + Nrho;
+        double * t_Ye = t_lT + NT;
+        double * t_lP = t_Ye + NYe;
+        double * t_le = t_lP + n3;
+        double * t_cs2 = t_le + n3;
+        std::vector<double> dpdrhoe(n3), dpderho(n3);
+        status = std::min({
+          read(file_id,"energy_shift",H5T_NATIVE_DOUBLE,base),
+          read(file_id,"logrho",H5T_NATIVE_DOUBLE,t_lrho),
+          read(file_id,"logtemp",H5T_NATIVE_DOUBLE,t_lT),
+          read(file_id,"ye",H5T_NATIVE_DOUBLE,t_Ye),
+          read(file_id,"logpress",H5T_NATIVE_DOUBLE,t_lP),
+          read(file_id,"logenergy",H5T_NATIVE_DOUBLE,t_le),
+          read(file_id,"dpdrhoe",H5T_NATIVE_DOUBLE,dpdrhoe.data()),
+          read(file_id,"dpderho",H5T_NATIVE_DOUBLE,dpderho.data())});
+        H5Fclose(file_id);
+
+        // Newtonian adiabatic sound speed:
+        // dP/drho|s = dP/drho|e + P/rho^2 dP/de|rho
+        for(int iY = 0; iY < NYe; ++iY)
+          for(int iT = 0; iT < NT; ++iT)
+            for(int irho = 0; irho < Nrho; ++irho) {
+              const int64_t e = elem(irho,iT,iY);
+              const double rho = pow(10.,t_lrho[irho]);
+              const double P = pow(10.,t_lP[e]);
+              t_cs2[e] = fabs(dpdrhoe[e] + P/(rho*rho)*dpderho[e]);
+            }
+      }
+      MPI_Bcast(&status,1,MPI_INT,0,node_comm_);
+      if(status < 0)
+        clog_fatal("Cannot read the EOS table " << filename << std::endl);
+      commit();
+    }
+
+    /**
+     * @brief      Cell and position in the cell of x on a uniform axis,
+     *             clamped to the table
+     */
+    static inline void
+    locate(
+      double x,
+      double x0,
+      double dx,
+      int n,
+      int& i,
+      double& d)
+    {
+      double s = std::min(std::max((x - x0)/dx,0.),double(n-1));
+      i = std::min(int(s),n-2);
+      d = s - i;
+    }
+
+    /**
+     * @brief      Trilinear interpolation of tab in (log10 rho, log10 T, Ye)
+     */
+    inline double
+    interp(
+      const double * tab,
+      double lr,
+      double lt,
+      double ye) const
+    {
+      int ir, it, iy;
+      double dr, dt, dy;
+      locate(lr,lrho_min,dlrho,Nrho,ir,dr);
+      locate(lt,lT_min,dlT,NT,it,dt);
+      locate(ye,Ye_min,dYe,NYe,iy,dy);
+      const int64_t e = elem(ir,it,iy);
+      const int64_t sT = Nrho, sY = int64_t(Nrho)*NT;
+      const double c0 = (1-dr)*tab[e]         + dr*tab[e+1];
+      const double c1 = (1-dr)*tab[e+sT]      + dr*tab[e+sT+1];
+      const double c2 = (1-dr)*tab[e+sY]      + dr*tab[e+sY+1];
+      const double c3 = (1-dr)*tab[e+sY+sT]   + dr*tab[e+sY+sT+1];
+      return (1-dy)*((1-dt)*c0 + dt*c1) + dy*((1-dt)*c2 + dt*c3);
+    }
+
+    /**
+     * @brief      Bilinear interpolation in (log10 rho, Ye) of tab on the
+     *             node iT of the temperature axis
+     */
+    inline double
+    interp_node(
+      const double * tab,
+      int ir,
+      double dr,
+      int iT,
+      int iy,
+      double dy) const
+    {
+      const int64_t e = elem(ir,iT,iy);
+      const int64_t sY = int64_t(Nrho)*NT;
+      return (1-dy)*((1-dr)*tab[e]    + dr*tab[e+1])
+           +     dy*((1-dr)*tab[e+sY] + dr*tab[e+sY+1]);
+    }
+
+    /**
+     * @brief      log10 T at which the interpolated log energy is le_target.
+     *             The interpolant is linear in log10 T on each cell of the
+     *             temperature axis: the root is exact once the cell brackets
+     *             le_target. The search walks from the cell of the guess,
+     *             then bisects the nodes if the guess is far off.
+     */
+    double
+    find_lT(
+      double lr,
+      double ye,
+      double le_target,
+      double lT_guess) const
+    {
+      int ir, iy, iT;
+      double dr, dy, dt;
+      locate(lr,lrho_min,dlrho,Nrho,ir,dr);
+      locate(ye,Ye_min,dYe,NYe,iy,dy);
+      locate(lT_guess,lT_min,dlT,NT,iT,dt);
+
+      double f0 = interp_node(le,ir,dr,iT,iy,dy);
+      double f1 = interp_node(le,ir,dr,iT+1,iy,dy);
+      for(int step = 0; step < max_walk; ++step) {
+        if(le_target < f0 and iT > 0) {
+          --iT;
+          f1 = f0;
+          f0 = interp_node(le,ir,dr,iT,iy,dy);
+        }
+        else if(le_target > f1 and iT < NT-2) {
+          ++iT;
+          f0 = f1;
+          f1 = interp_node(le,ir,dr,iT+1,iy,dy);
+        }
+        else
+          break;
+      }
+      if((le_target < f0 and iT > 0) or (le_target > f1 and iT < NT-2)) {
+        int lo = 0, hi = NT-1;
+        while(hi - lo > 1) {
+          const int mid = (lo + hi)/2;
+          if(interp_node(le,ir,dr,mid,iy,dy) <= le_target)
+            lo = mid;
+          else
+            hi = mid;
+        }
+        iT = std::min(lo,NT-2);
+        f0 = interp_node(le,ir,dr,iT,iy,dy);
+        f1 = interp_node(le,ir,dr,iT+1,iy,dy);
+      }
+      const double t = f1 != f0 ?
+          std::min(std::max((le_target - f0)/(f1 - f0),0.),1.) : 0.;
+      return lT_min + (iT + t)*dlT;
+    }
+
+    /**
+     * @brief      Pressure, sound speed and temperature of n particles from
+     *             their density, internal energy and electron fraction. T is
+     *             the temperature of the previous call, used as the guess of
+     *             the root find (none if T <= 0). The particles whose guess
+     *             cell brackets the energy are solved in a vectorized loop,
+     *             the others in find_lT.
+     */
+    void
+    apply(
+      int64_t n,
+      const double * rho,
+      const double * u,
+      const double * ye,
+      double * T,
+      double * P,
+      double * cs) const
+    {
+      for(int64_t start = 0; start < n; start += block)
+        apply_block(std::min(block,n-start),rho+start,u+start,ye+start,
+          T+start,P+start,cs+start);
+    }
+
+  private:
+
+    // Cells walked from the guess before bisecting the temperature axis
+    static const int max_walk = 4;
+
+    // Particles of the working arrays of apply_block
+    static const int64_t block = 256;
+
+    MPI_Comm node_comm_ = MPI_COMM_NULL;
+    MPI_Win win_ = MPI_WIN_NULL;
+    const double * base_ = nullptr;
+
+    void
+    apply_block(
+      int64_t n,
+      const double * rho,
+      const double * u,
+      const double * ye,
+      double * T,
+      double * P,
+      double * cs) const
+    {
+      const double ln10 = log(10.);
+      const double lT_mid = lT_min + .5*(NT-1)*dlT;
+      alignas(64) double lr[block], lt[block], let[block];
+      bool done[block];
+
+      #pragma omp simd
+      for(int64_t i = 0; i < n; ++i) {
+        lr[i] = log(rho[i])/ln10;
+        let[i] = log(std::max(u[i] + energy_shift,1e-300))/ln10;
+        const double guess = T[i] > 0. ? log(T[i])/ln10 : lT_mid;
+        int ir, iy, iT;
+        double dr, dy, dt;
+        locate(lr[i],lrho_min,dlrho,Nrho,ir,dr);
+        locate(ye[i],Ye_min,dYe,NYe,iy,dy);
+        locate(guess,lT_min,dlT,NT,iT,dt);
+        const double f0 = interp_node(le,ir,dr,iT,iy,dy);
+        const double f1 = interp_node(le,ir,dr,iT+1,iy,dy);
+        done[i] = T[i] > 0. and f0 <= let[i] and let[i] <= f1 and f1 > f0;
+        lt[i] = done[i] ? lT_min + (iT + (let[i] - f0)/(f1 - f0))*dlT
+                        : guess;
+      }
+
+      for(int64_t i = 0; i < n; ++i)
+        if(not done[i])
+          lt[i] = find_lT(lr[i],ye[i],let[i],lt[i]);
+
+      #pragma omp simd
+      for(int64_t i = 0; i < n; ++i) {
+        P[i] = exp(ln10*interp(lP,lr[i],lt[i],ye[i]));
+        cs[i] = sqrt(interp(cs2,lr[i],lt[i],ye[i]));
+        T[i] = exp(ln10*lt[i]);
+      }
+    }
+
+    int64_t
+    nelem() const
+    {
+      return 1 + Nrho + NT + NYe + 3*int64_t(Nrho)*NT*NYe;
+    }
+
+    static int
+    read(
+      hid_t file_id,
+      const char * name,
+      hid_t type,
+      void * data)
+    {
+      hid_t dset_id = H5Dopen(file_id,name,H5P_DEFAULT);
+      if(dset_id < 0)
+        return -1;
+      herr_t status = H5Dread(dset_id,type,H5S_ALL,H5S_ALL,H5P_DEFAULT,data);
+      H5Dclose(dset_id);
+      return status < 0 ? -1 : 0;
+    }
+  }; // class sc_table
+
+  inline sc_table&
+  sc()
+  {
+    static sc_table table;
+    return table;
+  }
+
+} // namespace eos
+
+#endif // _eos_stellar_collapse_h_
@@ -112,6 +112,36 @@ namespace integration{
                    + physics::dt*source.getVelocity());
   }
 
+  /**
+   * @brief      Leapfrog: second kick of the internal energy or, in the
+   *             thermokinetic formulation, of the total energy
+   *
+   * @param      srch  The source's body holder
+   */
+  void
+  leapfrog_kick_energy (body& source) {
+    if (thermokinetic_formulation)
+      leapfrog_kick_e(source);
+    else
+      leapfrog_kick_u(source);
+  }
+
+
+  /**
+   * @brief      Leapfrog: first kick and drift in one sweep over the
+   *             particles, same as leapfrog_kick_v, leapfrog_kick_energy,
+   *             save_velocityhalf and leapfrog_drift in turn
+   *
+   * @param      srch  The source's body holder
+   */
+  void
+  leapfrog_kick_drift (body& source) {
+    leapfrog_kick_v(source);
+    leapfrog_kick_energy(source);
+    save_velocityhalf(source);
+    leapfrog_drift(source);
+  }
+
 }; // integration
 
 #endif // _integration_h_
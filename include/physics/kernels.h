@@ -753,9 +753,98 @@ namespace kernels{
     return result;
   }
 
+/*============================================================================*/
+/*   Tabulated kernel                                                         */
+/*============================================================================*/
+  // W(q) and (dW/dq)/q of the selected kernel for h = 1, sampled on q = r/h
+  // in [0,1] with one padding zero. The normalization sigma is in the table.
+  std::vector<double> table_w;
+  std::vector<double> table_dwdq_q;
+  double table_size = 0.;
+
+  /**
+   * @brief      Sample the kernel and its gradient for h = 1
+   *
+   * @param[in]  w     The analytic kernel
+   * @param[in]  dw    The analytic kernel gradient
+   * @param[in]  n     Number of intervals on the support
+   */
+  void
+  tabulate(
+    kernel_function_t w,
+    kernel_gradient_t dw,
+    int64_t n)
+  {
+    const double dq = 1./n;
+    table_w.assign(n+2,0.);
+    table_dwdq_q.assign(n+2,0.);
+    for(int64_t i = 0; i <= n; ++i){
+      // Limit of (dW/dq)/q at q = 0
+      point_t p = 0.0;
+      p[0] = std::max(i*dq,1.e-3*dq);
+      table_w[i] = w(i*dq,1.);
+      table_dwdq_q[i] = dw(p,1.)[0]/p[0];
+    }
+    table_size = n;
+  }
+
+  /**
+   * @brief      Linear interpolation of the tabulated kernel
+   *
+   * @param[in]  r     Distance between the particles
+   * @param[in]  h     Smoothing length
+   *
+   * @return     Contribution from the particle
+   */
+  double
+  kernel_tabulated(
+    const double& r,
+    const double& h)
+  {
+    const double x = r/h*table_size;
+    if(x >= table_size)
+      return 0.;
+    const int64_t i = x;
+    const double t = x - i;
+    double hd = h;
+    for (unsigned int d=1; d<gdimension; d++)
+      hd *= h;
+    return ((1.-t)*table_w[i] + t*table_w[i+1])/hd;
+  }
+
+  /**
+   * @brief      Gradient of the tabulated kernel:
+   *             grad W = vecP (dW/dq)/q / h^(D+2)
+   *
+   * @param[in]  vecP  The vector pab = pa - pb
+   * @param[in]  h     The smoothing length
+   *
+   * @return     Contribution from the particle
+   */
+  point_t
+  kernel_gradient_tabulated(
+    const point_t& vecP,
+    const double& h)
+  {
+    const double x = flecsi::norm2(vecP)/h*table_size;
+    point_t result = 0.0;
+    if(x >= table_size)
+      return result;
+    const int64_t i = x;
+    const double t = x - i;
+    double hd = h*h;
+    for (unsigned int d=0; d<gdimension; d++)
+      hd *= h;
+    result = vecP*(((1.-t)*table_dwdq_q[i] + t*table_dwdq_q[i+1])/hd);
+    return result;
+  }
+
 #ifdef sph_kernel
-  kernel_function_t sph_kernel_function = kernel<param::sph_kernel,gdimension>;
-  kernel_gradient_t sph_kernel_gradient = kernel_gradient<param::sph_kernel,gdimension>;
+  // Kernel built in the executable: the calls are resolved at compile time
+  constexpr kernel_function_t sph_kernel_function =
+      kernel<param::sph_kernel,gdimension>;
+  constexpr kernel_gradient_t sph_kernel_gradient =
+      kernel_gradient<param::sph_kernel,gdimension>;
 #else
   kernel_function_t sph_kernel_function = nullptr;
   kernel_gradient_t sph_kernel_gradient = nullptr;
@@ -824,6 +913,19 @@ namespace kernels{
     else {
       clog_fatal("Bad kernel parameter" << std::endl);
     }
+
+    // Replace the analytic kernel by its table
+    if (sph_kernel_tabulated) {
+#     ifdef sph_kernel
+      clog_one(warn) << "sph_kernel is built in the executable: "
+                     << "sph_kernel_tabulated is ignored" << std::endl;
+#     else
+      tabulate(sph_kernel_function,sph_kernel_gradient,
+        sph_kernel_table_size);
+      sph_kernel_function = kernel_tabulated;
+      sph_kernel_gradient = kernel_gradient_tabulated;
+#     endif
+    }
   }
 
 
@@ -0,0 +1,84 @@
+#include <cinchdevel.h>
+#include <cinchtest.h>
+
+#include <iostream>
+#include <cmath>
+#include <mpi.h>
+
+#include "params.h"
+#include "eos_stellar_collapse.h"
+
+using namespace std;
+using namespace eos;
+
+namespace flecsi{
+namespace execution{
+  void driver(int argc, char* argv[]){
+  }
+}
+}
+
+// Linear in the table coordinates: the trilinear interpolation is exact
+double table_le(double lr, double lt, double ye) {
+  return 18. + 0.1*lr + 1.5*lt + 0.5*ye;
+}
+double table_lP(double lr, double lt, double ye) {
+  return 20. + 1.2*lr + 0.3*lt + ye;
+}
+
+TEST(eos, stellar_collapse) {
+  const int Nrho = 61, NT = 41, NYe = 11;
+  sc_table& t = sc();
+  double * base = t.allocate(Nrho,NT,NYe);
+  if(base != nullptr) {
+    const int64_t n3 = int64_t(Nrho)*NT*NYe;
+    double * lrho = base + 1, * lT = lrho + Nrho, * Ye = lT + NT;
+    double * lP = Ye + NYe, * le = lP + n3, * cs2 = le + n3;
+    base[0] = 0.;
+    for(int i = 0; i < Nrho; ++i) lrho[i] = 3. + 0.2*i;
+    for(int i = 0; i < NT; ++i) lT[i] = -2. + 0.1*i;
+    for(int i = 0; i < NYe; ++i) Ye[i] = 0.05 + 0.05*i;
+    for(int iY = 0; iY < NYe; ++iY)
+      for(int iT = 0; iT < NT; ++iT)
+        for(int ir = 0; ir < Nrho; ++ir) {
+          const int64_t e = t.elem(ir,iT,iY);
+          lP[e] = table_lP(lrho[ir],lT[iT],Ye[iY]);
+          le[e] = table_le(lrho[ir],lT[iT],Ye[iY]);
+          cs2[e] = 1e16;
+        }
+  }
+  t.commit();
+  ASSERT_TRUE(t.loaded());
+
+  const int64_t n = 1000;
+  std::vector<double> rho(n), u(n), ye(n), lt(n), T(n,0.), P(n), cs(n);
+  for(int64_t i = 0; i < n; ++i) {
+    const double lr = 4. + 10.*i/n;
+    lt[i] = -1.5 + 3.*((i*37)%n)/n;
+    ye[i] = 0.1 + 0.4*((i*91)%n)/n;
+    rho[i] = pow(10.,lr);
+    u[i] = pow(10.,table_le(lr,lt[i],ye[i]));
+  }
+
+  // From scratch, then warm-started after a small change of the energy
+  for(int pass = 0; pass < 2; ++pass) {
+    t.apply(n,rho.data(),u.data(),ye.data(),T.data(),P.data(),cs.data());
+    for(int64_t i = 0; i < n; ++i) {
+      ASSERT_NEAR(log10(T[i]),lt[i],1e-10);
+      ASSERT_NEAR(log10(P[i]),table_lP(log10(rho[i]),lt[i],ye[i]),1e-10);
+      ASSERT_NEAR(cs[i],1e8,1e-2);
+    }
+    for(int64_t i = 0; i < n; ++i) {
+      lt[i] += 0.01;
+      u[i] = pow(10.,table_le(log10(rho[i]),lt[i],ye[i]));
+    }
+  }
+
+  // Far from the guess
+  const double lr = 8., y = 0.3;
+  ASSERT_NEAR(t.find_lT(lr,y,table_le(lr,1.7,y),-2.),1.7,1e-10);
+  ASSERT_NEAR(t.find_lT(lr,y,table_le(lr,-1.9,y),2.),-1.9,1e-10);
+
+  t.free();
+  ASSERT_FALSE(t.loaded());
+}
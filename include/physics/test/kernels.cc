@@ -119,3 +119,50 @@ TEST(kernel, wendland_c2_1d) {
 
   fclose(output);
 }
+
+/**
+ * @brief      Max error of the tabulated kernel and gradient of K, relative
+ *             to the max of the analytic kernel and gradient
+ */
+template<param::sph_kernel_keyword K>
+void check_tabulated(const char * name) {
+  const double h = 0.7;
+  const int64_t nsamples = 10000;
+  tabulate(kernel<K,gdimension>,kernel_gradient<K,gdimension>,4096);
+
+  double max_w = 0., max_dw = 0., err_w = 0., err_dw = 0.;
+  point_t p;
+  for(int64_t i = 0; i < nsamples; ++i){
+    const double r = h*(i+.5)/nsamples;
+    p = 0.0;
+    p[0] = r;
+    const double w = kernel<K,gdimension>(r,h);
+    const double dw = kernel_gradient<K,gdimension>(p,h)[0];
+    max_w = std::max(max_w,fabs(w));
+    max_dw = std::max(max_dw,fabs(dw));
+    err_w = std::max(err_w,fabs(kernel_tabulated(r,h)-w));
+    err_dw = std::max(err_dw,fabs(kernel_gradient_tabulated(p,h)[0]-dw));
+  }
+  std::cout << name << ": tabulated kernel error " << err_w/max_w
+            << " gradient error " << err_dw/max_dw << std::endl;
+  ASSERT_LT(err_w/max_w,1.e-5);
+  ASSERT_LT(err_dw/max_dw,1.e-4);
+
+  // Outside of the support
+  p = 0.0;
+  p[0] = 1.01*h;
+  ASSERT_EQ(kernel_tabulated(1.01*h,h),0.);
+  ASSERT_EQ(kernel_gradient_tabulated(p,h)[0],0.);
+}
+
+TEST(kernel, tabulated) {
+  set_sinc_kernel_normalization(param::sph_sinc_index);
+  check_tabulated<param::cubic_spline>("cubic_spline");
+  check_tabulated<param::quintic_spline>("quintic_spline");
+  check_tabulated<param::wendland_c2>("wendland_c2");
+  check_tabulated<param::wendland_c4>("wendland_c4");
+  check_tabulated<param::wendland_c6>("wendland_c6");
+  check_tabulated<param::gaussian>("gaussian");
+  check_tabulated<param::super_gaussian>("super_gaussian");
+  check_tabulated<param::sinc_ker>("sinc");
+}
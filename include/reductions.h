@@ -0,0 +1,252 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file reductions.h
+ * @brief Fused reductions over the particles for the scalar and diagnostic
+ * outputs. The outputs register groups of quantities, each with its
+ * per-particle contribution and its operation (sum, min or max). At each
+ * output step they request their groups; start() then accumulates all the
+ * requested quantities in one OpenMP pass over the particles and reduces
+ * them over the ranks in one packed MPI_Iallreduce. The reduction completes
+ * during the next step: the callbacks of the groups run at the next start()
+ * or at wait().
+ */
+
+#ifndef _reductions_h_
+#define _reductions_h_
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <vector>
+#include <mpi.h>
+
+#include "tree.h"
+
+namespace reductions{
+
+  enum op_t : char {SUM = 0, MIN = 1, MAX = 2};
+
+  // Accumulates the contributions of the n particles in acc[0..width)
+  typedef std::function<void(const body*,int64_t,double*)> contribution_t;
+  // Receives the reduced values of the group
+  typedef std::function<void(const double*)> callback_t;
+
+  // Particles of a block of the pass: the block stays in cache while the
+  // contributions of all the quantities are accumulated
+  const int64_t block_size = 256;
+
+  struct quantity_t {
+    op_t op;
+    int width;
+    int offset;  // in the values of the group
+    contribution_t contribution;
+  };
+
+  struct group_t {
+    std::vector<quantity_t> quantities;
+    int width = 0;
+  };
+
+  struct state_t {
+    std::vector<group_t> groups;
+    std::vector<std::pair<int,callback_t>> requested;
+    // Reduction in flight: packed values, their operations and the
+    // callbacks with the offsets of their groups
+    std::vector<double> values;
+    std::vector<op_t> ops;
+    std::vector<std::pair<int,callback_t>> pending;
+    MPI_Request request = MPI_REQUEST_NULL;
+    MPI_Datatype type = MPI_DATATYPE_NULL;
+    MPI_Op op = MPI_OP_NULL;
+  };
+
+  inline state_t& state()
+  {
+    static state_t s;
+    return s;
+  }
+
+  inline double
+  identity(op_t op)
+  {
+    return op == MIN ? std::numeric_limits<double>::max() :
+           op == MAX ? std::numeric_limits<double>::lowest() : 0.;
+  }
+
+  inline void
+  combine(
+    const double * in,
+    double * inout,
+    const op_t * ops,
+    int n)
+  {
+    for(int i = 0; i < n; ++i)
+      inout[i] = ops[i] == MIN ? std::min(inout[i],in[i]) :
+                 ops[i] == MAX ? std::max(inout[i],in[i]) : inout[i]+in[i];
+  }
+
+  // MPI operation of the packed values: the operation of each slot is the
+  // one of the reduction in flight, the same on all the ranks. The values
+  // are one element of a contiguous type, which MPI does not split.
+  inline void
+  mpi_combine(
+    void * in,
+    void * inout,
+    int * len,
+    MPI_Datatype * type)
+  {
+    int bytes;
+    MPI_Type_size(*type,&bytes);
+    const int n = bytes/sizeof(double);
+    for(int i = 0; i < *len; ++i)
+      combine(static_cast<double*>(in)+i*n,static_cast<double*>(inout)+i*n,
+        state().ops.data(),n);
+  }
+
+  /**
+   * @brief      Add a group of quantities
+   *
+   * @return     The id of the group
+   */
+  inline int
+  add_group()
+  {
+    state().groups.emplace_back();
+    return state().groups.size()-1;
+  }
+
+  /**
+   * @brief      Add a quantity of width values to a group
+   *
+   * @return     The offset of the quantity in the values of the group
+   */
+  inline int
+  add(
+    int group,
+    op_t op,
+    int width,
+    contribution_t contribution)
+  {
+    group_t& g = state().groups[group];
+    g.quantities.push_back({op,width,g.width,contribution});
+    g.width += width;
+    return g.width - width;
+  }
+
+  /**
+   * @brief      Complete the reduction in flight, if any, and run the
+   *             callbacks of its groups
+   */
+  inline void
+  wait()
+  {
+    state_t& s = state();
+    if(s.request == MPI_REQUEST_NULL)
+      return;
+    MPI_Wait(&s.request,MPI_STATUS_IGNORE);
+    MPI_Type_free(&s.type);
+    for(auto& p: s.pending)
+      p.second(s.values.data()+p.first);
+    s.pending.clear();
+  }
+
+  /**
+   * @brief      Completes the reduction in flight if it is done
+   *
+   * @return     true if no reduction is in flight anymore
+   */
+  inline bool
+  test()
+  {
+    state_t& s = state();
+    if(s.request == MPI_REQUEST_NULL)
+      return true;
+    int done;
+    MPI_Test(&s.request,&done,MPI_STATUS_IGNORE);
+    if(!done)
+      return false;
+    MPI_Type_free(&s.type);
+    for(auto& p: s.pending)
+      p.second(s.values.data()+p.first);
+    s.pending.clear();
+    return true;
+  }
+
+  /**
+   * @brief      Reduce the group in the next start(), done is called with its
+   *             values when the reduction completes
+   */
+  inline void
+  request(
+    int group,
+    callback_t done)
+  {
+    state().requested.emplace_back(group,done);
+  }
+
+  /**
+   * @brief      Accumulate the requested groups over the local particles in
+   *             one pass and start their reduction over the ranks.
+   *             Collective: the ranks request the same groups.
+   *
+   * @param      bodies  The local particles
+   */
+  inline void
+  start(
+    const std::vector<body>& bodies)
+  {
+    state_t& s = state();
+    wait();
+    if(s.requested.empty())
+      return;
+    if(s.op == MPI_OP_NULL)
+      MPI_Op_create(mpi_combine,1,&s.op);
+
+    // Pack the quantities of the requested groups
+    std::vector<std::pair<int,const quantity_t*>> quantities;
+    s.ops.clear();
+    for(auto& r: s.requested){
+      const int offset = s.ops.size();
+      s.pending.emplace_back(offset,r.second);
+      for(auto& q: s.groups[r.first].quantities){
+        quantities.emplace_back(offset+q.offset,&q);
+        s.ops.insert(s.ops.end(),q.width,q.op);
+      }
+    }
+    s.requested.clear();
+    const int n = s.ops.size();
+    s.values.resize(n);
+    for(int i = 0; i < n; ++i)
+      s.values[i] = identity(s.ops[i]);
+
+    const int64_t nbodies = bodies.size();
+    const int64_t nblocks = (nbodies + block_size - 1)/block_size;
+    #pragma omp parallel
+    {
+      std::vector<double> local(n);
+      for(int i = 0; i < n; ++i)
+        local[i] = identity(s.ops[i]);
+      #pragma omp for schedule(static)
+      for(int64_t b = 0; b < nblocks; ++b){
+        const body * first = bodies.data() + b*block_size;
+        const int64_t m = std::min(block_size,nbodies-b*block_size);
+        for(auto& q: quantities)
+          q.second->contribution(first,m,local.data()+q.first);
+      }
+      #pragma omp critical
+      combine(local.data(),s.values.data(),s.ops.data(),n);
+    }
+
+    MPI_Type_contiguous(n,MPI_DOUBLE,&s.type);
+    MPI_Type_commit(&s.type);
+    MPI_Iallreduce(MPI_IN_PLACE,s.values.data(),1,s.type,s.op,
+      MPI_COMM_WORLD,&s.request);
+  }
+
+} // namespace reductions
+
+#endif // _reductions_h_
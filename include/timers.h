@@ -0,0 +1,153 @@
+/*~--------------------------------------------------------------------------~*
+ * Copyright (c) 2017 Triad National Security, LLC
+ * All rights reserved.
+ *~--------------------------------------------------------------------------~*/
+
+/**
+ * @file timers.h
+ * @brief Registry of wall-clock timers per phase of the iteration.
+ * Scoped timers accumulate in the registry, timers::output reduces the
+ * accumulated time over the ranks and appends to a CSV file:
+ * iteration,phase,calls,min,max,mean,imbalance with imbalance = max/mean.
+ */
+
+#ifndef _timers_h_
+#define _timers_h_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <mpi.h>
+
+namespace timers{
+
+  struct phase_t {
+    double seconds = 0.;
+    int64_t calls = 0;
+  };
+
+  // The communication threads also record their time
+  inline std::map<std::string,phase_t>& registry()
+  {
+    static std::map<std::string,phase_t> phases;
+    return phases;
+  }
+
+  inline std::mutex& registry_mutex()
+  {
+    static std::mutex m;
+    return m;
+  }
+
+  /**
+   * @brief      Add time to a phase
+   */
+  inline void
+  add(
+    const char* name,
+    double seconds)
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    phase_t& p = registry()[name];
+    p.seconds += seconds;
+    ++p.calls;
+  }
+
+  /**
+   * @brief      Time the enclosing scope in the phase name
+   */
+  class scoped_timer {
+  public:
+    scoped_timer(const char* name):name_(name),start_(MPI_Wtime()){}
+    ~scoped_timer(){ add(name_,MPI_Wtime()-start_); }
+  private:
+    const char* name_;
+    double start_;
+  };
+
+  /**
+   * @brief      Reduce the phases over the ranks and append them to the CSV
+   * file on rank 0, then reset the registry. Collective.
+   *
+   * @param[in]  iteration  The current iteration
+   * @param[in]  filename   The CSV file
+   */
+  inline void
+  output(
+    int64_t iteration,
+    const char* filename = "timers.csv")
+  {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+    MPI_Comm_size(MPI_COMM_WORLD,&size);
+    static bool first_time = true;
+
+    // Union of the phase names over the ranks
+    std::string names;
+    {
+      std::lock_guard<std::mutex> lock(registry_mutex());
+      for(auto& p: registry())
+        names += p.first + '\n';
+    }
+    int nchars = names.size();
+    std::vector<int> counts(size), offsets(size,0);
+    MPI_Allgather(&nchars,1,MPI_INT,counts.data(),1,MPI_INT,MPI_COMM_WORLD);
+    for(int i = 1; i < size; ++i)
+      offsets[i] = offsets[i-1] + counts[i-1];
+    std::string all(offsets.back()+counts.back(),'\0');
+    MPI_Allgatherv(names.data(),nchars,MPI_CHAR,&all[0],counts.data(),
+      offsets.data(),MPI_CHAR,MPI_COMM_WORLD);
+    std::map<std::string,phase_t> phases;
+    size_t start = 0, end;
+    while((end = all.find('\n',start)) != std::string::npos){
+      phases[all.substr(start,end-start)];
+      start = end+1;
+    }
+
+    // Same ordered set of phases on all the ranks
+    const size_t n = phases.size();
+    std::vector<double> local(n), min(n), max(n), sum(n);
+    std::vector<int64_t> calls(n);
+    {
+      std::lock_guard<std::mutex> lock(registry_mutex());
+      size_t i = 0;
+      for(auto& p: phases){
+        auto it = registry().find(p.first);
+        if(it != registry().end()){
+          local[i] = it->second.seconds;
+          calls[i] = it->second.calls;
+        }
+        ++i;
+      }
+      registry().clear();
+    }
+    MPI_Reduce(local.data(),min.data(),n,MPI_DOUBLE,MPI_MIN,0,MPI_COMM_WORLD);
+    MPI_Reduce(local.data(),max.data(),n,MPI_DOUBLE,MPI_MAX,0,MPI_COMM_WORLD);
+    MPI_Reduce(local.data(),sum.data(),n,MPI_DOUBLE,MPI_SUM,0,MPI_COMM_WORLD);
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : calls.data(),calls.data(),n,
+      MPI_INT64_T,MPI_MAX,0,MPI_COMM_WORLD);
+    if(rank != 0)
+      return;
+
+    std::ofstream out(filename,first_time ? std::ios_base::out :
+      std::ios_base::app);
+    if(first_time)
+      out << "iteration,phase,calls,min,max,mean,imbalance" << std::endl;
+    first_time = false;
+    size_t i = 0;
+    out << std::scientific << std::setprecision(6);
+    for(auto& p: phases){
+      double mean = sum[i]/size;
+      out << iteration << "," << p.first << "," << calls[i] << ","
+          << min[i] << "," << max[i] << "," << mean << ","
+          << (mean > 0. ? max[i]/mean : 1.) << std::endl;
+      ++i;
+    }
+  }
+
+} // namespace timers
+
+#endif // _timers_h_
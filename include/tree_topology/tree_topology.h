@@ -51,6 +51,8 @@
 #include <omp.h>
 #include <mpi.h>
 #include <thread>
+#include <atomic>
+#include <type_traits>
 
 #include "flecsi/geometry/point.h"
 #include "flecsi/concurrency/thread_pool.h"
@@ -58,6 +60,8 @@
 #include "key_id.h"
 
 #include "tree_branch.h"
+#include "timers.h"
+#include "mpi_type.h"
 #include "tree_entity.h"
 #include "tree_geometry.h"
 #include "entity.h"
@@ -126,6 +130,32 @@ public:
   using geometry_t = tree_geometry<element_t, dimension>;
   using entity_space_ptr_t = std::vector<tree_entity_t*>;
 
+  /**
+  * @brief Per thread scratch arena for the tree traversal temporaries.
+  * The vectors are only cleared between the work branches, their capacity
+  * is kept from one traversal to the next and grows to the high-water mark
+  * of the previous steps, avoiding allocations in the traversal loop.
+  */
+  struct traversal_scratch_t{
+    std::vector<branch_t*> queue;
+    std::vector<branch_t*> new_queue;
+    std::vector<branch_t*> inter_list;
+    std::vector<branch_t*> requests_branches;
+    std::vector<point_t> inter_coordinates;
+    std::vector<element_t> inter_radius;
+    std::vector<entity_t*> inter_entities;
+    std::vector<size_t> inter_ids;
+    // Flat neighbors buffer for a work branch and offsets per particle,
+    // with the index of the tree entity of each neighbor
+    std::vector<entity_t*> neighbors;
+    std::vector<size_t> neighbors_ids;
+    std::vector<size_t> offsets;
+    // Neighbors of the current particle given to the physics function
+    std::vector<entity_t*> nbs;
+    // Contributions per local particle of the symmetric traversal
+    std::vector<double> accumulator;
+  };
+
   /*!
     Constuct a tree topology with unit coordinates, i.e. each coordinate
     dimension is in range [0, 1].
@@ -147,6 +177,7 @@ public:
     }
 
     ghosts_entities_.resize(max_traversal);
+    node_ghosts_.resize(max_traversal);
     current_ghosts = 0;
   }
 
@@ -175,6 +206,7 @@ public:
     }
 
     ghosts_entities_.resize(max_traversal);
+    node_ghosts_.resize(max_traversal);
     current_ghosts = 0;
   }
 
@@ -189,9 +221,14 @@ public:
     tree_entities_.clear();
     ghosts_id_.clear();
     ghosts_entities_.clear();
+    node_ghosts_.clear();
     current_ghosts = 0;
     shared_entities_.clear();
     nonlocal_branches_ = 0;
+    int finalized;
+    MPI_Finalized(&finalized);
+    if(!finalized)
+      set_node_shared(false);
   }
 
   /**
@@ -203,11 +240,14 @@ public:
     branch_map_.clear();
     tree_entities_.clear();
     ghosts_id_.clear();
-    for(int i = 0 ; i <= current_ghosts; ++i)
+    for(int i = 0 ; i <= current_ghosts; ++i){
       ghosts_entities_[i].clear();
+      node_ghosts_[i].clear();
+    }
     current_ghosts = 0;
     shared_entities_.clear();
     nonlocal_branches_ = 0;
+    node_keys_valid_ = false;
 
     branch_map_.emplace(branch_id_t::root(),branch_id_t::root());
     root_ = branch_map_.find(branch_id_t::root());
@@ -221,30 +261,38 @@ public:
   void
   reset_ghosts()
   {
+    timers::scoped_timer timer("reset_ghosts");
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD,&rank);
     MPI_Comm_size(MPI_COMM_WORLD,&size);
-    if(size == 1) return;
+    if(size == 1){
+      current_ghosts = 0;
+      return;
+    }
     //clog(trace)<<"Reset the ghosts: "<<ghosts_entities_.size()<<std::endl;
     // Remove the ghosts, all the parent have to be non local
-    for(int i = 0 ; i <= current_ghosts; ++i)
+    auto remove_ghost = [&](const entity_t& g)
     {
-      for(auto& g: ghosts_entities_[i])
+      // Find the parent and change the status
+      key_t k = g.key();
+      auto& b = find_parent(k);
+      assert(!b.is_local());
+      for(auto eid: b)
       {
-        // Find the parent and change the status
-        key_t k = g.key();
-        auto& b = find_parent(k);
-        assert(!b.is_local());
-        for(auto eid: b)
-        {
-          auto ent = get(eid);
-          assert(ent->owner() != rank);
-          ent->setBody(nullptr);
-        }
-        b.clear();
-        b.set_ghosts_local(false);
-        b.set_requested(false);
+        auto ent = get(eid);
+        assert(ent->owner() != rank);
+        ent->setBody(nullptr);
       }
+      b.clear();
+      b.set_ghosts_local(false);
+      b.set_requested(false);
+    };
+    for(int i = 0 ; i <= current_ghosts; ++i)
+    {
+      for(auto& g: ghosts_entities_[i])
+        remove_ghost(g);
+      for(auto g: node_ghosts_[i])
+        remove_ghost(*g);
     }
     // Same for the shared_edge
     for(auto& s: shared_entities_)
@@ -284,8 +332,10 @@ public:
       tree_entities_.erase(start_ghosts,tree_entities_.end());
       // Clear ghosts informations
       ghosts_id_.clear();
-      for(int i = 0 ; i <= current_ghosts; ++i)
+      for(int i = 0 ; i <= current_ghosts; ++i){
         ghosts_entities_[i].clear();
+        node_ghosts_[i].clear();
+      }
       current_ghosts = 0;
       shared_entities_.clear();
 
@@ -314,6 +364,8 @@ public:
     int rank,size;
     MPI_Comm_rank(MPI_COMM_WORLD,&rank);
     MPI_Comm_size(MPI_COMM_WORLD,&size);
+    // The messages count entities
+    MPI_Datatype entity_type = mpi_utils::mpi_type<entity_t>();
     // First rank%2 == 0 send to rank%2 == 1
     std::array<key_t,2> my_keys;
     std::array<key_t,2> neighbor_keys;
@@ -507,16 +559,16 @@ public:
         partner = rank+1;
         if(partner < size)
         {
-          MPI_Send(&(edge_entities[0]),sizeof(entity_t)*edge_entities.size(),
-            MPI_BYTE,partner,1,MPI_COMM_WORLD);
+          MPI_Send(&(edge_entities[0]),edge_entities.size(),entity_type,
+            partner,1,MPI_COMM_WORLD);
           MPI_Status status;
           MPI_Probe(partner,1,MPI_COMM_WORLD,&status);
           // Get the count
           int nrecv = 0;
-          MPI_Get_count(&status,MPI_BYTE,&nrecv);
-          int offset = received_ghosts.size();
-          received_ghosts.resize(offset+nrecv/sizeof(entity_t));
-          MPI_Recv(&(received_ghosts[offset]),nrecv,MPI_BYTE,partner,1,
+          MPI_Get_count(&status,entity_type,&nrecv);
+          size_t offset = received_ghosts.size();
+          received_ghosts.resize(offset+nrecv);
+          MPI_Recv(&(received_ghosts[offset]),nrecv,entity_type,partner,1,
             MPI_COMM_WORLD,MPI_STATUS_IGNORE);
         }
       }else{
@@ -527,13 +579,13 @@ public:
           MPI_Probe(partner,1,MPI_COMM_WORLD,&status);
           // Get the count
           int nrecv = 0;
-          MPI_Get_count(&status,MPI_BYTE,&nrecv);
-          int offset = received_ghosts.size();
-          received_ghosts.resize(offset+nrecv/sizeof(entity_t));
-          MPI_Recv(&(received_ghosts[offset]),nrecv,MPI_BYTE,partner,1,
+          MPI_Get_count(&status,entity_type,&nrecv);
+          size_t offset = received_ghosts.size();
+          received_ghosts.resize(offset+nrecv);
+          MPI_Recv(&(received_ghosts[offset]),nrecv,entity_type,partner,1,
             MPI_COMM_WORLD,MPI_STATUS_IGNORE);
-          MPI_Send(&(edge_entities[0]),sizeof(entity_t)*edge_entities.size(),
-            MPI_BYTE,partner,1,MPI_COMM_WORLD);
+          MPI_Send(&(edge_entities[0]),edge_entities.size(),entity_type,
+            partner,1,MPI_COMM_WORLD);
         }
       }
     }
@@ -580,6 +632,132 @@ public:
     }
   }
 
+  /**
+   * @brief Set the periodic domain used for the neighbor search.
+   * The branches and particles are compared to their closest periodic
+   * image along the periodic axis, no halo copies are needed.
+   *
+   * @param box The periodic box, [min,max] on each axis
+   * @param periodic True for the periodic axis
+   */
+  void
+  set_periodic(
+    const range_t& box,
+    const std::array<bool,dimension>& periodic)
+  {
+    periodic_ = periodic;
+    is_periodic_ = false;
+    for(size_t d = 0; d < dimension; ++d)
+    {
+      period_[d] = box[1][d] - box[0][d];
+      if(periodic_[d]){
+        assert(period_[d] > 0.);
+        is_periodic_ = true;
+      }
+    }
+  }
+
+  /**
+   * @brief Return true if the tree search is periodic on at least one axis
+   */
+  bool
+  is_periodic()
+  {
+    return is_periodic_;
+  }
+
+  /**
+   * @brief Enlarge the radius of the SPH neighbors search by factor, the
+   * neighbors are the particles at distance < factor*(h_a+h_b)/2.
+   * Used to get a list of candidates for the smoothing length iterations.
+   *
+   * @param factor The search radius factor, 1 for the regular search
+   * @param margin The enlargement of the work branches boxes, at least
+   * (factor-1)*hmax with hmax the largest smoothing length. It also covers
+   * the distant branches boxes computed with a smaller smoothing length.
+   */
+  void
+  set_search_factor(
+    const element_t factor,
+    const element_t margin)
+  {
+    assert(factor >= 1.);
+    assert(margin >= 0.);
+    search_factor_ = factor;
+    search_margin_ = margin;
+  }
+
+  /**
+   * @brief Share the entities of the ranks of a node in MPI-3 shared memory
+   * segments, refreshed at the start of each traversal (see share_node): a
+   * ghost owned by a rank of the same node is then read in the segment of
+   * its owner, only the ghosts of the other nodes are requested. The first
+   * traversal of a tree requests all the ghosts and marks the entities the
+   * ranks of the node need, the next ones only copy these entities.
+   * Collective over MPI_COMM_WORLD.
+   *
+   * @param enable False to free the segments and request all the ghosts
+   */
+  void
+  set_node_shared(
+    const bool enable)
+  {
+    if(node_win_ != MPI_WIN_NULL){
+      MPI_Win_unlock_all(node_win_);
+      MPI_Win_free(&node_win_);
+    }
+    if(node_comm_ != MPI_COMM_NULL)
+      MPI_Comm_free(&node_comm_);
+    node_rank_.clear();
+    node_segments_.clear();
+    node_capacity_ = 0;
+    node_keys_valid_ = false;
+    if(!enable)
+      return;
+
+    int rank, size, node_size;
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+    MPI_Comm_size(MPI_COMM_WORLD,&size);
+    MPI_Comm_split_type(MPI_COMM_WORLD,MPI_COMM_TYPE_SHARED,rank,
+      MPI_INFO_NULL,&node_comm_);
+    MPI_Comm_size(node_comm_,&node_size);
+    if(node_size == 1){
+      MPI_Comm_free(&node_comm_);
+      return;
+    }
+
+    // Rank in the node of each rank, -1 on the other nodes
+    MPI_Group world_group, node_group;
+    MPI_Comm_group(MPI_COMM_WORLD,&world_group);
+    MPI_Comm_group(node_comm_,&node_group);
+    std::vector<int> ranks(size);
+    for(int i = 0; i < size; ++i)
+      ranks[i] = i;
+    node_rank_.resize(size);
+    MPI_Group_translate_ranks(world_group,size,ranks.data(),node_group,
+      node_rank_.data());
+    MPI_Group_free(&world_group);
+    MPI_Group_free(&node_group);
+    for(auto& r: node_rank_)
+      if(r == MPI_UNDEFINED)
+        r = -1;
+  }
+
+  /**
+   * @brief Update the smoothing length of the local tree entities from the
+   * local entities and recompute the branches boxes
+   */
+  void
+  update_h()
+  {
+    #pragma omp parallel for
+    for(int64_t i = 0; i < (int64_t)entities_.size(); ++i){
+      assert(tree_entities_[i].is_local());
+      tree_entities_[i].set_h(entities_[i].radius());
+    }
+    cofm(root(),0,false);
+  }
+
   /**
    * @brief Get the range
    */
@@ -710,11 +888,15 @@ public:
   /**
 ` * @brief Apply a function ef to the sub_cells using asynchronous comms.
   * @param [in] b The starting branch for the traversal
-  * @param [in] ncritical The number of subparticles for the branches
-  * @param [in] b The starting branch for the traversal
-  * @param [in] b The starting branch for the traversal
+  * @param [in] ef The function ef(particle,nbs,args...) applied to each
+  * local particle with its neighbors
   * @return <return_description>
-  * @details <details>
+  * @details The function ef is applied in place on the local entities,
+  * no copy of the entities is made. ef must only write the fields it
+  * produces for the particle and only read from the neighbors fields that
+  * are not produced during this traversal (e.g. the density traversal reads
+  * the neighbors mass and position and writes the density). This keeps the
+  * neighbors state consistent without double buffering the whole entities.
   */
   template<
     typename EF,
@@ -726,31 +908,216 @@ public:
       EF&& ef,
       ARGS&&... args)
   {
+    timers::scoped_timer timer("traversal_sph");
+    traversal_sph_branches(b,
+      [&](branch_t* work_branch, traversal_scratch_t& scratch)
+      {
+        int index = 0;
+        for(int j = work_branch->begin_tree_entities();
+          j <= work_branch->end_tree_entities(); ++j)
+        {
+          if(tree_entities_[j].is_local()){
+            scratch.nbs.assign(
+              scratch.neighbors.begin()+scratch.offsets[index],
+              scratch.neighbors.begin()+scratch.offsets[index+1]);
+            ef(entities_[j],scratch.nbs,args...);
+          }
+          ++index;
+        }
+      });
+  } // traversal_sph
+
+  /**
+  * @brief Version of traversal_sph restricted to the selected particles
+  * @param [in] b The starting branch for the traversal
+  * @param [in] sf The function sf(particle) returning true if the local
+  * particle has to be computed
+  * @param [in] ef The function ef(particle,nbs) applied to each selected
+  * particle with its neighbors
+  * @details The work branches without selected particles are skipped:
+  * their interaction lists are not built and their distant branches are
+  * not requested.
+  */
+  template<
+    typename SF,
+    typename EF
+  >
+  void
+  traversal_sph_selected(
+      branch_t * b,
+      SF&& sf,
+      EF&& ef)
+  {
+    timers::scoped_timer timer("traversal_sph");
+    auto selected = [&](size_t j){
+      return tree_entities_[j].is_local() && sf(entities_[j]);
+    };
+    traversal_sph_branches(b,
+      [&](branch_t* work_branch)
+      {
+        for(size_t j = work_branch->begin_tree_entities();
+          j <= work_branch->end_tree_entities(); ++j)
+          if(selected(j))
+            return true;
+        return false;
+      },
+      [&](branch_t* work_branch, traversal_scratch_t& scratch)
+      {
+        int index = 0;
+        for(size_t j = work_branch->begin_tree_entities();
+          j <= work_branch->end_tree_entities(); ++j, ++index)
+        {
+          if(selected(j)){
+            scratch.nbs.assign(
+              scratch.neighbors.begin()+scratch.offsets[index],
+              scratch.neighbors.begin()+scratch.offsets[index+1]);
+            ef(entities_[j],scratch.nbs);
+          }
+        }
+      });
+  } // traversal_sph_selected
+
+  /**
+  * @brief Symmetric version of traversal_sph: each pair of local particles
+  * (a,b) in the smoothing length is computed only once.
+  * @param [in] b The starting branch for the traversal
+  * @param [in] pf The pair function pf(a,b,acc_a,acc_b) adding the
+  * contributions of the pair to the accumulators of a and b. It only reads
+  * the entities a and b.
+  * @param [in] ff The final function ff(a,acc_a) applied once per local
+  * particle with the sum of its contributions
+  * @details The pair of local particles is computed by the particle of
+  * lowest tree entity index, whatever the work branches of the two
+  * particles, and its contributions are scattered to both of them in the
+  * accumulation buffer of the thread, one slot per local particle, kept in
+  * the scratch arena. A ghost neighbor only gets the contribution of the
+  * local particle, its owner computes the other one: only the pairs with a
+  * ghost are computed twice. This requires the neighbors search to be
+  * symmetric, which within_square_periodic is. The buffers of the threads
+  * are summed and ff is applied when all the work branches are done.
+  * The self interaction (a,a) is not computed and has to be added by ff.
+  */
+  template<
+    typename ACC,
+    typename PF,
+    typename FF
+  >
+  void
+  traversal_sph_symmetric(
+      branch_t * b,
+      PF&& pf,
+      FF&& ff)
+  {
+    static_assert(std::is_trivially_copyable<ACC>::value &&
+      sizeof(ACC) % sizeof(double) == 0 && alignof(ACC) <= alignof(double),
+      "The accumulator has to be stored in the double scratch buffer");
+    timers::scoped_timer timer("traversal_sph");
+    const ACC zero = 0.;
+    const int64_t nlocal = entities_.size();
+    const int nthreads = omp_get_max_threads();
+    const size_t nslots = nlocal*(sizeof(ACC)/sizeof(double));
+
+    if(scratch_.size() < nthreads)
+      scratch_.resize(nthreads);
+    #pragma omp parallel for
+    for(int t = 0; t < nthreads; ++t){
+      scratch_[t].accumulator.resize(nslots);
+      ACC* acc = reinterpret_cast<ACC*>(scratch_[t].accumulator.data());
+      std::fill(acc,acc+nlocal,zero);
+    }
 
+    traversal_sph_branches(b,
+      [&](branch_t* work_branch, traversal_scratch_t& scratch)
+      {
+        ACC* acc = reinterpret_cast<ACC*>(scratch.accumulator.data());
+        int index = 0;
+        for(size_t j = work_branch->begin_tree_entities();
+          j <= work_branch->end_tree_entities(); ++j, ++index)
+        {
+          if(!tree_entities_[j].is_local())
+            continue;
+          entity_t& particle = entities_[j];
+          for(size_t n = scratch.offsets[index];
+            n < scratch.offsets[index+1]; ++n)
+          {
+            const size_t id = scratch.neighbors_ids[n];
+            if(tree_entities_[id].is_local()){
+              // Local pair, computed from the lowest index
+              if(id <= j) continue;
+              pf(particle,*scratch.neighbors[n],acc[j],acc[id]);
+            }else{
+              ACC ignore = zero;
+              pf(particle,*scratch.neighbors[n],acc[j],ignore);
+            }
+          }
+        }
+      });
+
+    // Sum the contributions of the threads
+    #pragma omp parallel for
+    for(int64_t i = 0; i < nlocal; ++i){
+      ACC sum = zero;
+      for(int t = 0; t < nthreads; ++t)
+        sum += reinterpret_cast<ACC*>(scratch_[t].accumulator.data())[i];
+      ff(entities_[i],sum);
+    }
+  } // traversal_sph_symmetric
+
+  /**
+  * @brief Traversal of the work branches of b using asynchronous comms:
+  * bf(work_branch,scratch) is called once per work branch, with the
+  * neighbors of its particles in the scratch arena of the thread.
+  */
+  template<
+    typename BF
+  >
+  void
+  traversal_sph_branches(
+      branch_t * b,
+      BF&& bf)
+  {
+    traversal_sph_branches(b,[](branch_t*){return true;},
+      std::forward<BF>(bf));
+  }
+
+  /**
+  * @brief Traversal of the work branches of b for which wf(work_branch)
+  * is true, the other ones are skipped.
+  */
+  template<
+    typename WF,
+    typename BF
+  >
+  void
+  traversal_sph_branches(
+      branch_t * b,
+      WF&& wf,
+      BF&& bf)
+  {
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD,&rank);
     MPI_Comm_size(MPI_COMM_WORLD,&size);
 
-    entities_w_ = entities_;
-
     std::vector<branch_t*> working_branches;
     find_sub_cells(b,ncritical,working_branches);
+    working_branches.erase(std::remove_if(working_branches.begin(),
+      working_branches.end(),[&](branch_t* w){return !wf(w);}),
+      working_branches.end());
 
     // Remaining branches in case of non locality
     std::vector<branch_t*> remaining_branches;
 
     // Start communication thread
     if(size != 1){
+      share_node();
       std::thread handler(&tree_topology::handle_requests,this);
       // Start tree traversal
-      traverse_sph(working_branches,
-        remaining_branches,false,ef,std::forward<ARGS>(args)...);
+      traverse_sph(working_branches,remaining_branches,false,bf);
       MPI_Send(NULL, 0, MPI_INT, rank, MPI_DONE,MPI_COMM_WORLD);
       // Wait for communication thread
       handler.join();
     }else{
-      traverse_sph(working_branches,
-        remaining_branches,false,ef,std::forward<ARGS>(args)...);
+      traverse_sph(working_branches,remaining_branches,false,bf);
     }
 
 #ifdef DEBUG
@@ -761,21 +1128,7 @@ public:
 #endif
 
     // Add the eventual ghosts in the tree for remaining branches
-    for(size_t i = 0; i < ghosts_entities_[current_ghosts].size(); ++i)
-    {
-      entity_t& g = ghosts_entities_[current_ghosts][i];
-      auto id = make_entity(g.key(),g.coordinates(),
-        nullptr,g.owner(),g.mass(),g.id(),g.radius());
-      // Assert the parent exists and is non local
-      assert(!find_parent(g.key()).is_local());
-      insert(id);
-      auto nbi = get(id);
-      nbi->setBody(&g);
-      assert(nbi->global_id() == g.id());
-      assert(nbi->getBody() != nullptr);
-      // Set the parent to local for the search
-      find_parent(g.key()).set_ghosts_local(true);
-    }
+    insert_ghosts();
 
     // Prepare for the eventual next tree traversal, use other ghosts vector
     ++current_ghosts;
@@ -786,13 +1139,10 @@ public:
     // Vector useless because in this case no ghosts can be found
     if(remaining_branches.size() > 0){
       std::vector<branch_t*> ignore;
-      traverse_sph(remaining_branches,ignore,
-        true,ef,std::forward<ARGS>(args)...);
+      traverse_sph(remaining_branches,ignore,true,bf);
     }
-    // Copy back the results
-    entities_ = entities_w_;
 
-  } // apply_sub_cells
+  } // traversal_sph_branches
 
   /**
   * @brief Perform a tree traversal in parallel using omp threads for
@@ -805,22 +1155,20 @@ public:
   * distant particles will be gathered
   * @param [in] assert_local In the case of local run assert that no distant
   * particles are reached.
-  * @param [in] ef The function to apply to the particles in the work_branch
-  * @param [in] args Arguments of the function ef
+  * @param [in] bf The function bf(work_branch,scratch) computing the
+  * particles of a work branch from their neighbors in scratch
   * @return void
   * @details
   */
   template<
-    typename EF,
-    typename... ARGS
+    typename BF
   >
   void
   traverse_sph(
     std::vector<branch_t*>& working_branches,
     std::vector<branch_t*>& non_local_branches,
     const bool assert_local,
-    EF&& ef,
-    ARGS&&... args)
+    BF&& bf)
   {
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD,&rank);
@@ -828,31 +1176,23 @@ public:
 
     int nelem = working_branches.size();
 
+    // One scratch arena per thread, kept between the traversals
+    if(scratch_.size() < omp_get_max_threads())
+      scratch_.resize(omp_get_max_threads());
+
     #pragma omp parallel for
     for(int i = 0 ; i < nelem; ++i){
-      std::vector<branch_t*> inter_list;
-      std::vector<branch_t*> requests_branches;
+      traversal_scratch_t& scratch = scratch_[omp_get_thread_num()];
+      scratch.inter_list.clear();
+      scratch.requests_branches.clear();
 
       // Compute the interaction list for this branch
-      if(interactions_branches(working_branches[i],inter_list,
-        requests_branches))
+      if(interactions_branches(working_branches[i],scratch))
       {
-        std::vector<std::vector<entity_t*>> neighbors;
-        neighbors.clear();
-        neighbors.resize(working_branches[i]->sub_entities());
         // Sub traversal to apply to the particles
-        interactions_particles(working_branches[i],
-          inter_list,neighbors);
+        interactions_particles(working_branches[i],scratch);
         // Perform the computation in the same time for all the threads
-        int index = 0;
-        //for(auto j: *(working_branches[i]))
-        for(int j = working_branches[i]->begin_tree_entities();
-          j <= working_branches[i]->end_tree_entities(); ++j)
-        {
-          if(tree_entities_[j].is_local())
-            ef(entities_w_[j],neighbors[index],std::forward<ARGS>(args)...);
-          ++index;
-        }
+        bf(working_branches[i],scratch);
       }else{
         assert(!assert_local);
         std::vector<key_t> send;
@@ -860,7 +1200,7 @@ public:
         {
           non_local_branches.push_back(working_branches[i]);
           // Send branch key to request handler
-          for(auto b: requests_branches){
+          for(auto b: scratch.requests_branches){
             assert(b->owner() < size && b->owner() >= 0);
             assert(b->owner() != rank);
             if(!b->requested()){
@@ -880,22 +1220,32 @@ public:
   /**
   * @brief Compute the interaction list for all the sub-particles in b
   * @param [in] b Branch on which to propagate the force
-  * @param [in] inter_list The interaction list of the sub-particles of b
-  * @param [in] ef The function to apply on the particles
-  * @param [in] args The arguments of the function to apply
-  * @return void
+  * @param [in] scratch The thread scratch arena, the interaction list is
+  * stored in scratch.inter_list and the non local branches in
+  * scratch.requests_branches
+  * @return True if all the branches of the interaction list are local
   * @details This function apply a tree traversal because the branch b can
   * be different than a leaf.
   */
   bool
   interactions_branches(
     branch_t* work_branch,
-    std::vector<branch_t*>& inter_list,
-    std::vector<branch_t*>& non_local)
+    traversal_scratch_t& scratch)
   {
     // Queues for the branches
-    std::vector<branch_t*> queue;
-    std::vector<branch_t*> new_queue;
+    std::vector<branch_t*>& queue = scratch.queue;
+    std::vector<branch_t*>& new_queue = scratch.new_queue;
+    std::vector<branch_t*>& inter_list = scratch.inter_list;
+    std::vector<branch_t*>& non_local = scratch.requests_branches;
+    queue.clear();
+
+    // Enlarge the work branch box for the candidates search
+    point_t work_min = work_branch->bmin();
+    point_t work_max = work_branch->bmax();
+    for(size_t d = 0; d < dimension; ++d){
+      work_min[d] -= search_margin_;
+      work_max[d] += search_margin_;
+    }
 
     queue.push_back(root());
     while(!queue.empty()){
@@ -914,8 +1264,8 @@ public:
       queue.clear();
       for(int i = 0 ; i < queue_size; ++i){
         branch_t* b = new_queue[i];
-        if(geometry_t::intersects_box_box(
-          b->bmin(),b->bmax(),work_branch->bmin(),work_branch->bmax()))
+        if(intersects_box_box_periodic(
+          b->bmin(),b->bmax(),work_min,work_max))
         {
           if(b->is_leaf()){
             if(b->is_local() || b->ghosts_local()){
@@ -932,48 +1282,56 @@ public:
     return non_local.size() == 0;
   }
 
+  /**
+  * @brief Compute the neighbors of the sub-particles of working_branch
+  * from the interaction list.
+  * @details The neighbors are stored in a single flat buffer,
+  * scratch.neighbors, the neighbors of the i-th sub-particle are in
+  * [scratch.offsets[i],scratch.offsets[i+1])
+  */
   void
   interactions_particles(
     branch_t* working_branch,
-    const std::vector<branch_t*>& inter_list,
-    std::vector<std::vector<entity_t*>>& neighbors)
+    traversal_scratch_t& scratch)
   {
-    std::vector<point_t> inter_coordinates;
-    std::vector<element_t> inter_radius;
-    std::vector<entity_t*> inter_entities;
-    for(int j = 0; j < inter_list.size(); ++j){
-      for(auto k: *(inter_list[j])){
+    std::vector<point_t>& inter_coordinates = scratch.inter_coordinates;
+    std::vector<element_t>& inter_radius = scratch.inter_radius;
+    std::vector<entity_t*>& inter_entities = scratch.inter_entities;
+    inter_coordinates.clear();
+    inter_radius.clear();
+    inter_entities.clear();
+    scratch.inter_ids.clear();
+    scratch.neighbors.clear();
+    scratch.neighbors_ids.clear();
+    scratch.offsets.clear();
+
+    for(int j = 0; j < scratch.inter_list.size(); ++j){
+      for(auto k: *(scratch.inter_list[j])){
         inter_coordinates.push_back(tree_entities_[k].coordinates());
         inter_radius.push_back(tree_entities_[k].h());
         inter_entities.push_back(tree_entities_[k].getBody());
+        scratch.inter_ids.push_back(k);
         assert(inter_entities.back() != nullptr);
       }
     }
     const int nb_entities = inter_coordinates.size();
-    int index = 0;
-    //for(auto i: *(working_branch))
+    scratch.offsets.push_back(0);
     for(int i = working_branch->begin_tree_entities();
       i <= working_branch->end_tree_entities(); ++i)
     {
       point_t coordinates = tree_entities_[i].coordinates();
-      element_t radius = tree_entities_[i].h();
-      size_t total = 0;
-      std::vector<size_t> accepted(nb_entities,0);
+      element_t radius = tree_entities_[i].h()*search_factor_;
       for(int j = 0 ; j < nb_entities; ++j)
       {
-        accepted[j] += geometry_t::within_square(
+        if(within_square_periodic(
           inter_coordinates[j],coordinates,
-          inter_radius[j],radius);
-        total += accepted[j];
-      }
-      neighbors[index].resize(total);
-      int index_add = 0;
-      for(int j = 0 ; j < nb_entities; ++j)
-      {
-        if(accepted[j])
-          neighbors[index][index_add++] = inter_entities[j];
+          inter_radius[j]*search_factor_,radius))
+        {
+          scratch.neighbors.push_back(inter_entities[j]);
+          scratch.neighbors_ids.push_back(scratch.inter_ids[j]);
+        }
       }
-      ++index;
+      scratch.offsets.push_back(scratch.neighbors.size());
     }
   }
 
@@ -994,6 +1352,7 @@ public:
       C2P&& f_c2p
     )
   {
+    timers::scoped_timer timer("traversal_fmm");
 
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD,&rank);
@@ -1001,8 +1360,6 @@ public:
     clog_one(trace) << "FMM : maxmasscell: "<<maxmasscell<<" MAC: "<<
       MAC<<std::endl;
 
-    entities_w_ = entities_;
-
     std::stack<branch_t*> stk;
     stk.push(b);
     std::vector<branch_t*> work_branch;
@@ -1012,6 +1369,7 @@ public:
 
 
     if(size != 1){
+      share_node();
       std::thread handler(&tree_topology::handle_requests,this);
       // Start tree traversal
       traversal_fmm(work_branch,remaining_branches,MAC,
@@ -1031,21 +1389,7 @@ public:
       MPI_STATUS_IGNORE);
     assert(flag == 0);
 #endif
-    for(size_t i = 0; i < ghosts_entities_[current_ghosts].size(); ++i)
-    {
-      entity_t& g = ghosts_entities_[current_ghosts][i];
-      auto id = make_entity(g.key(),g.coordinates(),
-        nullptr,g.owner(),g.mass(),g.id(),g.radius());
-      // Assert the parent exists and is non local
-      assert(!find_parent(g.key()).is_local());
-      insert(id);
-      auto nbi = get(id);
-      nbi->setBody(&g);
-      assert(nbi->global_id() == g.id());
-      assert(nbi->getBody() != nullptr);
-      // Set the parent to local for the search
-      find_parent(g.key()).set_ghosts_local(true);
-    }
+    insert_ghosts();
     ++current_ghosts;
     assert(current_ghosts < max_traversal);
     cofm(root(), 0, false);
@@ -1058,7 +1402,6 @@ public:
     }else{
       assert(remaining_branches.size() == 0);
     }
-    entities_ = entities_w_;
   } // apply_sub_cells
 
   /**
@@ -1189,7 +1532,7 @@ public:
       // Propagate this information to the sub-particles for C2P
       for(int i = b->begin_tree_entities(); i <= b->end_tree_entities(); ++i){
         if(tree_entities_[i].is_local()){
-          f_c2p(fc,dfcdr,dfcdrdr,b->coordinates(),&(entities_w_[i]));
+          f_c2p(fc,dfcdr,dfcdrdr,b->coordinates(),&(entities_[i]));
         }
       }
       // Apply the P2P for the local particles
@@ -1199,9 +1542,9 @@ public:
             if(tree_entities_[k].id() != tree_entities_[i].id()){
               // N square computation
               point_t fc;
-              entities_w_[i].setAcceleration(
-                entities_w_[i].getAcceleration()+
-                f_fc(fc,entities_w_[i].coordinates(),
+              entities_[i].setAcceleration(
+                entities_[i].getAcceleration()+
+                f_fc(fc,entities_[i].coordinates(),
                   tree_entities_[k].coordinates(),tree_entities_[k].mass()));
             }
           }
@@ -1211,6 +1554,205 @@ public:
     return non_local.size() > 0;
   }
 
+  /**
+  * @brief Add the ghosts received and read in the node segments during the
+  * traversal in the tree, under their non local parents
+  */
+  void
+  insert_ghosts()
+  {
+    auto insert_ghost = [this](entity_t& g)
+    {
+      auto id = make_entity(g.key(),g.coordinates(),
+        nullptr,g.owner(),g.mass(),g.id(),g.radius());
+      // Assert the parent exists and is non local
+      assert(!find_parent(g.key()).is_local());
+      insert(id);
+      auto nbi = get(id);
+      nbi->setBody(&g);
+      assert(nbi->global_id() == g.id());
+      assert(nbi->getBody() != nullptr);
+      // Set the parent to local for the search
+      find_parent(g.key()).set_ghosts_local(true);
+    };
+    for(auto& g: ghosts_entities_[current_ghosts])
+      insert_ghost(g);
+    for(auto g: node_ghosts_[current_ghosts])
+      insert_ghost(*g);
+  }
+
+  /**
+  * @brief Refresh the node segment of this rank at the start of a
+  * traversal: the keys of the local entities, sorted, and of the edge
+  * entities shared by the neighbors, and the copy of the entities marked
+  * by the ranks of the node in the previous traversals of this tree (see
+  * get_node_entities). The ghosts read in the segments have the values of
+  * the start of the traversal, as the replies to the requests for the
+  * fields which are not written during the traversal.
+  * Collective over the ranks of the node.
+  */
+  void
+  share_node()
+  {
+    if(node_comm_ == MPI_COMM_NULL)
+      return;
+    timers::scoped_timer timer("share_node");
+
+    // All the ranks of the node are done reading the segments of the
+    // previous traversal when the reduction completes
+    const int64_t nentities = entities_.size();
+    const int64_t nshared = shared_entities_.size();
+    int64_t capacity = nentities + nshared;
+    MPI_Allreduce(MPI_IN_PLACE,&capacity,1,MPI_INT64_T,MPI_MAX,node_comm_);
+
+    // Grow the segments. The number of entities only changes with a new
+    // tree or after reset_ghosts, no ghost references the segments then.
+    if(capacity > node_capacity_){
+      if(node_win_ != MPI_WIN_NULL){
+        MPI_Win_unlock_all(node_win_);
+        MPI_Win_free(&node_win_);
+      }
+      node_capacity_ = capacity + capacity/4;
+      char * base;
+      MPI_Win_allocate_shared(node_entities_offset() +
+        node_capacity_*sizeof(entity_t),1,MPI_INFO_NULL,node_comm_,&base,
+        &node_win_);
+      MPI_Win_lock_all(MPI_MODE_NOCHECK,node_win_);
+      int node_size;
+      MPI_Comm_size(node_comm_,&node_size);
+      node_segments_.resize(node_size);
+      for(int i = 0; i < node_size; ++i){
+        MPI_Aint bytes;
+        int disp_unit;
+        MPI_Win_shared_query(node_win_,i,&bytes,&disp_unit,
+          &(node_segments_[i]));
+      }
+      node_keys_valid_ = false;
+    }
+    MPI_Win_sync(node_win_);
+
+    int node_rank;
+    MPI_Comm_rank(node_comm_,&node_rank);
+    char * segment = node_segments_[node_rank];
+    node_header_t * header = reinterpret_cast<node_header_t*>(segment);
+    key_t * keys = node_keys(segment);
+    std::atomic<uint8_t> * states = node_states(segment);
+    entity_t * first = node_entities(segment);
+    // New tree: the keys of the local entities, no entity is marked
+    if(!node_keys_valid_){
+      #pragma omp parallel for
+      for(int64_t i = 0; i < node_capacity_; ++i){
+        if(i < nentities)
+          keys[i] = entities_[i].key();
+        new (states+i) std::atomic<uint8_t>(NODE_UNUSED);
+      }
+      node_keys_valid_ = true;
+    }
+    header->nentities = nentities;
+    header->nshared = nshared;
+    for(int64_t i = 0; i < nshared; ++i)
+      keys[nentities+i] = shared_entities_[i].key();
+    // Only copy the marked entities
+    #pragma omp parallel for
+    for(int64_t i = 0; i < nentities+nshared; ++i){
+      if(states[i].load(std::memory_order_relaxed) == NODE_UNUSED)
+        continue;
+      first[i] = i < nentities ? entities_[i] : shared_entities_[i-nentities];
+      states[i].store(NODE_COPIED,std::memory_order_relaxed);
+    }
+    MPI_Win_sync(node_win_);
+    MPI_Barrier(node_comm_);
+    MPI_Win_sync(node_win_);
+  }
+
+  /**
+  * @brief Find the entities of the branch k of a rank of the node in its
+  * segment: the same entities as get_sub_entities on this rank. If some
+  * of them were not copied for this traversal, they are marked for the
+  * next traversals and the branch has to be requested.
+  * @param [in] node_rank The owner of the branch, rank in the node
+  * @param [in] k The key of the branch
+  * @param [out] search_list The entities, in the segment
+  * @return false if the branch is not in the segment
+  */
+  bool
+  get_node_entities(
+    const int node_rank,
+    const key_t& k,
+    std::vector<entity_t*>& search_list)
+  {
+    char * segment = node_segments_[node_rank];
+    const node_header_t * header =
+      reinterpret_cast<node_header_t*>(segment);
+    const int64_t nentities = header->nentities;
+    const int64_t nshared = header->nshared;
+    const key_t * keys = node_keys(segment);
+    std::atomic<uint8_t> * states = node_states(segment);
+    entity_t * first = node_entities(segment);
+    const size_t depth = k.depth();
+    auto prefix = [depth](key_t key)
+    {
+      key.truncate(depth);
+      return key;
+    };
+    // The local entities with the key prefix k are contiguous, then the
+    // edge entities of the neighbors in the branch
+    std::vector<int64_t> ids;
+    int64_t i = std::lower_bound(keys,keys+nentities,k,
+      [&](const key_t& a, const key_t& b){ return prefix(a) < b; }) - keys;
+    for(; i < nentities && prefix(keys[i]) == k; ++i)
+      ids.push_back(i);
+    for(i = nentities; i < nentities + nshared; ++i)
+      if(prefix(keys[i]) == k)
+        ids.push_back(i);
+    bool copied = true;
+    for(auto id: ids){
+      if(states[id].load(std::memory_order_relaxed) == NODE_COPIED)
+        continue;
+      copied = false;
+      uint8_t expected = NODE_UNUSED;
+      states[id].compare_exchange_strong(expected,NODE_MARKED,
+        std::memory_order_relaxed);
+    }
+    if(!copied)
+      return false;
+    for(auto id: ids)
+      search_list.push_back(first+id);
+    return true;
+  }
+
+  // Layout of a node segment: the header, the keys, the states and the
+  // copies of the entities, node_capacity_ of each
+  key_t *
+  node_keys(
+    char * segment)
+  {
+    return reinterpret_cast<key_t*>(segment+node_header_bytes);
+  }
+
+  std::atomic<uint8_t> *
+  node_states(
+    char * segment)
+  {
+    return reinterpret_cast<std::atomic<uint8_t>*>(
+      segment+node_header_bytes+node_capacity_*sizeof(key_t));
+  }
+
+  size_t
+  node_entities_offset()
+  {
+    size_t offset = node_header_bytes+node_capacity_*(sizeof(key_t)+
+      sizeof(std::atomic<uint8_t>));
+    return (offset+alignof(entity_t)-1)/alignof(entity_t)*alignof(entity_t);
+  }
+
+  entity_t *
+  node_entities(
+    char * segment)
+  {
+    return reinterpret_cast<entity_t*>(segment+node_entities_offset());
+  }
+
 /**
 *
 */
@@ -1222,6 +1764,8 @@ public:
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD,&rank);
     MPI_Comm_size(MPI_COMM_WORLD,&size);
+    // The replies count entities: a reply can exceed 2 GiB
+    MPI_Datatype entity_type = mpi_utils::mpi_type<entity_t>();
     bool done_traversal = false;
     bool done = false;
 
@@ -1242,6 +1786,7 @@ public:
     int request_counter = 0;
     std::vector<bool> rank_done(size,false);
     bool done_rank = false;
+    double wait_requests = 0.;
 
     while(!done)
     {
@@ -1250,7 +1795,9 @@ public:
 
       int source, tag, nrecv;
       if(!done_traversal){
+        double start_wait = MPI_Wtime();
         MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+        wait_requests += MPI_Wtime() - start_wait;
         source = status.MPI_SOURCE;
         tag = status.MPI_TAG;
         nrecv = 0;
@@ -1284,9 +1831,10 @@ public:
         // ------------------------------------------------------------------ //
         case SOURCE_REPLY:
         {
+          MPI_Get_count(&status,entity_type,&nrecv);
           assert(nrecv != 0);
-          std::vector<entity_t> received(nrecv/sizeof(entity_t));
-          MPI_Recv(&(received[0]),nrecv,MPI_BYTE,source,
+          std::vector<entity_t> received(nrecv);
+          MPI_Recv(&(received[0]),nrecv,entity_type,source,
             SOURCE_REPLY,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
           //assert(is_unique(received));
           ghosts_entities_[current_ghosts].insert(
@@ -1314,7 +1862,7 @@ public:
           //assert(is_unique(reply[source][current_reply[source]]));
           int ncount = reply[source][current_reply[source]].size();
           MPI_Isend(&(reply[source][current_reply[source]++][0]),
-            ncount*sizeof(entity_t),MPI_BYTE,source,SOURCE_REPLY,MPI_COMM_WORLD,
+            ncount,entity_type,source,SOURCE_REPLY,MPI_COMM_WORLD,
             &(mpi_replies[current_mpi_replies++]));
           if(current_mpi_replies > max_requests){
               clog_one(error)<<rank<<
@@ -1334,6 +1882,11 @@ public:
             auto itr = branch_map_.find(k); assert(itr != branch_map_.end());
             branch_t* branch = &(itr->second); assert(branch->requested());
             int owner = branch->owner(); assert(owner != rank);
+            // Same node: read the entities in the segment of the owner
+            if(node_comm_ != MPI_COMM_NULL && node_rank_[owner] >= 0 &&
+              get_node_entities(node_rank_[owner],k,
+                node_ghosts_[current_ghosts]))
+              continue;
             // Add this request to vector
             requests[owner][current_requests[owner]].push_back(k);
             if(requests[owner][current_requests[owner]].size() >= max_size){
@@ -1424,6 +1977,7 @@ public:
         }
       }
     }
+    timers::add("handle_requests/wait",wait_requests);
     //clog(trace)<<"Handler done"<<std::endl;
   }
 
@@ -2058,6 +2612,59 @@ public:
 
 private:
 
+    /**
+    * @brief Box-box intersection taking into account the periodic images
+    * of the first box along the periodic axis
+    */
+    bool
+    intersects_box_box_periodic(
+      const point_t& min_b1,
+      const point_t& max_b1,
+      const point_t& min_b2,
+      const point_t& max_b2)
+    {
+      if(!is_periodic_)
+        return geometry_t::intersects_box_box(min_b1,max_b1,min_b2,max_b2);
+      for(size_t d = 0; d < dimension; ++d)
+      {
+        bool overlap = min_b1[d] <= max_b2[d] && max_b1[d] >= min_b2[d];
+        if(!overlap && periodic_[d]){
+          // Try the images on the left and on the right
+          overlap =
+            (min_b1[d]+period_[d] <= max_b2[d] &&
+             max_b1[d]+period_[d] >= min_b2[d]) ||
+            (min_b1[d]-period_[d] <= max_b2[d] &&
+             max_b1[d]-period_[d] >= min_b2[d]);
+        }
+        if(!overlap)
+          return false;
+      }
+      return true;
+    }
+
+    /**
+    * @brief Return true if the minimum image distance dist^2 < radius^2
+    */
+    bool
+    within_square_periodic(
+      const point_t& origin,
+      const point_t& center,
+      element_t r1,
+      element_t r2)
+    {
+      if(!is_periodic_)
+        return geometry_t::within_square(origin,center,r1,r2);
+      element_t dist_2 = 0.;
+      for(size_t d = 0; d < dimension; ++d)
+      {
+        element_t dx = origin[d]-center[d];
+        if(periodic_[d])
+          dx -= period_[d]*std::round(dx/period_[d]);
+        dist_2 += dx*dx;
+      }
+      return dist_2 <= (r1+r2)*(r1+r2)*0.25;
+    }
+
     /**
     * @brief Find the parent of an entity or branch based on the key
     * @details First truncate the key to the lowest possible in the tree, then
@@ -2128,7 +2735,6 @@ private:
   std::map<entity_id_t,entity_id_t> ghosts_id_;
   std::vector<tree_entity_t> tree_entities_;
   std::vector<entity_t> entities_;
-  std::vector<entity_t> entities_w_;
 
   const size_t max_traversal = 5;
   std::vector<std::vector<entity_t>> ghosts_entities_;
@@ -2136,8 +2742,41 @@ private:
 
   std::vector<entity_t> shared_entities_;
 
+  // Node shared segments, see set_node_shared: a header with the counts,
+  // then the keys, the states and the copies of the local entities and the
+  // shared edge entities of each rank
+  struct node_header_t {
+    int64_t nentities;
+    int64_t nshared;
+  };
+  static constexpr size_t node_header_bytes =
+    (sizeof(node_header_t)+alignof(entity_t)-1)/alignof(entity_t)*
+    alignof(entity_t);
+  // State of an entity in a segment: not needed by the node, marked by a
+  // rank of the node, copied for the current traversal
+  enum node_state_t : uint8_t { NODE_UNUSED, NODE_MARKED, NODE_COPIED };
+  MPI_Comm node_comm_ = MPI_COMM_NULL;
+  MPI_Win node_win_ = MPI_WIN_NULL;
+  std::vector<int> node_rank_;
+  std::vector<char*> node_segments_;
+  int64_t node_capacity_ = 0;
+  bool node_keys_valid_ = false;
+  // Ghosts read in the node segments, per traversal
+  std::vector<std::vector<entity_t*>> node_ghosts_;
+
   int64_t nonlocal_branches_;
 
+  std::vector<traversal_scratch_t> scratch_;
+
+  // Periodic domain: flags per axis and period length on each axis
+  bool is_periodic_ = false;
+  std::array<bool,dimension> periodic_{};
+  point__<element_t, dimension> period_{};
+
+  // Radius factor and box margin for the candidates search
+  element_t search_factor_ = 1.;
+  element_t search_margin_ = 0.;
+
   const int ncritical = 32;
 };
 
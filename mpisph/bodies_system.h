@@ -18,6 +18,7 @@
 #include "utils.h"
 #include "params.h"
 #include "fmm.h"
+#include "timers.h"
 
 #include <omp.h>
 #include <iostream>
@@ -61,6 +62,9 @@ public:
     if(param::sph_variable_h){
       clog_one(warn) <<"Variable smoothing length ENABLE"<<std::endl;
     }
+
+    // Read the ghosts of the ranks of the same node in shared memory
+    tree_.set_node_shared(param::node_shared_ghosts);
   };
 
   /**
@@ -100,6 +104,10 @@ public:
    *                             step number (i.e. sim_00000.h5part -> "sim")
    * @param[in]  output_prefix   Output filename prefix
    * @param[in]  startiteration  The iteration from which load the data
+   * @details    With initial_data_checkpoint the native checkpoint of
+   *             startiteration is used if it exists. With
+   *             initial_data_key_sorted the particles are read on the
+   *             process owning their key
    */
   void
   read_bodies(
@@ -107,9 +115,32 @@ public:
       const char * output_prefix,
       const int startiteration)
   {
+    if(param::initial_data_checkpoint && startiteration > 0 &&
+      io::inputCheckpoint(tree_.entities(),input_prefix,startiteration,
+        totalnbodies_,localnbodies_,range_)){
+      tree_.set_range(range_);
+      return;
+    }
 
+    if(!param::initial_data_key_sorted){
+      io::inputDataHDF5(tree_.entities(),input_prefix,output_prefix,
+          totalnbodies_,localnbodies_,startiteration);
+      return;
+    }
+
+    // Compute the keys on the positions and only read the particles of
+    // this process
     io::inputDataHDF5(tree_.entities(),input_prefix,output_prefix,
-        totalnbodies_,localnbodies_,startiteration);
+        totalnbodies_,localnbodies_,startiteration,MPI_COMM_WORLD,
+        [this](std::vector<body>& rbodies, std::vector<int64_t>& indices){
+          int64_t nbodies = rbodies.size();
+          MPI_Allreduce(MPI_IN_PLACE,&nbodies,1,MPI_INT64_T,MPI_SUM,
+            MPI_COMM_WORLD);
+          tcolorer_.mpi_compute_range(rbodies,range_);
+          tree_.set_range(range_);
+          tree_.compute_keys();
+          tcolorer_.mpi_qsort_indices(rbodies,nbodies,indices);
+        });
   }
 
   /**
@@ -122,6 +153,8 @@ public:
    * @param[in]  output_prefix  The output file prefix
    * @param[in]  iter           The iteration of output
    * @param[in]  do_diff_files  Generate a file for each steps
+   * @details    With out_h5data_async the bodies are staged and written
+   *             by a background thread
    */
   void
   write_bodies(
@@ -129,7 +162,43 @@ public:
       int iter,
       double totaltime)
   {
-    io::outputDataHDF5(tree_.entities(),output_prefix,iter,totaltime);
+    timers::scoped_timer timer("output");
+    if(param::out_h5data_async){
+      if(writer_ == nullptr)
+        writer_.reset(new io::async_writer(param::out_h5data_async_buffers));
+      writer_->push(tree_.entities(),output_prefix,iter,totaltime);
+    }else{
+      io::outputDataHDF5(tree_.entities(),output_prefix,iter,totaltime);
+    }
+  }
+
+  /**
+   * @brief      Write the local bodies and the run state in the native
+   *             per-rank checkpoint format
+   *
+   * @param[in]  output_prefix  The checkpoint files prefix
+   * @param[in]  iter           The iteration of the checkpoint
+   * @param[in]  totaltime      The physical time of the checkpoint
+   */
+  void
+  write_checkpoint(
+      const char * output_prefix,
+      int64_t iter,
+      double totaltime)
+  {
+    timers::scoped_timer timer("output/checkpoint");
+    io::outputCheckpoint(tree_.entities(),output_prefix,iter,totaltime,
+      range_);
+  }
+
+  /**
+   * @brief      Wait for the snapshots written in background
+   */
+  void
+  flush_bodies()
+  {
+    if(writer_ != nullptr)
+      writer_->finish();
   }
 
 
@@ -194,27 +263,26 @@ public:
     MPI_Comm_size(MPI_COMM_WORLD,&size);
     std::ostringstream oss;
 
+    timers::scoped_timer timer_update("update_iteration");
+
     // Clean the previous tree
     tree_.clean();
 
-    if(param::periodic_boundary_x || param::periodic_boundary_y ||
-      param::periodic_boundary_z)
-      boundary::pboundary_clean(tree_.entities());
-
+    // Periodic domains are handled in the tree search with minimum image
+    // distances: only bring back the particles which left the box
     if(param::periodic_boundary_x || param::periodic_boundary_y ||
       param::periodic_boundary_z){
-      // Choose the smoothing length to be the biggest from everyone
-      double smoothinglength = getSmoothinglength();
-      boundary::pboundary_generate(tree_.entities(),2.5*smoothinglength);
-      localnbodies_ = tree_.entities().size();
-      MPI_Allreduce(&localnbodies_,&totalnbodies_,1,MPI_INT64_T,MPI_SUM,
-        MPI_COMM_WORLD);
+      boundary::pboundary_wrap(tree_.entities());
+      tree_.set_periodic(boundary::periodic_box(),boundary::periodic_axis());
     }
 
     clog_one(trace)<<"#particles: "<<totalnbodies_<<std::endl;
 
    // Then compute the range of the system
-    tcolorer_.mpi_compute_range(tree_.entities(),range_);
+    {
+      timers::scoped_timer timer("update_iteration/range");
+      tcolorer_.mpi_compute_range(tree_.entities(),range_);
+    }
     clog_one(trace) << "Range="<<range_[0]<<";"<<range_[1]<<std::endl;
     assert(range_[0] != range_[1]);
 
@@ -223,14 +291,21 @@ public:
     tree_.set_range(range_);
 
     // Compute the keys
-    tree_.compute_keys();
+    {
+      timers::scoped_timer timer("update_iteration/keys");
+      tree_.compute_keys();
+    }
     // Distributed sample sort
-    tcolorer_.mpi_qsort(tree_.entities(),totalnbodies_);
+    {
+      timers::scoped_timer timer("update_iteration/qsort");
+      tcolorer_.mpi_qsort(tree_.entities(),totalnbodies_);
+    }
 
 #ifdef OUTPUT_TREE_INFO
     clog_one(trace) << "Construction of the tree";
 #endif
 
+    double start_build = MPI_Wtime();
 // Sort the bodies
 #ifdef BOOST_PARALLEL
     boost::sort::block_indirect_sort(
@@ -261,14 +336,12 @@ public:
       assert(nbi->is_local());
     }
     localnbodies_ = tree_.entities().size();
+    timers::add("update_iteration/tree_build",MPI_Wtime()-start_build);
 
     #ifdef OUTPUT_TREE_INFO
         clog_one(trace) << ".done"<<std::endl;
     #endif
 
-if(!(param::periodic_boundary_x || param::periodic_boundary_y ||
-  param::periodic_boundary_z))
-{
 #ifdef DEBUG
     // Check the total number of bodies
     int64_t checknparticles = tree_.tree_entities().size();
@@ -276,16 +349,21 @@ if(!(param::periodic_boundary_x || param::periodic_boundary_y ||
     MPI_SUM,MPI_COMM_WORLD);
     assert(checknparticles==totalnbodies_);
 #endif
-}
     //tree_.mpi_tree_traversal_graphviz(0);
     // Add edge bodies from my direct neighbor
-    tree_.share_edge();
+    {
+      timers::scoped_timer timer("update_iteration/share_edge");
+      tree_.share_edge();
+    }
 
 #ifdef OUTPUT_TREE_INFO
     clog_one(trace) << "Computing branches"<<std::endl;
 #endif
 
-    tree_.cofm(tree_.root(),epsilon_,false);
+    {
+      timers::scoped_timer timer("update_iteration/cofm");
+      tree_.cofm(tree_.root(),epsilon_,false);
+    }
     //tree_.mpi_tree_traversal_graphviz(1);
 
 #ifdef OUTPUT_TREE_INFO
@@ -315,11 +393,18 @@ if(!(param::periodic_boundary_x || param::periodic_boundary_y ||
 #endif
 
     // Exchnage usefull body_holder from my tree to other processes
-    tcolorer_.mpi_branches_exchange(tree_,tree_.entities(),rangeposproc_,
-      range_);
+    {
+      timers::scoped_timer timer("update_iteration/branches_exchange");
+      tcolorer_.mpi_branches_exchange(tree_,tree_.entities(),rangeposproc_,
+        range_);
+    }
 
     // update the tree
-    tree_.cofm(tree_.root(),epsilon_,false);
+    {
+      timers::scoped_timer timer("update_iteration/cofm");
+      tree_.cofm(tree_.root(),epsilon_,false);
+    }
+    tree_.set_search_factor(1.,0.);
     //tree_.mpi_tree_traversal_graphviz(2);
 
     MPI_Barrier(MPI_COMM_WORLD);
@@ -410,6 +495,115 @@ if(!(param::periodic_boundary_x || param::periodic_boundary_y ||
         std::forward<ARGS>(args)...);
   }
 
+  /**
+   * @brief      Density traversal for variable smoothing length: EF solves
+   *             the smoothing length of each particle from a list of
+   *             candidates in an enlarged radius, sph_h_search_factor*h.
+   *             The particles that did not converge inside their
+   *             candidates radius are searched again with their new
+   *             smoothing length, at most sph_h_max_passes times. These
+   *             passes only traverse the work branches holding such
+   *             particles.
+   *
+   * @param[in]  ef    The function bool ef(particle,nbs,h) returning true
+   *                   if h converged
+   * @param[in]  df    The density function df(particle,nbs) at fixed h.
+   *                   After the last pass, it recomputes the particles
+   *                   converged in the previous passes, whose density
+   *                   used the smoothing length their neighbors had then.
+   *                   As with a single pass, the particles converged in
+   *                   the last pass keep the neighbors h of that pass.
+   */
+  template<
+    typename EF,
+    typename DF
+  >
+  void apply_in_smoothinglength_variable_h(
+      EF&& ef,
+      DF&& df)
+  {
+    const int64_t nelem = tree_.entities().size();
+    const body* first = tree_.entities().data();
+    std::vector<double> h_new(nelem);
+    // Pass in which the particle converged, 0 if not yet
+    std::vector<int> done(nelem,0);
+
+    // Largest smoothing length used for the distant branches boxes
+    const double hmax_tree = getSmoothinglength();
+    double hmax = hmax_tree;
+    int64_t nremaining = totalnbodies_;
+    int pass = 0;
+    while(pass < param::sph_h_max_passes && nremaining > 0){
+      ++pass;
+      tree_.set_search_factor(param::sph_h_search_factor,
+        param::sph_h_search_factor*hmax-hmax_tree);
+      tree_.traversal_sph_selected(tree_.root(),
+        [&](const body& particle){ return !done[&particle - first]; },
+        [&](body& particle, std::vector<body*>& nbs)
+        {
+          const int64_t i = &particle - first;
+          if(ef(particle,nbs,h_new[i]))
+            done[i] = pass;
+        });
+
+      // Update the smoothing length and share it for the next traversals
+      nremaining = 0;
+      #pragma omp parallel for reduction(+:nremaining)
+      for(int64_t i = 0; i < nelem; ++i){
+        tree_.entities()[i].set_radius(h_new[i]);
+        nremaining += !done[i];
+      }
+      MPI_Allreduce(MPI_IN_PLACE,&nremaining,1,MPI_INT64_T,MPI_SUM,
+        MPI_COMM_WORLD);
+      tree_.reset_ghosts();
+      tree_.update_h();
+      hmax = getSmoothinglength();
+    }
+    // Regular search, but keep the boxes margin for the distant branches
+    tree_.set_search_factor(1.,std::max(0.,hmax-hmax_tree));
+
+    // Density of the particles converged before the last pass with the
+    // final smoothing lengths
+    if(pass > 1){
+      tree_.traversal_sph_selected(tree_.root(),
+        [&](const body& particle){
+          const int d = done[&particle - first];
+          return d > 0 && d < pass;
+        },
+        std::forward<DF>(df));
+      tree_.reset_ghosts();
+    }
+
+    clog_one(trace)<<"h-rho solve: "<<pass<<" passes, "<<nremaining
+      <<" particles not converged"<<std::endl;
+  }
+
+  /**
+   * @brief      Symmetric version of apply_in_smoothinglength: each pair
+   *             of particles is computed once and the contributions are
+   *             scattered to both particles.
+   *
+   * @param[in]  pf    The pair function pf(a,b,acc_a,acc_b)
+   * @param[in]  ff    The function ff(a,acc_a) applied to each local
+   *                   particle with its total contribution
+   *
+   * @tparam     ACC   The type of the contributions, e.g. double or point_t
+   */
+  template<
+    typename ACC,
+    typename PF,
+    typename FF
+  >
+  void apply_in_smoothinglength_symmetric(
+      PF&& pf,
+      FF&& ff)
+  {
+    tree_.template traversal_sph_symmetric<ACC>(
+        tree_.root(),
+        std::forward<PF>(pf),
+        std::forward<FF>(ff));
+  }
+
   /**
    * @brief      Apply a function to all the particles.
    *
@@ -434,6 +628,28 @@ if(!(param::periodic_boundary_x || param::periodic_boundary_y ||
     }
   }
 
+  /**
+   * @brief      Apply several functions to all the particles in one sweep.
+   *             Each particle goes through the functions in order: this is
+   *             apply_all of each function in turn, as long as a function
+   *             only reads the fields of its own particle.
+   *
+   * @tparam     EF    The functions to apply to all particles
+   */
+  template<
+    typename... EF
+  >
+  void apply_all_fused(
+      EF&&... efs)
+  {
+    int64_t nelem = tree_.entities().size();
+    #pragma omp parallel for
+    for(int64_t i=0; i<nelem; ++i){
+      auto& particle = tree_.entities()[i];
+      (efs(particle), ...);
+    }
+  }
+
   /**
    * @brief      Apply a function on the vector of local bodies
    *
@@ -490,6 +706,24 @@ if(!(param::periodic_boundary_x || param::periodic_boundary_y ||
     return tree_.entities();
   };
 
+  /**
+   * @brief      Replace the local bodies of this process, for particles
+   *             generated in memory instead of read from a file.
+   *             Collective: computes the total number of bodies.
+   *
+   * @param[in]  bodies  The new local bodies
+   */
+  void
+  setLocalbodies(
+    std::vector<body>&& bodies)
+  {
+    tree_.entities() = std::move(bodies);
+    localnbodies_ = tree_.entities().size();
+    totalnbodies_ = localnbodies_;
+    MPI_Allreduce(MPI_IN_PLACE,&totalnbodies_,1,MPI_INT64_T,MPI_SUM,
+      MPI_COMM_WORLD);
+  }
+
   /**
    * @ brief return the number of local bodies
    */
@@ -518,6 +752,7 @@ private:
   tree_colorer<T,D> tcolorer_;
   tree_topology_t tree_;     // The particle tree data structure
   double epsilon_ = 0.;
+  std::unique_ptr<io::async_writer> writer_; // Background output
 };
 
 #endif
@@ -31,6 +31,17 @@
 #include <vector>
 #include <dirent.h>
 #include <libgen.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <set>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
 
 #include "params.h"
 #include "default_physics.h"
@@ -47,6 +58,10 @@ hid_t IO_group_id; // Group id to keep track of the current step
 // Data for hyperslab
 hsize_t IO_offset;
 hsize_t IO_count;
+// Data for points selection, the particles of the process are not
+// contiguous in the file for the key-sorted read
+bool IO_use_points = false;
+std::vector<hsize_t> IO_points;
 static int output_step = 0;
 const int MAX_FNAME_LEN = 256;
 // TODO: overload ostream instead, i.e.smth like, clog_exit << "ERROR!"
@@ -57,6 +72,9 @@ int64_t IO_nparticles;
 
 MPI_Comm comm_ = MPI_COMM_WORLD;
 
+// Wait for the snapshots queued in the async writers, defined with them
+void wait_writes();
+
 template<
   typename T>
 hid_t
@@ -79,9 +97,11 @@ H5P_getType(T* data)
 }
 
 hid_t
-H5P_openFile(const char * filename,	unsigned int flags )
+H5P_openFile(
+  const char * filename,
+  unsigned int flags,
+  MPI_Comm comm = comm_)
 {
-  MPI_Comm comm  = comm_;
   MPI_Info info  = MPI_INFO_NULL;
   /* Set up file access property list with parallel I/O access */
   hid_t plist_id = H5Pcreate(H5P_FILE_ACCESS);
@@ -117,43 +137,250 @@ H5P_hasStep(hid_t& file_id, size_t step)
   return !(stat); // true if found (stat==0), false if not
 }
 
-void
-H5P_setStep(
+/**
+ * @brief Open or create the group of a step
+ */
+hid_t
+H5P_openStep(
   hid_t& file_id,
   size_t step
 )
 {
   char cstep[255];
   sprintf(cstep,"/Step#%lu",step);
-  hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
-  H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_COLLECTIVE);
-  if(H5P_hasStep(file_id,step)){
-    IO_group_id = H5Gopen(file_id, cstep, H5P_DEFAULT );
+  if(H5P_hasStep(file_id,step))
+    return H5Gopen(file_id, cstep, H5P_DEFAULT );
+  return H5Gcreate(file_id, cstep, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+}
+
+void
+H5P_setStep(
+  hid_t& file_id,
+  size_t step
+)
+{
+  IO_group_id = H5P_openStep(file_id,step);
+}
+
+/**
+ * @brief Name of the step index dataset at the root of single-file outputs.
+ * One row per step: iteration, time and total number of particles.
+ */
+const char* STEP_INDEX_NAME = "StepIndex";
+const int STEP_INDEX_COLUMNS = 3;
+
+/**
+ * @brief Set the row of a step in the step index, collective.
+ * The index is resized to step+1 rows, so rewriting a step after a
+ * restart drops the rows of the following steps.
+ */
+void
+H5P_writeStepIndex(
+  hid_t& file_id,
+  size_t step,
+  int64_t iteration,
+  double time,
+  int64_t nparticles,
+  MPI_Comm comm = comm_)
+{
+  int rank;
+  MPI_Comm_rank(comm,&rank);
+
+  hsize_t dims[2] = {step+1,STEP_INDEX_COLUMNS};
+  hid_t dset_id;
+  if(H5Lexists(file_id,STEP_INDEX_NAME,H5P_DEFAULT) > 0){
+    dset_id = H5Dopen(file_id,STEP_INDEX_NAME,H5P_DEFAULT);
+    H5Dset_extent(dset_id,dims);
+  }else{
+    hsize_t maxdims[2] = {H5S_UNLIMITED,STEP_INDEX_COLUMNS};
+    hsize_t chunk[2] = {256,STEP_INDEX_COLUMNS};
+    hid_t filespace = H5Screate_simple(2,dims,maxdims);
+    hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(dcpl_id,2,chunk);
+    dset_id = H5Dcreate(file_id,STEP_INDEX_NAME,H5T_NATIVE_DOUBLE,
+      filespace,H5P_DEFAULT,dcpl_id,H5P_DEFAULT);
+    H5Pclose(dcpl_id);
+    H5Sclose(filespace);
+  }
+
+  // Only rank 0 provides the row
+  double row[STEP_INDEX_COLUMNS] = {(double)iteration,time,
+    (double)nparticles};
+  hsize_t offset[2] = {step,0};
+  hsize_t count[2] = {1,STEP_INDEX_COLUMNS};
+  hid_t memspace = H5Screate_simple(2,count,NULL);
+  hid_t dataspace = H5Dget_space(dset_id);
+  if(rank == 0){
+    H5Sselect_hyperslab(dataspace,H5S_SELECT_SET,offset,NULL,count,NULL);
   }else{
-    IO_group_id = H5Gcreate(file_id, cstep, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    H5Sselect_none(memspace);
+    H5Sselect_none(dataspace);
   }
+  hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
+  H5Pset_dxpl_mpio(plist_id, H5FD_MPIO_COLLECTIVE);
+  H5Dwrite(dset_id,H5T_NATIVE_DOUBLE,memspace,dataspace,plist_id,row);
+
   H5Pclose(plist_id);
+  H5Sclose(memspace);
+  H5Sclose(dataspace);
+  H5Dclose(dset_id);
+}
+
+/**
+ * @brief Iteration of a step from its attribute, independent read
+ */
+int64_t
+H5P_readStepIteration(
+  hid_t& file_id,
+  size_t step)
+{
+  char cstep[255];
+  sprintf(cstep,"/Step#%lu",step);
+  int64_t iteration = -1;
+  hid_t group_id = H5Gopen(file_id,cstep,H5P_DEFAULT);
+  hid_t att_id = H5Aopen(group_id,"iteration",H5P_DEFAULT);
+  H5Aread(att_id,H5T_NATIVE_INT64,&iteration);
+  H5Aclose(att_id);
+  H5Gclose(group_id);
+  return iteration;
+}
+
+/**
+ * @brief Find the step of an iteration in a single-file output.
+ * Rank 0 reads the step index and broadcasts the result. Files written
+ * without index have consecutive steps with increasing iterations: the
+ * number of steps and then the step are found by binary search.
+ *
+ * @return The step, -1 if the iteration is not in the file
+ */
+int64_t
+H5P_findIterationStep(
+  hid_t& file_id,
+  int64_t iteration)
+{
+  int rank;
+  MPI_Comm_rank(comm_,&rank);
+
+  int64_t step = -1;
+  if(rank == 0){
+    H5Eset_auto(H5E_DEFAULT, NULL, NULL);
+    if(H5Lexists(file_id,STEP_INDEX_NAME,H5P_DEFAULT) > 0){
+      hid_t dset_id = H5Dopen(file_id,STEP_INDEX_NAME,H5P_DEFAULT);
+      hid_t dataspace = H5Dget_space(dset_id);
+      hsize_t dims[2];
+      H5Sget_simple_extent_dims(dataspace,dims,NULL);
+      std::vector<double> index(dims[0]*dims[1]);
+      H5Dread(dset_id,H5T_NATIVE_DOUBLE,H5S_ALL,H5S_ALL,H5P_DEFAULT,
+        index.data());
+      H5Sclose(dataspace);
+      H5Dclose(dset_id);
+      for(size_t i = 0; i < dims[0]; ++i)
+        if((int64_t)index[i*dims[1]] == iteration){
+          step = i;
+          break;
+        }
+    }else{
+      // Legacy file: bound the number of steps, then bisect on iteration
+      int64_t nsteps = 1;
+      while(H5P_hasStep(file_id,nsteps))
+        nsteps *= 2;
+      int64_t lo = nsteps/2, hi = nsteps;
+      while(hi - lo > 1){
+        int64_t mid = lo + (hi-lo)/2;
+        if(H5P_hasStep(file_id,mid)) lo = mid; else hi = mid;
+      }
+      nsteps = H5P_hasStep(file_id,0) ? lo+1 : 0;
+      lo = 0; hi = nsteps;
+      while(lo < hi){
+        int64_t mid = lo + (hi-lo)/2;
+        if(H5P_readStepIteration(file_id,mid) < iteration)
+          lo = mid+1;
+        else
+          hi = mid;
+      }
+      if(lo < nsteps && H5P_readStepIteration(file_id,lo) == iteration)
+        step = lo;
+    }
+  }
+  MPI_Bcast(&step,1,MPI_INT64_T,0,comm_);
+  return step;
+}
+
+/**
+ * @brief Number of steps of a single-file output, i.e. the last step + 1.
+ * Rank 0 reads the rows of the step index and broadcasts it. Files
+ * written without index are probed step by step from first.
+ */
+int64_t
+H5P_countSteps(
+  hid_t& file_id,
+  int64_t first)
+{
+  int rank;
+  MPI_Comm_rank(comm_,&rank);
+
+  int64_t nsteps = first;
+  if(rank == 0){
+    H5Eset_auto(H5E_DEFAULT, NULL, NULL);
+    if(H5Lexists(file_id,STEP_INDEX_NAME,H5P_DEFAULT) > 0){
+      hid_t dset_id = H5Dopen(file_id,STEP_INDEX_NAME,H5P_DEFAULT);
+      hid_t dataspace = H5Dget_space(dset_id);
+      hsize_t dims[2];
+      H5Sget_simple_extent_dims(dataspace,dims,NULL);
+      nsteps = dims[0];
+      H5Sclose(dataspace);
+      H5Dclose(dset_id);
+    }else{
+      // Legacy file
+      while(H5P_hasStep(file_id,nsteps))
+        ++nsteps;
+    }
+  }
+  MPI_Bcast(&nsteps,1,MPI_INT64_T,0,comm_);
+  return nsteps;
 }
 
+/**
+ * @brief Collective write of the slab [offset,offset+dim) of a particles
+ * dataset of total elements in the group group_id
+ *
+ * @param single_precision Store the double data as float in the file
+ * @param chunk Chunk size in number of elements, 0 for contiguous
+ * @param compression Deflate level for the chunked datasets, 0 for none
+ */
 template<
   typename T>
 hid_t
-H5P_writeDataset(
-  hid_t& file_id,
+H5P_writeDatasetSlab(
+  hid_t group_id,
   const char * dsname,
   T* data,
-  size_t dim = IO_nparticlesproc)
+  hsize_t offset,
+  hsize_t dim,
+  hsize_t total,
+  bool single_precision = false,
+  hsize_t chunk = 0,
+  int compression = 0)
 {
 
   hid_t type = H5P_getType(data);
+  hid_t filetype = type;
+  if(single_precision && type == H5T_NATIVE_DOUBLE)
+    filetype = H5T_NATIVE_FLOAT;
 
   hid_t status = 1;
-  hsize_t hdim = dim;
   /* Create the dataspace for the dataset.*/
-  hsize_t total = IO_nparticles;
   hid_t filespace = H5Screate_simple(1, &total, NULL);
-  hid_t dset_id = H5Dcreate(IO_group_id, dsname, type, filespace,
-    H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+  hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
+  chunk = std::min(chunk,total);
+  if(chunk > 0){
+    H5Pset_chunk(dcpl_id, 1, &chunk);
+    if(compression > 0)
+      H5Pset_deflate(dcpl_id, compression);
+  }
+  hid_t dset_id = H5Dcreate(group_id, dsname, filetype, filespace,
+    H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+  H5Pclose(dcpl_id);
   H5Sclose(filespace);
 
   hsize_t offset_in = 0;
@@ -162,7 +389,7 @@ H5P_writeDataset(
 
   // Select the hyperslab
   hid_t dataspace = H5Dget_space(dset_id);
-  H5Sselect_hyperslab(dataspace, H5S_SELECT_SET, &IO_offset, NULL, &IO_count, NULL);
+  H5Sselect_hyperslab(dataspace, H5S_SELECT_SET, &offset, NULL, &dim, NULL);
 
   /*Create property list for collective dataset write.*/
   hid_t plist_id = H5Pcreate(H5P_DATASET_XFER);
@@ -179,6 +406,26 @@ H5P_writeDataset(
   return status;
 }
 
+/**
+ * @brief Collective write of the local slab of a particles dataset in the
+ * current step, set by H5P_setStep and H5P_setNumParticles
+ */
+template<
+  typename T>
+hid_t
+H5P_writeDataset(
+  hid_t& file_id,
+  const char * dsname,
+  T* data,
+  size_t dim = IO_nparticlesproc,
+  bool single_precision = false,
+  hsize_t chunk = 0,
+  int compression = 0)
+{
+  return H5P_writeDatasetSlab(IO_group_id,dsname,data,IO_offset,dim,
+    IO_nparticles,single_precision,chunk,compression);
+}
+
 template<
   typename T>
 hid_t
@@ -304,9 +551,18 @@ H5P_readDataset(
   status = H5Sselect_hyperslab(memspace, H5S_SELECT_SET, &offset_out, NULL,
      &count_out, NULL);
 
-  // Select the hyperslab
+  // Select the hyperslab or the points of this process
   hid_t dataspace = H5Dget_space(dset_id);
-  H5Sselect_hyperslab(dataspace, H5S_SELECT_SET, &IO_offset, NULL, &IO_count, NULL);
+  if(!IO_use_points){
+    H5Sselect_hyperslab(dataspace, H5S_SELECT_SET, &IO_offset, NULL,
+      &IO_count, NULL);
+  }else if(!IO_points.empty()){
+    H5Sselect_elements(dataspace, H5S_SELECT_SET, IO_points.size(),
+      IO_points.data());
+  }else{
+    H5Sselect_none(memspace);
+    H5Sselect_none(dataspace);
+  }
 
   status = H5Dread(dset_id, type, memspace, dataspace,
         plist_id, data);
@@ -362,9 +618,9 @@ void H5P_bodiesReadDataset(
       rank|| clog(trace)<<"Setting ID for particles"<<std::endl;
       int64_t start = (IO_nparticles/size)*rank+1;
       for(int64_t i=0; i<IO_nparticlesproc; ++i){
-        bodies[i].set_id(start+i);
+        bodies[i].set_id(IO_use_points?IO_points[i]+1:start+i);
       }
-      if(rank == size - 1) // last rank
+      if(rank == size - 1 && !IO_use_points) // last rank
         assert(IO_nparticles == bodies.back().id());
     }
   }
@@ -661,6 +917,7 @@ int H5P_removePrefix(const char * output_file_prefix,
 
 
 // Input data fro HDF5 File
+// With a partition function, the particles are read already distributed
 void inputDataHDF5(
   std::vector<body>& bodies,
   const char * input_file_prefix,
@@ -668,9 +925,13 @@ void inputDataHDF5(
   int64_t& totalnbodies,
   int64_t& nbodies,
   int startIteration,
-  MPI_Comm comm = MPI_COMM_WORLD)
+  MPI_Comm comm = MPI_COMM_WORLD,
+  std::function<void(std::vector<body>&,std::vector<int64_t>&)>
+    partition = nullptr)
 {
 
+  // HDF5 is not thread safe: no write in flight while reading
+  wait_writes();
   comm_ = comm;
   char input_filename[MAX_FNAME_LEN];
 
@@ -706,26 +967,10 @@ void inputDataHDF5(
 
     if (input_single_file) {  // --- single-file mode --- 
 
-      // Go through all the steps in a single file
+      // Find the step in the index of the file
       dataFile = H5P_openFile(input_filename,H5F_ACC_RDONLY);
-
-      // TODO: this loop better run over all timesteps
-      const int64_t maxstep = 1000000;
-      int64_t step;
-      for (step= 0; step<maxstep; ++step) {
-        if (H5P_hasStep(dataFile,step)) {
-          // Check iteration number
-          H5P_setStep(dataFile,step);
-          int64_t iteration;
-          if(0 != H5P_readAttributeStep(dataFile,"iteration",&iteration)){
-            clog_one(error)<<"Cannot find attribute 'iteration' in Step#"
-              <<step<<" in file "<< input_filename <<std::endl; FULLSTOP;
-          }
-          if(iteration == startIteration) 
-            break;
-        }
-      }
-      if(step == maxstep) {
+      int64_t step = H5P_findIterationStep(dataFile,startIteration);
+      if(step < 0) {
         clog_one(error)<<"Cannot find iteration "<<startIteration<<" in "
           <<input_filename<<std::endl; FULLSTOP;
       }
@@ -792,9 +1037,7 @@ void inputDataHDF5(
       hid_t outputFile = H5P_openFile(output_filename,H5F_ACC_RDONLY);
       H5P_setStep(outputFile,startStep);
       // Check if startStep == lastStep
-      int lastStep = startStep;
-      while(H5P_hasStep(outputFile,lastStep)){lastStep++;}
-      --lastStep;
+      int lastStep = H5P_countSteps(outputFile,startStep)-1;
       clog_one(trace)<<"startStep: "<<startStep<<" lastStep: "
         <<lastStep<<std::endl;
       if(startStep != lastStep){
@@ -830,6 +1073,27 @@ void inputDataHDF5(
 
   H5P_setNumParticles(nparticlesproc);
 
+  //--------------- KEY-SORTED PARTITION --------------------------------------
+  // Only read the positions and smoothing lengths of the slab, the
+  // partition callback returns the file indices of the particles of this
+  // process, which are then read directly
+  if(partition){
+    bodies.clear();
+    bodies.resize(IO_nparticlesproc);
+    std::vector<double> data(IO_nparticlesproc*gdimension);
+    H5P_bodiesReadDataset(bodies,dataFile,"x",data.data());
+    H5P_bodiesReadDataset(bodies,dataFile,"h",data.data());
+    for(int64_t i = 0; i < IO_nparticlesproc; ++i)
+      bodies[i].set_id(IO_offset+i);
+
+    std::vector<int64_t> indices;
+    partition(bodies,indices);
+    std::sort(indices.begin(),indices.end());
+    IO_points.assign(indices.begin(),indices.end());
+    IO_use_points = true;
+    IO_nparticlesproc = IO_points.size();
+  }
+
   // Register for main
   totalnbodies = nparticles;
   nbodies = IO_nparticlesproc;
@@ -890,6 +1154,9 @@ void inputDataHDF5(
   delete[] dataInt;
   delete[] dataInt32;
 
+  IO_use_points = false;
+  IO_points.clear();
+
   MPI_Barrier(comm_);
   H5Fclose(dataFile);
   //H5CloseFile(dataFile);
@@ -899,177 +1166,645 @@ void inputDataHDF5(
 
 }// inputDataHDF5
 
-// Output data in HDF5 format
-// Generate the associate XDMF file
-void outputDataHDF5(
+/**
+ * @brief Return true if the field is written in the particles output.
+ * The list is given by the parameter out_h5data_fields, comma separated.
+ * "x", "v" and "a" select the position, velocity and acceleration
+ * components for the problem dimension only. "all" is the default set:
+ * x,v,a,h,rho,P,m,dt,id,type and u with INTERNAL_ENERGY. "rank" and
+ * "key" are only written in DEBUG mode.
+ */
+bool
+H5P_isOutputField(
+  const std::string& field)
+{
+  static const std::set<std::string> fields = []{
+    std::set<std::string> f;
+    std::string list = param::out_h5data_fields;
+    list.erase(std::remove(list.begin(),list.end(),' '),list.end());
+    std::istringstream iss(list);
+    std::string token;
+    while(std::getline(iss,token,','))
+      if(!token.empty())
+        f.insert(token);
+    if(f.count("all")){
+      f.insert({"x","v","a","h","rho","P","m","dt","id","type"});
+#ifdef INTERNAL_ENERGY
+      f.insert("u");
+#endif
+    }
+    return f;
+  }();
+#ifndef INTERNAL_ENERGY
+  if(field == "u")
+    return false;
+#endif
+  if(field == "rank" || field == "key")
+#ifdef DEBUG
+    return true;
+#else
+    return false;
+#endif
+  return fields.count(field) > 0;
+}
+
+/**
+ * @brief Particles data of one output step, extracted from the bodies.
+ * Written synchronously by outputDataHDF5 or by the async_writer thread.
+ */
+struct snapshot_t{
+  char filename[MAX_FNAME_LEN];
+  int step;
+  int64_t iteration;
+  double totaltime;
+  double timestep;
+  int64_t nparticles;
+  std::vector<double> x, y, z, vx, vy, vz, ax, ay, az;
+  std::vector<double> h, rho, u, P, m, dt;
+  std::vector<int64_t> id, key;
+  std::vector<int32_t> type;
+};
+
+/**
+ * @brief Copy the output fields of the bodies in the snapshot staging
+ * buffers. The buffers capacity is kept if the snapshot is reused.
+ */
+void stageSnapshot(
     std::vector<body>& bodies,
     const char* fileprefix,
     int64_t iteration,
     double totaltime,
-    MPI_Comm comm = MPI_COMM_WORLD)
+    snapshot_t& snap)
 {
+  snap.step = output_step++;
+  if (param::out_h5data_separate_iterations)
+    sprintf(snap.filename,"%s_%05d.h5part",fileprefix,snap.step);
+  else
+    sprintf(snap.filename,"%s.h5part",fileprefix);
+  snap.iteration = iteration;
+  snap.totaltime = totaltime;
+  snap.timestep = physics::dt;
+
+  const int64_t n = bodies.size();
+  // Only stage the selected fields
+  const bool out_x = H5P_isOutputField("x");
+  const bool out_v = H5P_isOutputField("v");
+  const bool out_a = H5P_isOutputField("a");
+  std::vector<std::pair<std::vector<double>*,bool>> buffers = {
+    {&snap.x,out_x},{&snap.y,out_x && gdimension>1},
+    {&snap.z,out_x && gdimension>2},
+    {&snap.vx,out_v},{&snap.vy,out_v && gdimension>1},
+    {&snap.vz,out_v && gdimension>2},
+    {&snap.ax,out_a},{&snap.ay,out_a && gdimension>1},
+    {&snap.az,out_a && gdimension>2},
+    {&snap.h,H5P_isOutputField("h")},{&snap.rho,H5P_isOutputField("rho")},
+    {&snap.u,H5P_isOutputField("u")},{&snap.P,H5P_isOutputField("P")},
+    {&snap.m,H5P_isOutputField("m")},{&snap.dt,H5P_isOutputField("dt")}};
+  for(auto& b: buffers)
+    b.first->resize(b.second?n:0);
+  snap.id.resize(H5P_isOutputField("id")?n:0);
+  snap.type.resize(H5P_isOutputField("type")?n:0);
+  snap.key.resize(H5P_isOutputField("key")?n:0);
+  snap.nparticles = n;
+
+  #pragma omp parallel for
+  for(int64_t i = 0; i < n; ++i){
+    body& b = bodies[i];
+    for(size_t d = 0; d < gdimension; ++d){
+      if(out_x) (d==0?snap.x:d==1?snap.y:snap.z)[i] = b.coordinates()[d];
+      if(out_v) (d==0?snap.vx:d==1?snap.vy:snap.vz)[i] = b.getVelocity()[d];
+      if(out_a) (d==0?snap.ax:d==1?snap.ay:snap.az)[i] =
+        b.getAcceleration()[d];
+    }
+    if(!snap.h.empty())   snap.h[i]   = b.radius();
+    if(!snap.rho.empty()) snap.rho[i] = b.getDensity();
+#ifdef INTERNAL_ENERGY
+    if(!snap.u.empty())   snap.u[i]   = b.getInternalenergy();
+#endif
+    if(!snap.P.empty())   snap.P[i]   = b.getPressure();
+    if(!snap.m.empty())   snap.m[i]   = b.mass();
+    if(!snap.dt.empty())  snap.dt[i]  = b.getDt();
+    if(!snap.id.empty())  snap.id[i]  = b.id();
+    if(!snap.type.empty()) snap.type[i] = b.getType();
+    if(!snap.key.empty()) snap.key[i] = b.key().value_();
+  }
+}
 
-  comm_ = comm;
-  int step = output_step++;
-
+/**
+ * @brief Write a staged snapshot in the H5part file, collective on comm.
+ * The slab of the rank and the step group are local: the io globals
+ * (comm_, IO_group_id, IO_offset...) are not used, the async_writer
+ * thread calls it.
+ */
+void writeSnapshotHDF5(
+    snapshot_t& snap,
+    MPI_Comm comm)
+{
   int size, rank;
-  MPI_Comm_size(comm_,&size);
-  MPI_Comm_rank(comm_,&rank);
-
-  MPI_Barrier(comm_);
-  clog_one(trace)<<"Output particles"<<std::flush;
-
-  char filename[128];
-  if (param::out_h5data_separate_iterations)
-    sprintf(filename,"%s_%05d.h5part",fileprefix,step);
-  else 
-    sprintf(filename,"%s.h5part",fileprefix);
+  MPI_Comm_size(comm,&size);
+  MPI_Comm_rank(comm,&rank);
 
   // Wait for removing the file before writing in
-  MPI_Barrier(comm_);
+  MPI_Barrier(comm);
   // Check if file exists
-  hid_t dataFile = H5P_openFile(filename,H5F_ACC_RDWR);
+  hid_t dataFile = H5P_openFile(snap.filename,H5F_ACC_RDWR,comm);
 
   //-------------------GLOBAL HEADER-------------------------------------------
   // Only for the first output
-  if (step == 0 or param::out_h5data_separate_iterations) {
+  if (snap.step == 0 or param::out_h5data_separate_iterations) {
     int gdimension32 = gdimension;
     H5P_writeAttribute(dataFile,"dimension",&gdimension32);
   }
 
   //------------------STEP HEADER----------------------------------------------
   // Put the step header
-  H5P_setStep(dataFile,step);
-  H5P_writeAttributeStep(dataFile,"time",&physics::totaltime);
-  H5P_writeAttributeStep(dataFile,"iteration",&iteration);
-  H5P_writeAttributeStep(dataFile,"timestep",&physics::dt);
+  hid_t group_id = H5P_openStep(dataFile,snap.step);
+  H5P_writeAttribute(group_id,"time",&snap.totaltime);
+  H5P_writeAttribute(group_id,"iteration",&snap.iteration);
+  H5P_writeAttribute(group_id,"timestep",&snap.timestep);
   //------------------STEP DATA------------------------------------------------
 
-  H5P_setNumParticles(bodies.size());
-
-  // 4 buffers, 3 double and 1 int64
-  double* b1 = new double[IO_nparticlesproc];
-  double* b2 = new double[IO_nparticlesproc];
-  double* b3 = new double[IO_nparticlesproc];
-  int64_t* bi = new int64_t[IO_nparticlesproc];
-  int32_t* bint = new int32_t[IO_nparticlesproc];
-
-  // Position
-  int64_t pos = 0L;
-  // Extract data from bodies
-  for(auto bi: bodies){
-    b1[pos] = bi.coordinates()[0];
-    if(gdimension>1){
-      b2[pos] = bi.coordinates()[1];
-    }else{
-      b2[pos] = 0.;
-    }
-    if(gdimension>2){
-      b3[pos++] = bi.coordinates()[2];
-    }else{
-      b3[pos++] = 0.;
-    }
+  // Slab of this rank in the datasets
+  int64_t offset = 0, total = 0;
+  MPI_Exscan(&snap.nparticles,&offset,1,MPI_INT64_T,MPI_SUM,comm);
+  if(rank == 0)
+    offset = 0;
+  MPI_Allreduce(&snap.nparticles,&total,1,MPI_INT64_T,MPI_SUM,comm);
+  if(!param::out_h5data_separate_iterations)
+    H5P_writeStepIndex(dataFile,snap.step,snap.iteration,snap.totaltime,
+      total,comm);
+
+  // Write the selected fields, chunked and compressed if requested
+  const bool single = param::out_h5data_single_precision;
+  const hsize_t chunk = param::out_h5data_chunk_size;
+  const int compression = param::out_h5data_compression;
+  auto write = [&](const char* name, auto& buffer, const char* field){
+    if(H5P_isOutputField(field))
+      H5P_writeDatasetSlab(group_id,name,buffer.data(),offset,
+        snap.nparticles,total,single,chunk,compression);
+  };
+  const char* xyz[3] = {"x","y","z"};
+  const char* vxyz[3] = {"vx","vy","vz"};
+  const char* axyz[3] = {"ax","ay","az"};
+  std::vector<double>* pos[3] = {&snap.x,&snap.y,&snap.z};
+  std::vector<double>* vel[3] = {&snap.vx,&snap.vy,&snap.vz};
+  std::vector<double>* acc[3] = {&snap.ax,&snap.ay,&snap.az};
+  for(size_t d = 0; d < gdimension; ++d){
+    write(xyz[d],*pos[d],"x");
+    write(vxyz[d],*vel[d],"v");
+    write(axyz[d],*acc[d],"a");
   }
-  H5P_writeDataset(dataFile,"x",b1);
-  H5P_writeDataset(dataFile,"y",b2);
-  H5P_writeDataset(dataFile,"z",b3);
-
-
-  // Velocity
-  pos = 0L;
-  // Extract data from bodies
-  for(auto bi: bodies){
-    b1[pos] = bi.getVelocity()[0];
-    if(gdimension>1){
-      b2[pos] = bi.getVelocity()[1];
-    }else{
-      b2[pos] = 0;
-    }
-    if(gdimension>2){
-      b3[pos++] = bi.getVelocity()[2];
-    }else{
-      b3[pos++] = 0.;
-    }
+  write("h",snap.h,"h");
+  write("rho",snap.rho,"rho");
+  write("u",snap.u,"u");
+  write("P",snap.P,"P");
+  write("m",snap.m,"m");
+  write("dt",snap.dt,"dt");
+  write("id",snap.id,"id");
+  write("type",snap.type,"type");
+  write("key",snap.key,"key");
+
+  // Output the rank for analysis
+  if(H5P_isOutputField("rank")){
+    std::vector<int64_t> ranks(snap.nparticles,rank);
+    write("rank",ranks,"rank");
   }
-  H5P_writeDataset(dataFile,"vx",b1);
-  H5P_writeDataset(dataFile,"vy",b2);
-  H5P_writeDataset(dataFile,"vz",b3);
-
-  // Acceleration
-  pos = 0L;
-  // Extract data from bodies
-  for(auto bi: bodies){
-    b1[pos] = bi.getAcceleration()[0];
-    if(gdimension>1){
-      b2[pos] = bi.getAcceleration()[1];
-    }else{
-      b2[pos] = 0.;
+
+  H5Gclose(group_id);
+  H5Fclose(dataFile);
+}
+
+// Output data in HDF5 format
+// Generate the associate XDMF file
+void outputDataHDF5(
+    std::vector<body>& bodies,
+    const char* fileprefix,
+    int64_t iteration,
+    double totaltime,
+    MPI_Comm comm = MPI_COMM_WORLD)
+{
+  clog_one(trace)<<"Output particles"<<std::flush;
+
+  // The snapshots in flight are written before this one
+  wait_writes();
+  snapshot_t snap;
+  stageSnapshot(bodies,fileprefix,iteration,totaltime,snap);
+  writeSnapshotHDF5(snap,comm);
+
+  clog_one(trace)<<".done"<<std::endl;
+}// outputDataHDF5
+
+/**
+ * @brief Background writer for the particles output.
+ * @details push copies the output fields in a free staging snapshot and
+ * returns, a dedicated thread writes the snapshots in order on a
+ * duplicated communicator. At most max_pending snapshots are in flight,
+ * push blocks until a staging buffer is free (back-pressure).
+ * All the ranks have to push the same snapshots in the same order, the
+ * writes are collective.
+ * HDF5 is not thread safe: the other HDF5 uses of the main thread are
+ * preceded by wait_writes(), which waits for the queued snapshots of the
+ * running writers.
+ */
+class async_writer{
+public:
+
+  async_writer(
+    size_t max_pending = 2)
+  : max_pending_(max_pending)
+  {
+    assert(max_pending_ > 0);
+  }
+
+  ~async_writer()
+  {
+    finish();
+  }
+
+  /**
+   * @brief Stage the bodies and queue them for the writer thread
+   */
+  void
+  push(
+    std::vector<body>& bodies,
+    const char* fileprefix,
+    int64_t iteration,
+    double totaltime)
+  {
+    if(!running_)
+      start();
+    std::unique_ptr<snapshot_t> snap;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      // Only block if all the staging buffers are in flight
+      cv_.wait(lock,[this]{return !free_.empty();});
+      snap = std::move(free_.back());
+      free_.pop_back();
     }
-    if(gdimension>2){
-      b3[pos++] = bi.getAcceleration()[2];
-    }else{
-      b3[pos++] = 0.;
+    stageSnapshot(bodies,fileprefix,iteration,totaltime,*snap);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_.push_back(std::move(snap));
     }
+    cv_.notify_all();
   }
-  H5P_writeDataset(dataFile,"ax",b1);
-  H5P_writeDataset(dataFile,"ay",b2);
-  H5P_writeDataset(dataFile,"az",b3);
-
-  // Smoothing length, Density, Internal Energy
-  pos = 0L;
-  // Extract data from bodies
-  for(auto bi: bodies){
-    b1[pos] = bi.radius();
-    b2[pos] = bi.getDensity();
-    #ifdef INTERNAL_ENERGY
-    b3[pos] = bi.getInternalenergy();
-    #endif
-    pos++;
+
+  /**
+   * @brief Wait until the queued snapshots are written, the writer thread
+   * keeps running
+   */
+  void
+  wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock,[this]{return pending_.empty() && !writing_;});
   }
-  H5P_writeDataset(dataFile,"h",b1);
-  H5P_writeDataset(dataFile,"rho",b2);
-#ifdef INTERNAL_ENERGY
-  H5P_writeDataset(dataFile,"u",b3);
-#endif
 
- // Pressure, Mass, Id, timestep
-  pos = 0L;
-  // Extract data from bodies
-  for(auto bid: bodies){
-    b1[pos] = bid.getPressure();
-    b2[pos] = bid.mass();
-    b3[pos] = bid.getDt();
-    bi[pos] = bid.id();
-    bint[pos++] = bid.getType();
+  /**
+   * @brief Wait for the queued snapshots and stop the writer thread
+   */
+  void
+  finish()
+  {
+    if(!running_)
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+    MPI_Comm_free(&comm_io_);
+    running_ = false;
+    auto& w = writers();
+    w.erase(std::find(w.begin(),w.end(),this));
   }
-  H5P_writeDataset(dataFile,"P",b1);
-  H5P_writeDataset(dataFile,"m",b2);
-  H5P_writeDataset(dataFile,"dt",b3);
-  H5P_writeDataset(dataFile,"id",bi);
-  H5P_writeDataset(dataFile,"type",bint);
 
-  // Output the rank for analysis
-  std::fill(bi,bi+IO_nparticlesproc,rank);
-  H5P_writeDataset(dataFile,"rank",bi);
+  /**
+   * @brief The running writers
+   */
+  static std::vector<async_writer*>&
+  writers()
+  {
+    static std::vector<async_writer*> w;
+    return w;
+  }
 
-  pos = 0L;
-  for(auto bid: bodies){
-    bi[pos++] = bid.key().value_();
+private:
+
+  void
+  start()
+  {
+    writers().push_back(this);
+    MPI_Comm_dup(MPI_COMM_WORLD,&comm_io_);
+    free_.clear();
+    for(size_t i = 0; i < max_pending_; ++i)
+      free_.emplace_back(new snapshot_t);
+    stop_ = false;
+    running_ = true;
+    thread_ = std::thread(&async_writer::run,this);
+  }
+
+  void
+  run()
+  {
+    while(true){
+      std::unique_ptr<snapshot_t> snap;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock,[this]{return stop_ || !pending_.empty();});
+        if(pending_.empty())
+          return;
+        snap = std::move(pending_.front());
+        pending_.pop_front();
+        writing_ = true;
+      }
+      writeSnapshotHDF5(*snap,comm_io_);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(std::move(snap));
+        writing_ = false;
+      }
+      cv_.notify_all();
+    }
   }
-  H5P_writeDataset(dataFile,"key",bi);
 
-  H5P_closeFile(dataFile);
+  size_t max_pending_;
+  bool running_ = false;
+  bool stop_ = false;
+  bool writing_ = false;
+  MPI_Comm comm_io_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<std::unique_ptr<snapshot_t>> free_;
+  std::deque<std::unique_ptr<snapshot_t>> pending_;
+}; // async_writer
+
+void
+wait_writes()
+{
+  for(auto w: async_writer::writers())
+    w->wait();
+}
 
-  delete[] b1;
-  delete[] b2;
-  delete[] b3;
-  delete[] bi;
-  delete[] bint;
+//----------------------------------------------------------------------------//
+// Native checkpoint/restart
+//----------------------------------------------------------------------------//
+
+/**
+ * @brief Header of the per-rank checkpoint files.
+ * The file is this header followed by the nbodies local bodies, as in
+ * memory. The ranks hold consecutive key ranges, so the concatenation of
+ * the files in rank order is the key-sorted particle system.
+ */
+struct checkpoint_header_t {
+  char magic[8];
+  int32_t version;
+  int32_t dimension;
+  int64_t body_size;
+  int32_t nranks;
+  int32_t rank;
+  int64_t nbodies;
+  int64_t totalnbodies;
+  int64_t offset;       // Global index of the first local body
+  int64_t iteration;
+  double totaltime;
+  double timestep;
+  int32_t output_step;
+  int32_t padding;
+  double range[2][3];   // Range of the particles at the checkpoint
+};
+
+const char CHECKPOINT_MAGIC[8] = "FSPHCKP";
+const int32_t CHECKPOINT_VERSION = 1;
 
+/**
+ * @brief Name of the checkpoint file of a rank for an iteration
+ */
+void
+checkpointFilename(
+  char* filename,
+  const char* prefix,
+  int64_t iteration,
+  int rank)
+{
+  sprintf(filename,"%s_ckpt%08ld.%05d",prefix,(long)iteration,rank);
+}
+
+/**
+ * @brief Read and check the header of a checkpoint file
+ *
+ * @return true if the file exists and is a checkpoint of this build
+ */
+bool
+readCheckpointHeader(
+  const char* filename,
+  checkpoint_header_t& header)
+{
+  FILE* f = fopen(filename,"rb");
+  if(f == nullptr)
+    return false;
+  size_t nread = fread(&header,sizeof(header),1,f);
+  fclose(f);
+  return nread == 1 &&
+    strncmp(header.magic,CHECKPOINT_MAGIC,8) == 0 &&
+    header.version == CHECKPOINT_VERSION &&
+    header.dimension == (int32_t)gdimension &&
+    header.body_size == (int64_t)sizeof(body);
+}
+
+/**
+ * @brief Read count bodies of a checkpoint file, from the body first,
+ * directly in the destination
+ *
+ * @return true if all the bodies were read
+ */
+bool
+readCheckpointBodies(
+  const char* filename,
+  int64_t first,
+  int64_t count,
+  body* bodies)
+{
+  FILE* f = fopen(filename,"rb");
+  if(f == nullptr)
+    return false;
+  bool ok = fseeko(f,sizeof(checkpoint_header_t)+first*sizeof(body),
+      SEEK_SET) == 0 &&
+    fread(bodies,sizeof(body),count,f) == (size_t)count;
+  fclose(f);
+  return ok;
+}
+
+/**
+ * @brief Write the local bodies and the run state in a per-rank binary
+ * file. No collective I/O, each rank writes one contiguous file.
+ *
+ * @param bodies   The local bodies, key-sorted after update_iteration
+ * @param prefix   Output prefix of the checkpoint files
+ * @param range    Range of the particles system
+ */
+template<
+  typename R>
+void
+outputCheckpoint(
+  std::vector<body>& bodies,
+  const char* prefix,
+  int64_t iteration,
+  double totaltime,
+  const R& range,
+  MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank, size;
+  MPI_Comm_size(comm,&size);
+  MPI_Comm_rank(comm,&rank);
+
+  clog_one(trace)<<"Output checkpoint"<<std::flush;
+
+  checkpoint_header_t header;
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic,CHECKPOINT_MAGIC,8);
+  header.version = CHECKPOINT_VERSION;
+  header.dimension = gdimension;
+  header.body_size = sizeof(body);
+  header.nranks = size;
+  header.rank = rank;
+  header.nbodies = bodies.size();
+  MPI_Exscan(&header.nbodies,&header.offset,1,MPI_INT64_T,MPI_SUM,comm);
+  if(rank == 0)
+    header.offset = 0;
+  MPI_Allreduce(&header.nbodies,&header.totalnbodies,1,MPI_INT64_T,
+    MPI_SUM,comm);
+  header.iteration = iteration;
+  header.totaltime = totaltime;
+  header.timestep = physics::dt;
+  header.output_step = output_step;
+  for(int i = 0; i < 2; ++i)
+    for(size_t d = 0; d < gdimension; ++d)
+      header.range[i][d] = range[i][d];
+
+  char filename[MAX_FNAME_LEN];
+  checkpointFilename(filename,prefix,iteration,rank);
+  FILE* f = fopen(filename,"wb");
+  if(f == nullptr ||
+    fwrite(&header,sizeof(header),1,f) != 1 ||
+    fwrite(bodies.data(),sizeof(body),bodies.size(),f) != bodies.size()){
+    clog(error)<<rank<<": cannot write checkpoint "<<filename<<std::endl;
+    FULLSTOP;
+  }
+  fclose(f);
+
+  // The checkpoint is complete only when all the ranks wrote their file
+  MPI_Barrier(comm);
   clog_one(trace)<<".done"<<std::endl;
+}
 
+/**
+ * @brief Restart from the per-rank checkpoint files of an iteration.
+ * With the same number of ranks each rank reads its own file and keeps
+ * its partition, the next update_iteration only moves the particles
+ * which changed owner. With a different number of ranks each rank takes
+ * a contiguous slice of the key-sorted particles from the files which
+ * overlap it.
+ *
+ * @param range  Set to the range of the particles at the checkpoint
+ * @return false if the checkpoint cannot be found
+ */
+template<
+  typename R>
+bool
+inputCheckpoint(
+  std::vector<body>& bodies,
+  const char* prefix,
+  int64_t iteration,
+  int64_t& totalnbodies,
+  int64_t& nbodies,
+  R& range,
+  MPI_Comm comm = MPI_COMM_WORLD)
+{
+  int rank, size;
+  MPI_Comm_size(comm,&size);
+  MPI_Comm_rank(comm,&rank);
+
+  clog_one(trace)<<"Input checkpoint"<<std::flush;
+
+  char filename[MAX_FNAME_LEN];
+  checkpoint_header_t header;
+  // Rank 0 header gives the layout of the checkpoint
+  checkpointFilename(filename,prefix,iteration,0);
+  int valid = rank == 0 ? readCheckpointHeader(filename,header) : 0;
+  MPI_Bcast(&valid,1,MPI_INT,0,comm);
+  if(!valid){
+    clog_one(warn)<<"No checkpoint for iteration "<<iteration
+      <<" in prefix "<<prefix<<std::endl;
+    return false;
+  }
+  MPI_Bcast(&header,sizeof(header),MPI_BYTE,0,comm);
+  const int32_t nranks = header.nranks;
+  totalnbodies = header.totalnbodies;
+
+  if(nranks == size){
+    // Same decomposition: read my own file
+    checkpointFilename(filename,prefix,iteration,rank);
+    bool ok = readCheckpointHeader(filename,header) && header.rank == rank;
+    if(ok){
+      bodies.resize(header.nbodies);
+      ok = readCheckpointBodies(filename,0,header.nbodies,bodies.data());
+    }
+    if(!ok){
+      clog(error)<<rank<<": cannot read checkpoint "<<filename<<std::endl;
+      FULLSTOP;
+    }
+  }else{
+    // Different decomposition: reassign the key ranges. My slice of the
+    // key-sorted particles is [start,end)
+    int64_t start = totalnbodies/size*rank + std::min<int64_t>(rank,
+      totalnbodies%size);
+    int64_t end = start + totalnbodies/size + (rank<totalnbodies%size);
+    bodies.resize(end-start);
+    for(int32_t r = 0; r < nranks && start < end; ++r){
+      checkpoint_header_t rheader;
+      checkpointFilename(filename,prefix,iteration,r);
+      if(!readCheckpointHeader(filename,rheader)){
+        clog(error)<<rank<<": cannot read checkpoint "<<filename<<std::endl;
+        FULLSTOP;
+      }
+      int64_t rstart = rheader.offset;
+      int64_t rend = rheader.offset + rheader.nbodies;
+      if(rend <= start || rstart >= end)
+        continue;
+      const int64_t first = std::max(start,rstart);
+      const int64_t last = std::min(end,rend);
+      if(!readCheckpointBodies(filename,first-rstart,last-first,
+          bodies.data()+(first-start))){
+        clog(error)<<rank<<": cannot read checkpoint "<<filename<<std::endl;
+        FULLSTOP;
+      }
+    }
+    clog_one(warn)<<"Checkpoint written on "<<nranks<<" ranks, read on "
+      <<size<<" ranks"<<std::endl;
+  }
+  nbodies = bodies.size();
+
+  // Restore the run state
+  physics::iteration = header.iteration;
+  physics::totaltime = header.totaltime;
+  physics::dt = header.timestep;
+  output_step = header.output_step;
+  for(int i = 0; i < 2; ++i)
+    for(size_t d = 0; d < gdimension; ++d)
+      range[i][d] = header.range[i][d];
+
+#ifdef DEBUG
+  int64_t checknbodies = nbodies;
+  MPI_Allreduce(MPI_IN_PLACE,&checknbodies,1,MPI_INT64_T,MPI_SUM,comm);
+  assert(checknbodies == totalnbodies);
+#endif
 
-}// outputDataHDF5
+  clog_one(trace)<<".done"<<std::endl;
+  return true;
+}
 
 } // namespace io
 
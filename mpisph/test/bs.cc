@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 #include <mpi.h>
 
 #include "bodies_system.h"
@@ -36,3 +37,73 @@ TEST(body_system, write_range_read) {
   bs.write_bodies(fileprefix,0,0);
 
 }
+
+// The symmetric traversal gives the density of the regular one
+TEST(body_system, symmetric_density) {
+
+  const char * fileprefix = "io_test";
+
+  body_system<double,gdimension> bs;
+  bs.read_bodies(fileprefix,fileprefix,0);
+  kernels::select();
+  bs.update_iteration();
+
+  bs.apply_in_smoothinglength(physics::compute_density);
+  std::vector<double> rho;
+  for(auto& b: bs.getLocalbodies())
+    rho.push_back(b.getDensity());
+
+  bs.reset_ghosts();
+  bs.apply_in_smoothinglength_symmetric<double>(
+    physics::pair_density,physics::finalize_density);
+  auto& bodies = bs.getLocalbodies();
+  ASSERT_EQ(bodies.size(),rho.size());
+  for(size_t i = 0; i < bodies.size(); ++i)
+    ASSERT_NEAR(bodies[i].getDensity(),rho[i],1.e-12*rho[i]);
+
+}
+
+// The ghosts read in the node shared segments give the neighbors and the
+// density of the requested ones
+TEST(body_system, node_shared_ghosts) {
+
+  const char * fileprefix = "io_test";
+
+  std::vector<double> rho[2];
+  std::vector<std::vector<int64_t>> neighbors[2];
+  for(int shared = 0; shared < 2; ++shared){
+    param::_node_shared_ghosts = shared;
+    body_system<double,gdimension> bs;
+    bs.read_bodies(fileprefix,fileprefix,0);
+    kernels::select();
+    bs.update_iteration();
+
+    auto& bodies = bs.getLocalbodies();
+    neighbors[shared].resize(bodies.size());
+    // The first traversal of the tree requests the ghosts, the second one
+    // reads the ghosts of the node in the segments
+    for(int traversal = 0; traversal < 2; ++traversal){
+      if(traversal > 0)
+        bs.reset_ghosts();
+      bs.apply_in_smoothinglength(
+        [&](body& particle, std::vector<body*>& nbs){
+          auto& ids = neighbors[shared][&particle-bodies.data()];
+          ids.clear();
+          for(auto nb: nbs)
+            ids.push_back(nb->id());
+          std::sort(ids.begin(),ids.end());
+          physics::compute_density(particle,nbs);
+        });
+    }
+    for(auto& b: bodies)
+      rho[shared].push_back(b.getDensity());
+  }
+  param::_node_shared_ghosts = false;
+
+  ASSERT_EQ(rho[0].size(),rho[1].size());
+  for(size_t i = 0; i < rho[0].size(); ++i){
+    ASSERT_TRUE(neighbors[0][i] == neighbors[1][i]);
+    ASSERT_NEAR(rho[1][i],rho[0][i],1.e-12*rho[0][i]);
+  }
+
+}
@@ -66,3 +66,198 @@ TEST(io, write_N_read) {
   remove(filename);
 
 }
+
+TEST(io, async_write_N_read) {
+
+  int rank,size;
+  MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+  MPI_Comm_size(MPI_COMM_WORLD,&size);
+
+  const char * fileprefix = "io_async_utest";
+  const char * filename = "io_async_utest.h5part";
+
+  size_t n = 1000;
+  std::vector<body> bodies(n);
+  for(size_t i = 0; i < n; ++i){
+    point_t p = {
+      (double)rand()/(double)RAND_MAX,
+      (double)rand()/(double)RAND_MAX,
+      (double)rand()/(double)RAND_MAX};
+    bodies[i].set_coordinates(p);
+    bodies[i].set_mass(1.0);
+    bodies[i].set_radius(1.0);
+  }
+
+  // Write in background, the bodies can be modified after the push
+  io::output_step = 0;
+  {
+    io::async_writer writer;
+    writer.push(bodies,fileprefix,0,0.);
+    for(auto& b: bodies)
+      b.set_mass(2.0);
+    writer.finish();
+  }
+
+  std::vector<body> rbodies;
+  int64_t totalnbodies = 0;
+  int64_t localnbodies = 0;
+  io::inputDataHDF5(rbodies,fileprefix,fileprefix,totalnbodies,localnbodies,0);
+
+  ASSERT_TRUE(localnbodies == n);
+  ASSERT_TRUE(totalnbodies == n*size);
+  for(auto& b: rbodies)
+    ASSERT_TRUE(b.mass() == 1.0);
+
+  remove(filename);
+
+}
+
+TEST(io, checkpoint_N_restart) {
+
+  int rank,size;
+  MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+  MPI_Comm_size(MPI_COMM_WORLD,&size);
+
+  const char * fileprefix = "io_ckpt_utest";
+
+  size_t n = 1000;
+  std::vector<body> bodies(n);
+  for(size_t i = 0; i < n; ++i){
+    point_t p = {
+      (double)rand()/(double)RAND_MAX,
+      (double)rand()/(double)RAND_MAX,
+      (double)rand()/(double)RAND_MAX};
+    bodies[i].set_coordinates(p);
+    bodies[i].set_mass(1.0);
+    bodies[i].set_radius(1.0);
+  }
+  std::array<point_t,2> range = {point_t{},point_t{1.,1.,1.}};
+
+  physics::dt = 0.5;
+  io::outputCheckpoint(bodies,fileprefix,10,2.0,range);
+  physics::dt = 0.;
+
+  std::vector<body> rbodies;
+  int64_t totalnbodies = 0;
+  int64_t localnbodies = 0;
+  std::array<point_t,2> rrange;
+  ASSERT_TRUE(io::inputCheckpoint(rbodies,fileprefix,10,
+    totalnbodies,localnbodies,rrange));
+
+  ASSERT_TRUE(localnbodies == n);
+  ASSERT_TRUE(totalnbodies == n*size);
+  ASSERT_TRUE(physics::iteration == 10);
+  ASSERT_TRUE(physics::totaltime == 2.0);
+  ASSERT_TRUE(physics::dt == 0.5);
+  ASSERT_TRUE(rrange[0] == range[0]);
+  ASSERT_TRUE(rrange[1] == range[1]);
+  for(size_t i = 0; i < n; ++i)
+    ASSERT_TRUE(rbodies[i].coordinates() == bodies[i].coordinates());
+
+  // Missing checkpoint is reported
+  ASSERT_FALSE(io::inputCheckpoint(rbodies,fileprefix,11,
+    totalnbodies,localnbodies,rrange));
+
+  char filename[io::MAX_FNAME_LEN];
+  io::checkpointFilename(filename,fileprefix,10,rank);
+  MPI_Barrier(MPI_COMM_WORLD);
+  remove(filename);
+
+}
+
+TEST(io, checkpoint_N_restart_M) {
+
+  int rank,size;
+  MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+  MPI_Comm_size(MPI_COMM_WORLD,&size);
+
+  const char * fileprefix = "io_ckpt_nm_utest";
+
+  // Write on the first size-1 ranks, rank r holds the global indices
+  // [r*n,(r+1)*n) in x
+  const int nwriters = std::max(1,size-1);
+  const int64_t n = 1000 + rank;
+  MPI_Comm wcomm;
+  MPI_Comm_split(MPI_COMM_WORLD,rank < nwriters ? 0 : MPI_UNDEFINED,rank,
+    &wcomm);
+  int64_t first = 0;
+  for(int r = 0; r < rank; ++r)
+    first += 1000 + r;
+  std::array<point_t,2> range = {point_t{-1.,-2.,-3.},point_t{1.,2.,3.}};
+  if(wcomm != MPI_COMM_NULL){
+    std::vector<body> bodies(n);
+    for(int64_t i = 0; i < n; ++i){
+      point_t p = {(double)(first+i),0.,0.};
+      bodies[i].set_coordinates(p);
+      bodies[i].set_mass(1.0);
+    }
+    io::outputCheckpoint(bodies,fileprefix,20,3.0,range,wcomm);
+    MPI_Comm_free(&wcomm);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  // Read on all the ranks: contiguous slices of the global indices
+  std::vector<body> rbodies;
+  int64_t totalnbodies = 0;
+  int64_t localnbodies = 0;
+  std::array<point_t,2> rrange;
+  ASSERT_TRUE(io::inputCheckpoint(rbodies,fileprefix,20,
+    totalnbodies,localnbodies,rrange));
+
+  int64_t total = 0;
+  for(int r = 0; r < nwriters; ++r)
+    total += 1000 + r;
+  ASSERT_TRUE(totalnbodies == total);
+  int64_t start = total/size*rank + std::min<int64_t>(rank,total%size);
+  ASSERT_TRUE(localnbodies == total/size + (rank<total%size));
+  for(int64_t i = 0; i < localnbodies; ++i){
+    ASSERT_TRUE(rbodies[i].coordinates()[0] == (double)(start+i));
+    ASSERT_TRUE(rbodies[i].mass() == 1.0);
+  }
+  ASSERT_TRUE(physics::iteration == 20);
+  ASSERT_TRUE(physics::totaltime == 3.0);
+  ASSERT_TRUE(rrange[0] == range[0]);
+  ASSERT_TRUE(rrange[1] == range[1]);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  if(rank < nwriters){
+    char filename[io::MAX_FNAME_LEN];
+    io::checkpointFilename(filename,fileprefix,20,rank);
+    remove(filename);
+  }
+
+}
+
+TEST(io, step_index) {
+
+  const char * fileprefix = "io_index_utest";
+  const char * filename = "io_index_utest.h5part";
+
+  size_t n = 100;
+  std::vector<body> bodies(n);
+  for(size_t i = 0; i < n; ++i){
+    point_t p = {
+      (double)rand()/(double)RAND_MAX,
+      (double)rand()/(double)RAND_MAX,
+      (double)rand()/(double)RAND_MAX};
+    bodies[i].set_coordinates(p);
+    bodies[i].set_mass(1.0);
+    bodies[i].set_radius(1.0);
+  }
+
+  // Three steps in the same file
+  io::output_step = 0;
+  io::outputDataHDF5(bodies,fileprefix,0,0.);
+  io::outputDataHDF5(bodies,fileprefix,5,0.5);
+  io::outputDataHDF5(bodies,fileprefix,10,1.0);
+
+  hid_t dataFile = io::H5P_openFile(filename,H5F_ACC_RDONLY);
+  ASSERT_TRUE(io::H5P_findIterationStep(dataFile,0) == 0);
+  ASSERT_TRUE(io::H5P_findIterationStep(dataFile,10) == 2);
+  ASSERT_TRUE(io::H5P_findIterationStep(dataFile,7) == -1);
+  H5Fclose(dataFile);
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  remove(filename);
+
+}
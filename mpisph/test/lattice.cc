@@ -0,0 +1,69 @@
+#include <cinchdevel.h>
+#include <cinchtest.h>
+
+#include <iostream>
+#include <vector>
+#include <mpi.h>
+
+#include "params.h"
+#include "lattice.h"
+
+using namespace ::testing;
+
+namespace flecsi{
+  namespace execution{
+    void driver(int argc, char* argv[]){
+    }
+  }
+}
+
+// The sub-blocks of the ranks are the serial lattice, split in order
+void check_partition(int lattice_type, int domain_type, double sep) {
+  int rank, size;
+  MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+  MPI_Comm_size(MPI_COMM_WORLD,&size);
+  const int lattice_type_saved = param::lattice_type;
+  param::_lattice_type = lattice_type;
+  particle_lattice::select();
+  point_t bbox_min, bbox_max;
+  bbox_min = -1.;
+  bbox_max = 1.;
+
+  const int64_t n = particle_lattice::count(lattice_type,domain_type,
+      bbox_min,bbox_max,sep,0);
+  std::vector<double> X(n), Y(n), Z(n);
+  particle_lattice::generate(lattice_type,domain_type,bbox_min,bbox_max,
+      sep,0,X.data(),Y.data(),Z.data());
+
+  particle_lattice::block_t block = particle_lattice::partition(lattice_type,
+      domain_type,bbox_min,bbox_max,sep);
+  ASSERT_EQ(block.total,n);
+  std::vector<double> x(block.nlocal), y(block.nlocal), z(block.nlocal);
+  ASSERT_EQ(block.nlocal,particle_lattice::generate_block(lattice_type,
+      domain_type,bbox_min,bbox_max,sep,block,0,x.data(),y.data(),z.data()));
+  for(int64_t i = 0; i < block.nlocal; ++i) {
+    ASSERT_EQ(x[i],X[block.offset+i]);
+    ASSERT_EQ(y[i],Y[block.offset+i]);
+    ASSERT_EQ(z[i],Z[block.offset+i]);
+  }
+
+  // Contiguous over the ranks
+  int64_t next = block.offset + block.nlocal, sum = block.nlocal;
+  std::vector<int64_t> offsets(size);
+  MPI_Allgather(&next,1,MPI_INT64_T,offsets.data(),1,MPI_INT64_T,
+      MPI_COMM_WORLD);
+  if(rank > 0)
+    ASSERT_EQ(offsets[rank-1],block.offset);
+  MPI_Allreduce(MPI_IN_PLACE,&sum,1,MPI_INT64_T,MPI_SUM,MPI_COMM_WORLD);
+  ASSERT_EQ(sum,n);
+
+  param::_lattice_type = lattice_type_saved;
+  particle_lattice::select();
+}
+
+TEST(lattice, partition) {
+  for(int lattice_type = 0; lattice_type < 3; ++lattice_type)
+    for(int domain_type = 0; domain_type < 2; ++domain_type)
+      check_partition(lattice_type,domain_type,2./24);
+  check_partition(3,1,2./24);
+}
@@ -0,0 +1,95 @@
+#include <cinchdevel.h>
+#include <cinchtest.h>
+
+#include <iostream>
+#include <cmath>
+#include <mpi.h>
+
+#include "utils.h"
+
+namespace flecsi{
+  namespace execution{
+    void driver(int argc, char* argv[]){
+    }
+  }
+}
+
+// Element of the exchanges: source rank, destination rank and index
+struct element_t {
+  int64_t source;
+  int64_t dest;
+  int64_t index;
+};
+
+inline
+bool
+operator== (
+  const element_t& a,
+  const element_t& b)
+{
+  return a.source == b.source && a.dest == b.dest && a.index == b.index;
+}
+
+// The split and point to point paths, taken past mpi_max_count, give the
+// results of the single MPI calls
+TEST(mpi_utils, alltoallv_max_count) {
+
+  int rank,size;
+  MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+  MPI_Comm_size(MPI_COMM_WORLD,&size);
+
+  std::vector<int64_t> sendcount(size);
+  std::vector<element_t> send;
+  for(int d = 0; d < size; ++d){
+    sendcount[d] = (rank*7+d*3)%11;
+    for(int64_t i = 0; i < sendcount[d]; ++i)
+      send.push_back({rank,d,i});
+  }
+
+  std::vector<element_t> recv, recvsplit;
+  mpi_utils::mpi_alltoallv(sendcount,send,recv);
+  const int64_t max_count = mpi_utils::mpi_max_count;
+  mpi_utils::mpi_max_count = 3;
+  mpi_utils::mpi_alltoallv(sendcount,send,recvsplit);
+  mpi_utils::mpi_max_count = max_count;
+
+  size_t p = 0;
+  for(int s = 0; s < size; ++s)
+    for(int64_t i = 0; i < (s*7+rank*3)%11; ++i, ++p){
+      ASSERT_TRUE(p < recv.size());
+      ASSERT_TRUE(recv[p] == (element_t{s,rank,i}));
+    }
+  ASSERT_EQ(p,recv.size());
+  ASSERT_TRUE(recvsplit == recv);
+
+}
+
+TEST(mpi_utils, allgatherv_max_count) {
+
+  int rank,size;
+  MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+  MPI_Comm_size(MPI_COMM_WORLD,&size);
+
+  std::vector<element_t> send;
+  for(int64_t i = 0; i < rank+2; ++i)
+    send.push_back({rank,-1,i});
+
+  std::vector<element_t> recv, recvsplit;
+  std::vector<int64_t> count, countsplit;
+  mpi_utils::mpi_allgatherv(send,recv,count);
+  const int64_t max_count = mpi_utils::mpi_max_count;
+  mpi_utils::mpi_max_count = 3;
+  mpi_utils::mpi_allgatherv(send,recvsplit,countsplit);
+  mpi_utils::mpi_max_count = max_count;
+
+  size_t p = 0;
+  for(int s = 0; s < size; ++s){
+    ASSERT_EQ(count[s],s+2);
+    for(int64_t i = 0; i < s+2; ++i, ++p)
+      ASSERT_TRUE(recv[p] == (element_t{s,-1,i}));
+  }
+  ASSERT_EQ(p,recv.size());
+  ASSERT_TRUE(countsplit == count);
+  ASSERT_TRUE(recvsplit == recv);
+
+}
@@ -111,7 +111,7 @@ public:
   */
   void mpi_qsort(
     std::vector<body>& rbodies,
-    int totalnbodies)
+    int64_t totalnbodies)
   {
     int size, rank;
     MPI_Comm_size(MPI_COMM_WORLD,&size);
@@ -142,7 +142,7 @@ public:
     } // if
 
     std::vector<std::pair<entity_key_t,int64_t>> splitters;
-    std::vector<int> scount(size);
+    std::vector<int64_t> scount(size);
     generate_splitters_samples(splitters,rbodies,totalnbodies);
 
     int cur_proc = 0;
@@ -150,7 +150,7 @@ public:
     assert(splitters.size() == size-1+2);
 
     int64_t nbodies = rbodies.size();
-    for(size_t i = 0L ; i < nbodies; ++i){
+    for(int64_t i = 0L ; i < nbodies; ++i){
       if(rbodies[i].key() >= splitters[cur_proc].first &&
         rbodies[i].key() < splitters[cur_proc+1].first){
           scount[cur_proc]++;
@@ -161,14 +161,14 @@ public:
     }
 
     // Check that we considered all the bodies
-    assert( std::accumulate(scount.begin(), scount.end(), 0) == rbodies.size());
+    assert( std::accumulate(scount.begin(), scount.end(), int64_t(0)) ==
+      nbodies);
 
     std::vector<body> recvbuffer;
     // Direct exchange using point to point
     mpi_alltoallv_p2p(scount,rbodies,recvbuffer);
 
-    rbodies.clear();
-    rbodies = recvbuffer;
+    rbodies = std::move(recvbuffer);
 
 // Sort the bodies after reception
 #ifdef BOOST_PARALLEL
@@ -188,11 +188,11 @@ public:
       }); // sort
 
 #ifdef OUTPUT
-    std::vector<int> totalprocbodies;
+    std::vector<int64_t> totalprocbodies;
     totalprocbodies.resize(size);
-    int mybodies = rbodies.size();
+    int64_t mybodies = rbodies.size();
     // Share the final array size of everybody
-    MPI_Allgather(&mybodies,1,MPI_INT,&totalprocbodies[0],1,MPI_INT,
+    MPI_Allgather(&mybodies,1,MPI_INT64_T,&totalprocbodies[0],1,MPI_INT64_T,
       MPI_COMM_WORLD);
     #ifdef OUTPUT_TREE_INFO
     std::ostringstream oss;
@@ -205,6 +205,63 @@ public:
   } // mpi_qsort
 
 
+  /**
+   * @brief      Compute the distribution of mpi_qsort but only exchange the
+   * indices of the particles, not the bodies. Used to read the initial data
+   * directly on their owner.
+   *
+   * @param      rbodies       The local bodies with their key and their
+   *                           index in the input as id
+   * @param[in]  totalnbodies  The total number of bodies
+   * @param      indices       The indices of the bodies of this process
+   */
+  void mpi_qsort_indices(
+    std::vector<body>& rbodies,
+    int64_t totalnbodies,
+    std::vector<int64_t>& indices)
+  {
+    int size, rank;
+    MPI_Comm_size(MPI_COMM_WORLD,&size);
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+
+    std::sort(rbodies.begin(),rbodies.end(),
+        [](auto& left, auto& right){
+        if(left.key() < right.key()){
+          return true;
+        }
+        if(left.key() == right.key()){
+          return left.id() < right.id();
+        }
+        return false;
+      }); // sort
+
+    indices.resize(rbodies.size());
+    for(size_t i = 0; i < rbodies.size(); ++i)
+      indices[i] = rbodies[i].id();
+    if(size==1)
+      return;
+
+    std::vector<std::pair<entity_key_t,int64_t>> splitters;
+    generate_splitters_samples(splitters,rbodies,totalnbodies);
+
+    std::vector<int64_t> scount(size);
+    int cur_proc = 0;
+    int64_t nbodies = rbodies.size();
+    for(int64_t i = 0L ; i < nbodies; ++i){
+      if(rbodies[i].key() >= splitters[cur_proc].first &&
+        rbodies[i].key() < splitters[cur_proc+1].first){
+          scount[cur_proc]++;
+        }else{
+          i--;
+          cur_proc++;
+        }
+    }
+
+    std::vector<int64_t> rindices;
+    mpi_alltoallv(scount,indices,rindices);
+    indices = std::move(rindices);
+  } // mpi_qsort_indices
+
   /**
    * @brief      Exchange the useful branches of the current tree of the procs.
    * There is several ways to share. Here we look for the particles in the
@@ -453,11 +510,11 @@ public:
     // the master.
     size_t maxnsamples = noct/sizeof(std::pair<entity_key_t,int64_t>);
     int64_t nvalues = rbodies.size();
-    size_t nsample = maxnsamples*((double)nvalues/(double)totalnbodies);
+    int nsample = maxnsamples*((double)nvalues/(double)totalnbodies);
 
     if(nvalues<(int64_t)nsample){nsample = nvalues;}
 
-    for(size_t i=0;i<nsample;++i){
+    for(int i=0;i<nsample;++i){
       int64_t position = (nvalues/(nsample+1.))*(i+1.);
       keys_sample.push_back(std::make_pair(rbodies[position].key(),
       rbodies[position].id()));
@@ -467,7 +524,7 @@ public:
     std::vector<std::pair<entity_key_t,int64_t>> master_keys;
     std::vector<int> master_recvcounts;
     std::vector<int> master_offsets;
-    int master_nkeys = 0;
+    int64_t master_nkeys = 0;
 
     if(rank==0){
       master_recvcounts.resize(size);
@@ -482,7 +539,7 @@ public:
     if(rank == 0){
       master_offsets.resize(size);
       master_nkeys = std::accumulate(
-        master_recvcounts.begin(),master_recvcounts.end(),0);
+        master_recvcounts.begin(),master_recvcounts.end(),int64_t(0));
       if(totalnbodies<master_nkeys){master_nkeys=totalnbodies;}
       // Number to receiv from each process
       for(int i=0;i<size;++i){
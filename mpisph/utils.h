@@ -26,9 +26,12 @@
 #ifndef _mpisph_utils_
 #define _mpisph_utils_
 
+#include <algorithm>
+#include <limits>
 #include <numeric>
 
 #include "tree.h"
+#include "mpi_type.h"
 
 // Local version of assert to handle MPI abort
 #define mpi_assert( assertion )  ((assertion) ? true : \
@@ -38,6 +41,46 @@
 
 namespace mpi_utils{
 
+  // Largest count or displacement of one MPI call, in elements. The tests
+  // lower it to run the split and point to point exchanges on small data.
+  int64_t mpi_max_count = std::numeric_limits<int>::max();
+
+  /**
+   * @brief      Non blocking send of count elements, split in messages of at
+   * most mpi_max_count elements. The requests are added to requests.
+   */
+  template<
+    typename M>
+  void
+  mpi_isend(
+    const M * buffer,
+    int64_t count,
+    int dest,
+    std::vector<MPI_Request>& requests)
+  {
+    for(int64_t first = 0; first < count; first += mpi_max_count){
+      requests.emplace_back();
+      MPI_Isend(buffer+first,std::min(count-first,mpi_max_count),
+        mpi_type<M>(),dest,0,MPI_COMM_WORLD,&requests.back());
+    }
+  }
+
+  /**
+   * @brief      Receive the count elements sent by mpi_isend
+   */
+  template<
+    typename M>
+  void
+  mpi_recv(
+    M * buffer,
+    int64_t count,
+    int source)
+  {
+    for(int64_t first = 0; first < count; first += mpi_max_count)
+      MPI_Recv(buffer+first,std::min(count-first,mpi_max_count),
+        mpi_type<M>(),source,0,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+  }
+
   /**
    * @brief Simple version of all gather
    * Send the size of arrays and then the all gather operation
@@ -48,7 +91,7 @@ namespace mpi_utils{
   mpi_allgatherv(
     const std::vector<M>& send,
     std::vector<M>& recv,
-    std::vector<int>& count = 0)
+    std::vector<int64_t>& count)
   {
     int size, rank;
     MPI_Comm_rank(MPI_COMM_WORLD,&rank);
@@ -57,31 +100,89 @@ namespace mpi_utils{
     count.clear();
     count.resize(size);
 
-    int my_count = send.size();
+    int64_t my_count = send.size();
     // Gather the total size
-    MPI_Allgather(&my_count,1,MPI_INT,&count[0],1,MPI_INT,MPI_COMM_WORLD);
-    // Convert to byte
-    std::vector<int> count_byte(size);
-    std::vector<int> offset_byte(size);
-    int64_t total = 0L;
-
-#pragma omp parallel for reduction(+:total)
-    for(int i = 0; i < size; ++i){
-      total += count[i];
-      count_byte[i] = count[i]*sizeof(M);
+    MPI_Allgather(&my_count,1,MPI_INT64_T,&count[0],1,MPI_INT64_T,
+      MPI_COMM_WORLD);
+    std::vector<int64_t> offset(size+1,0);
+    std::partial_sum(count.begin(),count.end(),offset.begin()+1);
+    recv.resize(offset.back());
+
+    MPI_Datatype type = mpi_type<M>();
+    if(offset.back() <= mpi_max_count){
+      std::vector<int> icount(count.begin(),count.end());
+      std::vector<int> ioffset(offset.begin(),offset.end()-1);
+      MPI_Allgatherv(send.data(),my_count,type,recv.data(),&icount[0],
+        &ioffset[0],type,MPI_COMM_WORLD);
+    }else{
+      // The displacements do not fit in int: each rank broadcasts its part
+      std::copy(send.begin(),send.end(),recv.begin()+offset[rank]);
+      for(int r = 0; r < size; ++r)
+        for(int64_t first = 0; first < count[r]; first += mpi_max_count)
+          MPI_Bcast(&recv[offset[r]+first],
+            std::min(count[r]-first,mpi_max_count),type,r,MPI_COMM_WORLD);
     }
-    std::partial_sum(count_byte.begin(),count_byte.end(),&offset_byte[0]);
-    offset_byte.insert(offset_byte.begin(),0);
-    recv.resize(total);
+  }
+
+  /**
+   * @brief      Exchange the counts of an all to all and generate the
+   * offsets of the send and receive buffers
+   */
+  void
+  mpi_alltoallv_counts(
+      const std::vector<int64_t>& sendcount,
+      std::vector<int64_t>& recvcount,
+      std::vector<int64_t>& sendoffsets,
+      std::vector<int64_t>& recvoffsets)
+  {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD,&size);
+    recvcount.resize(size);
+    // Exchange the send count
+    MPI_Alltoall(&sendcount[0],1,MPI_INT64_T,&recvcount[0],1,MPI_INT64_T,
+      MPI_COMM_WORLD);
+    // Exclusive scans, the last offset is the total
+    sendoffsets.assign(size+1,0);
+    recvoffsets.assign(size+1,0);
+    std::partial_sum(sendcount.begin(),sendcount.end(),sendoffsets.begin()+1);
+    std::partial_sum(recvcount.begin(),recvcount.end(),recvoffsets.begin()+1);
+  }
 
-    MPI_Allgatherv(&send[0],count_byte[rank],MPI_BYTE,&recv[0],&count_byte[0],
-        &offset_byte[0],MPI_BYTE,MPI_COMM_WORLD);
+  /**
+   * @brief      Point to point part of the all to all, once the counts and
+   * offsets are known
+   */
+  template<
+    typename M>
+  void
+  mpi_alltoallv_p2p(
+      const std::vector<int64_t>& sendcount,
+      const std::vector<int64_t>& sendoffsets,
+      const std::vector<M>& sendbuffer,
+      const std::vector<int64_t>& recvcount,
+      const std::vector<int64_t>& recvoffsets,
+      std::vector<M>& recvbuffer
+    )
+  {
+    int size;
+    MPI_Comm_size(MPI_COMM_WORLD,&size);
+    std::vector<std::vector<MPI_Request>> requests(size);
+#pragma omp parallel for
+    for(int i = 0 ; i < size; ++i){
+      mpi_isend(sendbuffer.data()+sendoffsets[i],sendcount[i],i,requests[i]);
+    }
+#pragma omp parallel for
+    for(int i = 0 ; i < size; ++i){
+      mpi_recv(recvbuffer.data()+recvoffsets[i],recvcount[i],i);
+      MPI_Waitall(requests[i].size(),requests[i].data(),MPI_STATUSES_IGNORE);
+    }
   }
 
   /**
  * @brief      Simple version of all to all
  * Use to generate the offsets and do the pre exchange
- * Then realise the MPI_Alltoall call
+ * Then realise the MPI_Alltoall call. When the counts or displacements do
+ * not fit in int, the exchange is done point to point.
  *
  * @param[in]  sendcount   The sendcount
  * @param      sendbuffer  The sendbuffer
@@ -93,107 +194,56 @@ namespace mpi_utils{
     typename M>
   void
   mpi_alltoallv(
-      std::vector<int> sendcount,
-      std::vector<M>& sendbuffer,
+      const std::vector<int64_t>& sendcount,
+      const std::vector<M>& sendbuffer,
       std::vector<M>& recvbuffer
     )
   {
-    int rank, size;
-    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
-    MPI_Comm_size(MPI_COMM_WORLD,&size);
-
-    std::vector<int> recvcount(size);
-    std::vector<int> recvoffsets(size);
-    std::vector<int> sendoffsets(size);
-
-    // Exchange the send count
-    MPI_Alltoall(&sendcount[0],1,MPI_INT,&recvcount[0],1,MPI_INT,
-      MPI_COMM_WORLD);
-
-    // Generate the send and recv offsets
-    std::partial_sum(recvcount.begin(),recvcount.end(),&recvoffsets[0]);
-    // As we need an exscan, add a zero
-    recvoffsets.insert(recvoffsets.begin(),0);
-
-    // Then send offsets
-    std::partial_sum(sendcount.begin(),sendcount.end(),&sendoffsets[0]);
-    // As we need an exscan, add a zero
-    sendoffsets.insert(sendoffsets.begin(),0);
+    std::vector<int64_t> recvcount, sendoffsets, recvoffsets;
+    mpi_alltoallv_counts(sendcount,recvcount,sendoffsets,recvoffsets);
 
     // Set the recvbuffer to the right size
     recvbuffer.resize(recvoffsets.back());
 
-    // Trnaform the offsets for bytes
-#pragma omp parallel for
-    for(int i=0;i<size;++i){
-      sendcount[i] *= sizeof(M);
-      assert(sendcount[i]>=0);
-      recvcount[i] *= sizeof(M);
-      assert(recvcount[i]>=0);
-      sendoffsets[i] *= sizeof(M);
-      assert(sendoffsets[i]>=0);
-      recvoffsets[i] *= sizeof(M);
-      assert(recvoffsets[i]>=0);
-    } // for
+    // All the ranks take the same path
+    int64_t total = std::max(sendoffsets.back(),recvoffsets.back());
+    MPI_Allreduce(MPI_IN_PLACE,&total,1,MPI_INT64_T,MPI_MAX,MPI_COMM_WORLD);
+    if(total > mpi_max_count){
+      mpi_alltoallv_p2p(sendcount,sendoffsets,sendbuffer,recvcount,
+        recvoffsets,recvbuffer);
+      return;
+    }
 
+    std::vector<int> isendcount(sendcount.begin(),sendcount.end());
+    std::vector<int> irecvcount(recvcount.begin(),recvcount.end());
+    std::vector<int> isendoffsets(sendoffsets.begin(),sendoffsets.end()-1);
+    std::vector<int> irecvoffsets(recvoffsets.begin(),recvoffsets.end()-1);
+    MPI_Datatype type = mpi_type<M>();
     // Use this array for the global buckets communication
-    MPI_Alltoallv(&sendbuffer[0],&sendcount[0],&sendoffsets[0],MPI_BYTE,
-      &recvbuffer[0],&recvcount[0],&recvoffsets[0],MPI_BYTE,MPI_COMM_WORLD);
+    MPI_Alltoallv(sendbuffer.data(),&isendcount[0],&isendoffsets[0],type,
+      recvbuffer.data(),&irecvcount[0],&irecvoffsets[0],type,MPI_COMM_WORLD);
   }
 
+  /**
+   * @brief      All to all using point to point communications, for any
+   * count of elements
+   */
   template<
     typename M>
   void
   mpi_alltoallv_p2p(
-      std::vector<int>& sendcount,
-      std::vector<M>& sendbuffer,
+      const std::vector<int64_t>& sendcount,
+      const std::vector<M>& sendbuffer,
       std::vector<M>& recvbuffer
     )
   {
-    int rank, size;
-    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
-    MPI_Comm_size(MPI_COMM_WORLD,&size);
-
-    std::vector<int> recvcount(size), recvoffsets(size), sendoffsets(size);
-    // Exchange the send count
-    MPI_Alltoall(&sendcount[0],1,MPI_INT,&recvcount[0],1,MPI_INT,
-      MPI_COMM_WORLD);
-    std::partial_sum(recvcount.begin(),recvcount.end(),&recvoffsets[0]);
-    recvoffsets.insert(recvoffsets.begin(),0);
-    std::partial_sum(sendcount.begin(),sendcount.end(),&sendoffsets[0]);
-    sendoffsets.insert(sendoffsets.begin(),0);
+    std::vector<int64_t> recvcount, sendoffsets, recvoffsets;
+    mpi_alltoallv_counts(sendcount,recvcount,sendoffsets,recvoffsets);
     // Set the recvbuffer to the right size
     recvbuffer.resize(recvoffsets.back());
-    // Transform the offsets for bytes
-#pragma omp parallel for
-    for(int i=0;i<size;++i){
-      sendcount[i] *= sizeof(M);assert(sendcount[i]>=0);
-      recvcount[i] *= sizeof(M);assert(recvcount[i]>=0);
-      sendoffsets[i] *= sizeof(M);assert(sendoffsets[i]>=0);
-      recvoffsets[i] *= sizeof(M);assert(recvoffsets[i]>=0);
-    } // for
-    std::vector<MPI_Status> status(size);
-    std::vector<MPI_Request> request(size);
-#pragma omp parallel for
-    for(int i = 0 ; i < size; ++i){
-      if(sendcount[i] != 0){
-        char * start = (char*)&(sendbuffer[0]);
-        MPI_Isend(start+sendoffsets[i],sendcount[i],MPI_BYTE,
-            i,0,MPI_COMM_WORLD,&request[i]);
-      }
-    }
-#pragma omp parallel for
-    for(int i = 0 ; i < size; ++i){
-      if(recvcount[i] != 0){
-        char * start = (char*)&(recvbuffer[0]);
-        MPI_Recv(start+recvoffsets[i],recvcount[i],MPI_BYTE,
-            i,MPI_ANY_TAG,MPI_COMM_WORLD,&status[i]);
-      }
-      if(sendcount[i] != 0){
-        MPI_Wait(&request[i],&status[i]);
-      }
-    }
-} // mpi_alltoallv_p2p
+    mpi_alltoallv_p2p(sendcount,sendoffsets,sendbuffer,recvcount,recvoffsets,
+      recvbuffer);
+  } // mpi_alltoallv_p2p
 
 
 
@@ -363,7 +413,7 @@ namespace mpi_utils{
   )
   {
     int size;
-    const int sizeofT = sizeof(T);
+    MPI_Datatype type = mpi_type<T>();
     MPI_Comm_size(MPI_COMM_WORLD,&size);
 
     MPI_Request request;
@@ -371,7 +421,7 @@ namespace mpi_utils{
       // I send
       if(rank < partner){
         // Send size
-        MPI_Isend(&(buffer[0]),nsend*sizeofT,MPI_BYTE,partner,1,
+        MPI_Isend(&(buffer[0]),nsend,type,partner,1,
           MPI_COMM_WORLD,&request);
       }else{
         MPI_Status status;
@@ -379,16 +429,16 @@ namespace mpi_utils{
         MPI_Probe(partner,1,MPI_COMM_WORLD,&status);
         // Get the size
         int nrecv = 0;
-        MPI_Get_count(&status, MPI_BYTE, &nrecv);
-        buffer.resize(buffer.size()+nrecv/sizeofT);
-        MPI_Recv(&(buffer[last]), nrecv, MPI_BYTE, partner, 1,
+        MPI_Get_count(&status, type, &nrecv);
+        buffer.resize(buffer.size()+nrecv);
+        MPI_Recv(&(buffer[last]), nrecv, type, partner, 1,
            MPI_COMM_WORLD, MPI_STATUS_IGNORE);
         last = buffer.size();
       }
       // Other rank send
       if(rank > partner){
         // Send size
-        MPI_Isend(&(buffer[0]),nsend*sizeofT,MPI_BYTE,partner,1,
+        MPI_Isend(&(buffer[0]),nsend,type,partner,1,
           MPI_COMM_WORLD,&request);
       }else{
         MPI_Status status;
@@ -396,9 +446,9 @@ namespace mpi_utils{
         MPI_Probe(partner,1,MPI_COMM_WORLD,&status);
         // Get the size
         int nrecv = 0;
-        MPI_Get_count(&status, MPI_BYTE, &nrecv);
-        buffer.resize(buffer.size()+nrecv/sizeofT);
-        MPI_Recv(&(buffer[last]), nrecv, MPI_BYTE, partner, 1,
+        MPI_Get_count(&status, type, &nrecv);
+        buffer.resize(buffer.size()+nrecv);
+        MPI_Recv(&(buffer[last]), nrecv, type, partner, 1,
            MPI_COMM_WORLD, MPI_STATUS_IGNORE);
         last = buffer.size();
       }
@@ -19,6 +19,13 @@ import sys
 import argparse
 
 
+# The components above the problem dimension are not written: zeros
+def coordinate(step, name):
+    if name in step.keys():
+        return step[name].value
+    return np.zeros(step['x'].len())
+
+
 def create_output(dataset):
     print dataset
 
@@ -27,17 +34,17 @@ def create_output(dataset):
     i = int(s)
 
     # Get data from datasets 
-    x_data   = file[k]['x']
-    y_data   = file[k]['y']
-    z_data   = file[k]['z']
+    x_data   = file[k]['x'].value
+    y_data   = coordinate(file[k],'y')
+    z_data   = coordinate(file[k],'z')
     rho_data = file[k]['rho']
     P_data   = file[k]['P']
     u_data   = file[k]['u']
     
     # Coordinates of center 
     x_c = (file['Step#0']['x'].value.min() + file['Step#0']['x'].value.max())/2.0 
-    y_c = (file['Step#0']['y'].value.min() + file['Step#0']['y'].value.max())/2.0
-    z_c = (file['Step#0']['z'].value.min() + file['Step#0']['z'].value.max())/2.0
+    y_c = (coordinate(file['Step#0'],'y').min() + coordinate(file['Step#0'],'y').max())/2.0
+    z_c = (coordinate(file['Step#0'],'z').min() + coordinate(file['Step#0'],'z').max())/2.0
     
     # Calculate radial distance
     x_rc = x_data - x_c
@@ -76,4 +83,5 @@ if args.step is not None:
 # Otherwise, iterate over time steps
 else:
     for k in iter(file.keys()):
-        create_output(k)
+        if k.startswith('Step#'):
+            create_output(k)
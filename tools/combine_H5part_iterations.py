@@ -34,36 +34,11 @@ for f in args.file:
 			done = True
 			continue
 		grp = out.create_group("/Step#"+str(out_step))
-		dset = h5_in[dataset+"/P"]
-		grp.create_dataset("P",data=dset)
-		dsetX = h5_in[dataset+"/x"]
-		grp.create_dataset("x",data=dsetX)
-		dsetY = h5_in[dataset+"/y"]
-		grp.create_dataset("y",data=dsetY)
-		dsetZ = h5_in[dataset+"/z"]
-		grp.create_dataset("z",data=dsetZ)
-		dset = h5_in[dataset+"/vx"]
-		grp.create_dataset("vx",data=dset)
-		dset = h5_in[dataset+"/vy"]
-		grp.create_dataset("vy",data=dset)
-		dset = h5_in[dataset+"/vz"]
-		grp.create_dataset("vz",data=dset)
-		dset = h5_in[dataset+"/ax"]
-		grp.create_dataset("ax",data=dset)
-		dset = h5_in[dataset+"/ay"]
-		grp.create_dataset("ay",data=dset)
-		dset = h5_in[dataset+"/az"]
-		grp.create_dataset("az",data=dset)
-		dsetD = h5_in[dataset+"/density"]
-		grp.create_dataset("density",data=dsetD)
-		dsetM = h5_in[dataset+"/mass"]
-		grp.create_dataset("mass",data=dsetM)
-		dsetH = h5_in[dataset+"/h"]
-		grp.create_dataset("h",data=dsetH)
-		dsetU = h5_in[dataset+"/u"]
-		grp.create_dataset("u",data=dsetU)
-		dsetID = h5_in[dataset+"/id"]
-		grp.create_dataset("id",data=dsetID)
+		# Copy the datasets of the step, y and z are only in 2D and 3D
+		for name in h5_in[dataset].keys():
+			grp.create_dataset(name,data=h5_in[dataset+"/"+name])
+		for name in h5_in[dataset].attrs.keys():
+			grp.attrs[name] = h5_in[dataset].attrs[name]
 
 		out_step = out_step + 1
 		in_step = in_step + 1
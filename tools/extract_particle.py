@@ -38,9 +38,9 @@ except:
   except:
     sys.exit ("ERROR: cannot determine file dimensionality")
 
-# access the data
-key_step = h5file.keys()[0]
-Nsteps = len(h5file.keys())
+# access the data, the StepIndex dataset is not a step
+Nsteps = len([k for k in h5file.keys() if k.startswith('Step#')])
+key_step = "Step#0"
 dset = h5file[key_step]
 Npart = dset['x'].len()
 if args.pid < 1 or args.pid > Npart:
@@ -55,6 +55,14 @@ print ("# Particle %d" % args.pid)
 print ("# 1:iteration 2:time 3:x 4:y 5:z 6:rho 7:P 8:u 9:vx 10:vy 11:vz")
 print ("# 12:ax 13:ay 14:az 15:h 16:m 17:dt 18:pnum 19:rank 20:type")
 
+# value of a particle field, 0 if the field is not in the output
+# (see the out_h5data_fields parameter)
+def field(dset, name, buf, pn):
+  if name not in dset.keys():
+    return 0
+  dset[name].read_direct(buf)
+  return buf[pn]
+
 # main output loop
 for step in range(Nsteps):
   key_step = ("Step#%d" % step)
@@ -64,28 +72,13 @@ for step in range(Nsteps):
   dset['id'].read_direct(ids)
   pn = np.where(ids == args.pid)[0][0]
   
-  dset['x'].read_direct(xyz); x = xyz[pn]
-  dset['y'].read_direct(xyz); y = xyz[pn]
-  dset['z'].read_direct(xyz); z = xyz[pn]
-  
-  dset['rho'].read_direct(xyz); rho = xyz[pn]
-  dset['P'  ].read_direct(xyz); P = xyz[pn]
-  dset['u'  ].read_direct(xyz); u = xyz[pn]
-  
-  dset['vx'].read_direct(xyz); vx = xyz[pn]
-  dset['vy'].read_direct(xyz); vy = xyz[pn]
-  dset['vz'].read_direct(xyz); vz = xyz[pn]
-  
-  dset['ax'].read_direct(xyz); ax = xyz[pn]
-  dset['ay'].read_direct(xyz); ay = xyz[pn]
-  dset['az'].read_direct(xyz); az = xyz[pn]
-  
-  dset['h'].read_direct(xyz); h = xyz[pn]
-  dset['m'].read_direct(xyz); m = xyz[pn]
-  dset['dt'].read_direct(xyz); dt = xyz[pn]
-
-  dset['rank'].read_direct(ids); rank = ids[pn]
-  dset['type'].read_direct(ids); ptype= ids[pn]
+  x,y,z = field(dset,'x',xyz,pn), field(dset,'y',xyz,pn), field(dset,'z',xyz,pn)
+  rho,P,u = field(dset,'rho',xyz,pn), field(dset,'P',xyz,pn), field(dset,'u',xyz,pn)
+  vx,vy,vz = field(dset,'vx',xyz,pn), field(dset,'vy',xyz,pn), field(dset,'vz',xyz,pn)
+  ax,ay,az = field(dset,'ax',xyz,pn), field(dset,'ay',xyz,pn), field(dset,'az',xyz,pn)
+  h,m,dt = field(dset,'h',xyz,pn), field(dset,'m',xyz,pn), field(dset,'dt',xyz,pn)
+  rank = field(dset,'rank',ids,pn)
+  ptype = field(dset,'type',ids,pn)
 
   print ((" % 9d % 14.7e    % 14.7e % 14.7e % 14.7e % 14.7e % 14.7e % 14.7e"+ 
           " % 14.7e % 14.7e % 14.7e % 14.7e % 14.7e % 14.7e % 14.7e % 14.7e"+
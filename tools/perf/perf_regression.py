@@ -0,0 +1,262 @@
+#!/usr/bin/env python
+"""
+Performance regression harness on the physics test problems of
+app/drivers/test (sodtube, sedov, noh, implosion, RT).
+
+Each run generates the initial data of the problem at a lattice size, runs
+the hydro driver with mpirun and OpenMP threads, then reads the per-phase
+timers of the driver (timers.csv, max over the ranks, summed over the
+iterations) and the peak resident memory of the ranks.
+
+  check    run the cases and compare with the baselines, exit 1 on
+           regression (time above baseline*(1+tol), memory above
+           baseline*(1+mem-tol))
+  update   run the cases and store them as the new baselines
+  scaling  strong and weak scaling sweeps of one problem on this node,
+           written as strong_<case>.csv and weak_<case>.csv
+
+Example:
+  perf_regression.py check --build-dir build
+  perf_regression.py scaling --build-dir build --case sedov --nx 40 \\
+      --max-ranks 16
+"""
+
+import argparse
+import csv
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import time
+
+# name: dimension, parameter file, generator, sizes (lattice_nx)
+CASES = {
+  "sodtube":   (1, "sodtube_t1_n100.par", "sodtube_1d_generator", [100, 400]),
+  "sedov":     (2, "sedov_nx20.par",      "sedov_2d_generator",   [20, 40]),
+  "noh":       (2, "noh_nx20.par",        "noh_2d_generator",     [20, 40]),
+  "implosion": (2, "implosion_nx20.par",  "implosion_2d_generator", [20, 40]),
+  "RT":        (2, "RT_2d.par",           "RT_2d_generator",      [30, 60]),
+}
+
+# ranks x threads
+DEFAULT_CONFIGS = "1x1,2x1,2x2"
+
+# Phases shorter than this are too noisy to be compared
+MIN_SECONDS = 0.05
+
+
+def find_executable(build_dir, name):
+  for root, dirs, files in os.walk(build_dir):
+    if name in files:
+      path = os.path.join(root, name)
+      if os.access(path, os.X_OK):
+        return os.path.abspath(path)
+  sys.exit("ERROR: cannot find " + name + " in " + build_dir)
+
+
+# Runs a command and prints the peak memory of its descendants on stderr,
+# isolated from the other runs of the harness
+MEASURE = """
+import resource, subprocess, sys
+code = subprocess.call(sys.argv[1:], stdout=subprocess.DEVNULL)
+sys.stderr.write("maxrss_kb=%d\\n" %
+    resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss)
+sys.exit(code)
+"""
+
+
+def run_measured(command, cwd, env):
+  """ Run the command, return the wall time and the peak memory in kB """
+  start = time.time()
+  p = subprocess.run([sys.executable, "-c", MEASURE] + command, cwd=cwd,
+      env=env, stderr=subprocess.PIPE, universal_newlines=True)
+  wall = time.time() - start
+  if p.returncode != 0:
+    sys.stderr.write(p.stderr)
+    sys.exit("ERROR: " + " ".join(command) + " failed in " + cwd)
+  return wall, int(re.findall(r"maxrss_kb=(\d+)", p.stderr)[-1])
+
+
+def write_parfile(source, target, overrides):
+  """ Copy the parameter file, replacing or appending the overrides """
+  lines = open(source).read().splitlines()
+  done = set()
+  for i, line in enumerate(lines):
+    m = re.match(r"\s*(\w+)\s*=", line)
+    if m and m.group(1) in overrides:
+      lines[i] = "  %s = %s" % (m.group(1), overrides[m.group(1)])
+      done.add(m.group(1))
+  for key, value in overrides.items():
+    if key not in done:
+      lines.append("  %s = %s" % (key, value))
+  open(target, "w").write("\n".join(lines) + "\n")
+
+
+def read_timers(filename):
+  """ Sum over the iterations of the max over the ranks of each phase """
+  phases = {}
+  with open(filename) as f:
+    for row in csv.DictReader(f):
+      phases[row["phase"]] = phases.get(row["phase"], 0.) + float(row["max"])
+  return phases
+
+
+def run_case(args, case, nx, ranks, threads):
+  """ Generate the initial data and run the driver in a scratch directory """
+  dim, parfile, generator, sizes = CASES[case]
+  key = "%s/nx%d/np%d/t%d" % (case, nx, ranks, threads)
+  workdir = os.path.join(args.work_dir, key.replace("/", "_"))
+  shutil.rmtree(workdir, ignore_errors=True)
+  os.makedirs(workdir)
+  write_parfile(os.path.join(args.source_dir, "data", parfile),
+      os.path.join(workdir, "perf.par"), {
+      "initial_data_prefix": '"perf_initial"',
+      "output_h5data_prefix": '"perf_output"',
+      "lattice_nx": nx,
+      "final_iteration": args.iterations,
+      "out_scalar_every": 1,
+      "out_h5data_every": 0,
+      "out_checkpoint_every": 0})
+
+  env = dict(os.environ, OMP_NUM_THREADS=str(threads))
+  mpirun = args.mpirun.split()
+  subprocess.check_call(mpirun + ["-np", "1",
+      find_executable(args.build_dir, generator), "perf.par"],
+      cwd=workdir, env=env, stdout=subprocess.DEVNULL)
+
+  # The peak memory of the descendants is the largest rank of the driver
+  wall, maxrss = run_measured(mpirun + ["-np", str(ranks),
+      find_executable(args.build_dir, "hydro_%dd" % dim), "perf.par"],
+      workdir, env)
+
+  result = {"wall": wall, "maxrss_kb": maxrss,
+      "phases": read_timers(os.path.join(workdir, "timers.csv"))}
+  print("%-32s wall %8.3fs  maxrss %8d kB" % (key, wall, maxrss))
+  return key, result
+
+
+def configurations(args):
+  for case in args.case:
+    sizes = args.nx if args.nx else CASES[case][3]
+    for nx in sizes:
+      for config in args.configs.split(","):
+        ranks, threads = [int(v) for v in config.split("x")]
+        yield case, nx, ranks, threads
+
+
+def compare(key, result, baseline, args):
+  """ List of the regressions of a run against its baseline """
+  regressions = []
+  for phase, seconds in sorted(baseline["phases"].items()):
+    if seconds < MIN_SECONDS or phase not in result["phases"]:
+      continue
+    ratio = result["phases"][phase] / seconds
+    if ratio > 1. + args.tol:
+      regressions.append("%s %s: %.3fs vs %.3fs (x%.2f)" %
+          (key, phase, result["phases"][phase], seconds, ratio))
+  if result["maxrss_kb"] > baseline["maxrss_kb"] * (1. + args.mem_tol):
+    regressions.append("%s maxrss: %d kB vs %d kB" %
+        (key, result["maxrss_kb"], baseline["maxrss_kb"]))
+  return regressions
+
+
+def check(args):
+  baselines = {}
+  if os.path.exists(args.baselines):
+    baselines = json.load(open(args.baselines))
+  regressions = []
+  for case, nx, ranks, threads in configurations(args):
+    key, result = run_case(args, case, nx, ranks, threads)
+    if key not in baselines:
+      print("WARNING: no baseline for " + key)
+      continue
+    regressions += compare(key, result, baselines[key], args)
+  for r in regressions:
+    print("REGRESSION: " + r)
+  return 1 if regressions else 0
+
+
+def update(args):
+  baselines = {}
+  if os.path.exists(args.baselines):
+    baselines = json.load(open(args.baselines))
+  for case, nx, ranks, threads in configurations(args):
+    key, result = run_case(args, case, nx, ranks, threads)
+    baselines[key] = result
+  json.dump(baselines, open(args.baselines, "w"), indent=2, sort_keys=True)
+  print("Baselines written in " + args.baselines)
+  return 0
+
+
+def scaling_table(filename, rows, weak):
+  """ rows: (ranks, threads, nx, result), relative to the first row """
+  base = rows[0][3]["wall"]
+  with open(filename, "w") as f:
+    out = csv.writer(f)
+    out.writerow(["ranks", "threads", "nx", "wall", "speedup", "efficiency",
+        "update_iteration", "traversal_sph", "maxrss_kb"])
+    for ranks, threads, nx, result in rows:
+      wall = result["wall"]
+      speedup = base / wall
+      efficiency = speedup if weak else speedup / ranks
+      out.writerow([ranks, threads, nx, "%.3f" % wall, "%.3f" % speedup,
+          "%.3f" % efficiency,
+          "%.3f" % result["phases"].get("update_iteration", 0.),
+          "%.3f" % result["phases"].get("traversal_sph", 0.),
+          result["maxrss_kb"]])
+  print("Scaling table written in " + filename)
+
+
+def scaling(args):
+  for case in args.case:
+    dim = CASES[case][0]
+    nx = args.nx[0] if args.nx else CASES[case][3][0]
+    ranks = [1]
+    while ranks[-1] * 2 <= args.max_ranks:
+      ranks.append(ranks[-1] * 2)
+    # Strong: same problem; weak: same number of particles per rank
+    strong = [(r, args.threads, nx,
+        run_case(args, case, nx, r, args.threads)[1]) for r in ranks]
+    scaling_table("strong_%s.csv" % case, strong, False)
+    weak = []
+    for r in ranks:
+      wnx = int(round(nx * r ** (1. / dim)))
+      weak.append((r, args.threads, wnx,
+          run_case(args, case, wnx, r, args.threads)[1]))
+    scaling_table("weak_%s.csv" % case, weak, True)
+  return 0
+
+
+parser = argparse.ArgumentParser(
+    description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+parser.add_argument("mode", choices=["check", "update", "scaling"])
+parser.add_argument("--build-dir", default=".",
+    help="build tree containing the drivers and generators")
+parser.add_argument("--source-dir",
+    default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", ".."),
+    help="source tree, for the parameter files of data/")
+parser.add_argument("--baselines",
+    default=os.path.join(os.path.dirname(os.path.abspath(__file__)),
+    "baselines.json"))
+parser.add_argument("--work-dir", default="perf_runs")
+parser.add_argument("--case", nargs="+", default=sorted(CASES.keys()),
+    choices=sorted(CASES.keys()))
+parser.add_argument("--nx", nargs="+", type=int,
+    help="lattice sizes, default to the sizes of each case")
+parser.add_argument("--configs", default=DEFAULT_CONFIGS,
+    help="comma separated ranks x threads, default " + DEFAULT_CONFIGS)
+parser.add_argument("--iterations", type=int, default=20)
+parser.add_argument("--tol", type=float, default=0.2,
+    help="tolerated relative slowdown of a phase")
+parser.add_argument("--mem-tol", type=float, default=0.1,
+    help="tolerated relative increase of the peak memory")
+parser.add_argument("--max-ranks", type=int, default=os.cpu_count())
+parser.add_argument("--threads", type=int, default=1)
+parser.add_argument("--mpirun", default="mpirun")
+args = parser.parse_args()
+args.work_dir = os.path.abspath(args.work_dir)
+args.build_dir = os.path.abspath(args.build_dir)
+
+sys.exit({"check": check, "update": update, "scaling": scaling}[args.mode](args))
@@ -4,15 +4,15 @@
 #SBATCH --error=err_strong_scaling
 #SBATCH --time=02:00:00
 #SBATCH --extra-node-info="1:16:1"
-# TODO: add description
+# Strong scaling of the micro-benchmarks: same lattice on 1 to 16 ranks,
+# one JSON file per rank count
 
 echo "Running Strong Scaling"
-START=200000
+PARFILE=./bin/bench/bench.par
 
 for i in `seq 1 16`
 do
   echo "Working on $i"
-  echo "time mpirun -np $i ./bin/tree_mpilegion $START"
-  time mpirun -np $i ./bin/tree_mpilegion $START
+  echo "mpirun -np $i ./bin/bench/bench_3d $PARFILE bench_strong_$i.json"
+  mpirun -np $i ./bin/bench/bench_3d $PARFILE bench_strong_$i.json
 done
-
@@ -4,17 +4,18 @@
 #SBATCH --error=err_weak_scaling
 #SBATCH --time=02:00:00
 #SBATCH --extra-node-info="1:16:1"
-# TODO: add header and description
+# Weak scaling of the micro-benchmarks: the lattice grows with the number
+# of ranks (lattice_nx = NX*i^(1/3)), one JSON file per rank count
 
 echo "Running Weak Scaling"
-START=200000
-ADD=200000
+PARFILE=./bin/bench/bench.par
+NX=40
 
 for i in `seq 1 16`
 do
   echo "Working on $i"
-  echo "time mpirun -np $i ./bin/tree_mpilegion $START"
-  time mpirun -np $i ./bin/tree_mpilegion $START
-  ((START = START + ADD))
+  nx=`awk -v n=$NX -v i=$i 'BEGIN{printf "%d", n*i^(1./3.)+0.5}'`
+  sed "s/lattice_nx *= *[0-9]*/lattice_nx = $nx/" $PARFILE > bench_weak_$i.par
+  echo "mpirun -np $i ./bin/bench/bench_3d bench_weak_$i.par bench_weak_$i.json"
+  mpirun -np $i ./bin/bench/bench_3d bench_weak_$i.par bench_weak_$i.json
 done
-
@@ -41,7 +41,11 @@ def write_xdmf_timestep (in_h5file, out_xdmfile, in_fname, key_step, ndim):
   out_xdmfile.write("""
     <Grid>""")
   dset = in_h5file[key_step]
-  Npart = dset['x'].len()
+  # the y and z components are only written up to the problem dimension
+  Npart = dset[list(dset.keys())[0]].len()
+  # precision of the datasets, floats with out_h5data_single_precision
+  for var in vps:
+    if var in dset.keys(): vps[var]['size'] = dset[var].dtype.itemsize
 
   # -- 1D --------- ---------------------
   if ndim == 1:
@@ -172,6 +176,14 @@ def stepLabelSort (stepLabel):
   # Step#23 -> 23
   return int(stepLabel[5:])
 
+#
+# ## FUNCTION TO LIST STEP LABELS
+#    skips the other root objects, e.g. the StepIndex dataset
+#
+def stepLabels (h5file):
+  return sorted([k for k in h5file.keys() if k.startswith('Step#')],
+                key=stepLabelSort)
+
 ########################
 my_desc = """
 Creates an XDMF wrapper for one or multiple H5Part files"""
@@ -274,12 +286,11 @@ if multiple_files_mode:
       h5file = h5py.File(ifname,'r')
     except:
       sys.exit ("ERROR: cannot read input file %s" % ifname)
-    steps = h5file.keys()
+    steps = stepLabels(h5file)
     write_xdmf_timestep (h5file, xdmfile, ifname, steps[0], ndim)
 
 else:
-  steps = h5file.keys()
-  steps.sort(key=stepLabelSort)
+  steps = stepLabels(h5file)
   for key_step in steps:
     write_xdmf_timestep (h5file, xdmfile, ifname, key_step, ndim)
 